@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+void DieWithError(char *errorMessage);
+void ForwardSignal(int signalType);
+
+volatile sig_atomic_t childPID = 0; /* 計測対象のサーバのプロセスID */
+
+int main(int argc, char *argv[])
+{
+    struct sigaction handler; /* シグナルハンドラ */
+    struct rusage usage;      /* 子プロセスの資源使用量 */
+    int status;               /* 子プロセスの終了ステータス */
+    pid_t pid;                /* fork()の戻り値 */
+    int devNull;              /* /dev/nullのファイルディスクリプタ */
+
+    /* 引数の数が正しいか確認 */
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <Server Program> [<Server Args>...]\n", argv[0]);
+        exit(1);
+    }
+
+    /* SIGTERMとSIGINTはサーバに転送する。
+       サーバが子プロセスを回収してから終了すれば、その分も計測に含まれる */
+    handler.sa_handler = ForwardSignal;
+    if (sigfillset(&handler.sa_mask) < 0)
+    {
+        DieWithError("sigfillset() failed");
+    }
+    handler.sa_flags = 0;
+    if (sigaction(SIGTERM, &handler, 0) < 0 || sigaction(SIGINT, &handler, 0) < 0)
+    {
+        DieWithError("sigaction() failed");
+    }
+
+    if ((pid = fork()) < 0)
+    {
+        DieWithError("fork() failed");
+    }
+    else if (pid == 0)
+    {
+        /* 子プロセス: サーバの標準出力は捨てる */
+        if ((devNull = open("/dev/null", O_WRONLY)) >= 0)
+        {
+            dup2(devNull, STDOUT_FILENO);
+            close(devNull);
+        }
+        execvp(argv[1], &argv[1]);
+        DieWithError("execvp() failed");
+    }
+    childPID = pid;
+
+    /* サーバが終了するまで待つ */
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            DieWithError("waitpid() failed");
+        }
+    }
+
+    /* 終了した子孫プロセスの資源使用量を出力する。
+       ru_maxrssは合計ではなく、最も大きかったプロセスの値 */
+    if (getrusage(RUSAGE_CHILDREN, &usage) < 0)
+    {
+        DieWithError("getrusage() failed");
+    }
+    printf("%ld,%ld,%ld\n", usage.ru_maxrss, usage.ru_nvcsw, usage.ru_nivcsw);
+
+    return 0;
+}
+
+void ForwardSignal(int signalType)
+{
+    if (childPID > 0)
+    {
+        kill(childPID, SIGTERM);
+    }
+}
+
+void DieWithError(char *errorMessage)
+{
+    perror(errorMessage);
+    exit(1);
+}
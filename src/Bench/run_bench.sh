@@ -0,0 +1,134 @@
+#!/bin/sh
+# 全てのエコーサーバをビルドし、ループバック上で同じ負荷生成クライアントから計測する。
+#
+#   ./run_bench.sh [<出力ファイル名（拡張子なし）: default bench>]
+#
+# 環境変数で計測の条件を変えられる:
+#   DURATION    1回の計測時間（秒）              default 5
+#   CONNS       同時接続数の一覧                 default "1 16 64"
+#   SIZES       ペイロードのバイト数の一覧       default "32 1024 16384"
+#   SERVERS     計測するサーバの一覧             default 全て
+#   LOADTHREADS 負荷生成クライアントのスレッド数 default 1
+#   PORT        最初に使うポート番号             default 9700
+#   CC, CFLAGS  コンパイラとオプション
+#
+# 結果は <出力ファイル名>.csv と <出力ファイル名>.json に、サーバの標準エラー出力は
+# <出力ファイル名>.log に書き出す。
+
+set -eu
+
+SRC=$(cd "$(dirname "$0")/.." && pwd)
+OUT=${1:-bench}
+DURATION=${DURATION:-5}
+CONNS=${CONNS:-"1 16 64"}
+SIZES=${SIZES:-"32 1024 16384"}
+LOADTHREADS=${LOADTHREADS:-1}
+PORT=${PORT:-9700}
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:-"-O2 -Wall -Wno-error=incompatible-pointer-types -Wno-error=implicit-function-declaration"}
+
+# サーバの一覧: 名前 プロトコル 種類 引数 ソースファイル...
+#   種類 iterative: 1度に1つの接続しか扱えないので接続数1だけ計測する
+#        small:     ECHOMAX が255バイトなのでペイロード255バイト以下だけ計測する
+#        any:       全ての組み合わせを計測する
+#   引数 サーバに渡す引数をカンマで区切ったもの。%p はポート、%c は同時接続数に置き換える
+#        （ワーカー数が固定のモデルは、接続数分のワーカーを用意しないと残りの接続が待たされ続ける）
+ALLSERVERS="
+tcp-iterative   tcp iterative %p    TCP-Echo/TCPEchoServer.c
+tcp-non-threads tcp iterative %p    Threads/TCPEchoServer-non-Threads.c
+tcp-threads     tcp any       %p    Threads/TCPEchoServer-Threads.c Threads/TCPEchoServer.c Threads/Admission.c Threads/ConnTable.c Threads/Metrics.c Threads/Log.c TCP-Echo/Listener.c
+tcp-threadpool  tcp any       %p,%c Threads/TCPEchoServer-ThreadPool.c Threads/MPMCQueue.c Threads/TCPEchoServer.c Threads/Admission.c Threads/ConnTable.c Threads/Metrics.c Threads/Log.c TCP-Echo/Listener.c
+tcp-splice      tcp any       %p    Threads/TCPEchoServer-splice.c Threads/TCPEchoServer.c Threads/Admission.c Threads/ConnTable.c Threads/Metrics.c Threads/Log.c TCP-Echo/Listener.c
+tcp-fork        tcp any       %p    Multitask/TCPEchoServer-fork.c Multitask/TCPEchoServer.c TCP-Echo/Listener.c
+tcp-prefork     tcp any       %p,%c Multitask/TCPEchoServer-prefork.c Multitask/TCPEchoServer.c TCP-Echo/Listener.c
+tcp-epoll       tcp any       %p    EventLoop/TCPEchoServer-epoll.c EventLoop/TCPEchoServer.c EventLoop/EpollReactor.c EventLoop/BufferPool.c EventLoop/TimerWheel.c EventLoop/Shutdown.c TCP-Echo/Listener.c
+tcp-reuseport   tcp any       %p    EventLoop/TCPEchoServer-reuseport.c EventLoop/TCPEchoServer.c EventLoop/EpollReactor.c EventLoop/BufferPool.c EventLoop/TimerWheel.c EventLoop/Shutdown.c TCP-Echo/Listener.c
+tcp-uring       tcp any       %p    EventLoop/TCPEchoServer-uring.c EventLoop/TCPEchoServer.c EventLoop/UringReactor.c EventLoop/IoUring.c EventLoop/TimerWheel.c TCP-Echo/Listener.c
+udp             udp small     %p    UDP-Echo/UDPEchoServer.c
+udp-sigio       udp small     %p    NonblockingIO/UDPEchoServer-SIGIO.c Threads/Log.c
+udp-mmsg        udp any       %p    UDP-Echo/UDPEchoServer-mmsg.c
+udp-reuseport   udp any       %p    UDP-Echo/UDPEchoServer-reuseport.c
+udp-epoll       udp any       %p    NonblockingIO/UDPEchoServer-epoll.c
+"
+SERVERS=${SERVERS:-$(echo "$ALLSERVERS" | awk 'NF { print $1 }')}
+
+BUILD=$(mktemp -d)
+trap 'rm -rf "$BUILD"' EXIT
+
+# ビルド
+echo "building into $BUILD" >&2
+$CC $CFLAGS -o "$BUILD/TCPEchoLoadGen" "$SRC/TCP-Echo/TCPEchoLoadGen.c" "$SRC/TCP-Echo/Histogram.c" -lpthread
+$CC $CFLAGS -o "$BUILD/BenchExec" "$SRC/Bench/BenchExec.c"
+for name in $SERVERS; do
+    line=$(echo "$ALLSERVERS" | awk -v n="$name" '$1 == n')
+    if [ -z "$line" ]; then
+        echo "unknown server: $name" >&2
+        exit 1
+    fi
+    srcs=$(echo "$line" | awk '{ for (i = 5; i <= NF; i++) printf "%s/%s ", src, $i }' src="$SRC")
+    $CC $CFLAGS -o "$BUILD/$name" $srcs -lpthread
+done
+
+# JSONの1行からキーの値を取り出す
+json_get() {
+    echo "$1" | sed -n "s/.*\"$2\":\"\{0,1\}\([^,\"}]*\).*/\1/p"
+}
+
+echo "server,proto,connections,payload,req_per_sec,mb_per_sec,p50_us,p99_us,p999_us,max_us,errors,max_rss_kb,vol_ctx,invol_ctx" > "$OUT.csv"
+echo "[" > "$OUT.json"
+: > "$OUT.log"
+first=1
+
+for name in $SERVERS; do
+    set -- $(echo "$ALLSERVERS" | awk -v n="$name" '$1 == n { print $2, $3, $4 }')
+    proto=$1
+    kind=$2
+    args=$3
+    udpflag=""
+    [ "$proto" = udp ] && udpflag="-u"
+
+    for conns in $CONNS; do
+        [ "$kind" = iterative ] && [ "$conns" -ne 1 ] && continue
+        for size in $SIZES; do
+            [ "$kind" = small ] && [ "$size" -gt 255 ] && continue
+            [ "$proto" = udp ] && [ "$size" -gt 65507 ] && continue
+
+            # 計測ごとにサーバを起動し直し、ポートも変えてTIME_WAITの影響を避ける
+            PORT=$((PORT + 1))
+            "$BUILD/BenchExec" "$BUILD/$name" $(echo "$args" | sed "s/%p/$PORT/; s/%c/$conns/; s/,/ /g") > "$BUILD/rusage" 2>> "$OUT.log" &
+            execpid=$!
+            sleep 0.5
+
+            threads=$LOADTHREADS
+            [ "$threads" -gt "$conns" ] && threads=$conns
+            result=$(timeout $((DURATION + 30)) "$BUILD/TCPEchoLoadGen" $udpflag -j -c "$conns" -t "$threads" -d "$DURATION" -s "$size" 127.0.0.1 "$PORT" || true)
+
+            kill -TERM "$execpid" 2>/dev/null || true
+            wait "$execpid" || true
+            rusage=$(cat "$BUILD/rusage")
+            [ -z "$rusage" ] && rusage=",,"
+            [ -z "$result" ] && result='{"req_per_sec":0,"mb_per_sec":0,"p50_us":0,"p99_us":0,"p999_us":0,"max_us":0,"errors":-1}'
+
+            row="$name,$proto,$conns,$size"
+            for key in req_per_sec mb_per_sec p50_us p99_us p999_us max_us errors; do
+                row="$row,$(json_get "$result" $key)"
+            done
+            row="$row,$rusage"
+            echo "$row" >> "$OUT.csv"
+            echo "$row" >&2
+
+            [ $first -eq 0 ] && echo "," >> "$OUT.json"
+            first=0
+            echo "$rusage" | awk -F, -v n="$name" -v p="$proto" -v c="$conns" -v s="$size" -v r="$result" '{
+                sub(/^\{/, "", r); sub(/\}$/, "", r);
+                gsub(/"(proto|connections|payload)":[^,]*,/, "", r);
+                printf "{\"server\":\"%s\",\"proto\":\"%s\",\"connections\":%d,\"payload\":%d,%s,\"max_rss_kb\":%s,\"vol_ctx\":%s,\"invol_ctx\":%s}",
+                       n, p, c, s, r, ($1 == "" ? "null" : $1), ($2 == "" ? "null" : $2), ($3 == "" ? "null" : $3)
+            }' >> "$OUT.json"
+        done
+    done
+done
+
+echo "" >> "$OUT.json"
+echo "]" >> "$OUT.json"
+echo "wrote $OUT.csv $OUT.json" >&2
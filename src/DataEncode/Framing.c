@@ -0,0 +1,327 @@
+#include "Framing.h"
+
+void FrameReaderInit(struct FrameReader *reader, int format, size_t maxFrame)
+{
+    memset(reader, 0, sizeof(struct FrameReader));
+    reader->size = FRAME_INITBUF;
+    reader->maxFrame = maxFrame;
+    reader->format = format;
+    if ((reader->buffer = (char *)malloc(reader->size)) == NULL)
+    {
+        DieWithError("malloc() failed");
+    }
+}
+
+void FrameReaderFree(struct FrameReader *reader)
+{
+    free(reader->buffer);
+    reader->buffer = NULL;
+}
+
+/* 受信バッファの空きにrecv()する。戻り値はrecv()と同じ。
+   FrameReaderNext()が返したポインタは、この呼び出しで無効になる */
+ssize_t FrameReaderRecv(struct FrameReader *reader, int sock)
+{
+    size_t newSize; /* 広げた後のバッファサイズ */
+    ssize_t rcvd;   /* 受信したバイト数 */
+
+    if (reader->head == reader->tail)
+    {
+        /* 未処理データがなければ先頭から使い直す。大きなフレームで広げたバッファは元に戻す */
+        reader->head = reader->tail = 0;
+        if (reader->size > FRAME_INITBUF)
+        {
+            free(reader->buffer);
+            reader->size = FRAME_INITBUF;
+            if ((reader->buffer = (char *)malloc(reader->size)) == NULL)
+            {
+                DieWithError("malloc() failed");
+            }
+        }
+    }
+    else if (reader->tail == reader->size || reader->head + reader->need > reader->size)
+    {
+        /* 途中まで届いたフレームだけを先頭に詰める（処理済みのフレームはコピーしない） */
+        memmove(reader->buffer, reader->buffer + reader->head, reader->tail - reader->head);
+        reader->tail -= reader->head;
+        reader->head = 0;
+
+        /* フレームがバッファに収まらなければ、全体が入る大きさまで広げる */
+        newSize = reader->size;
+        while (newSize < reader->need || newSize == reader->tail)
+        {
+            newSize *= 2;
+        }
+        if (newSize != reader->size)
+        {
+            if ((reader->buffer = (char *)realloc(reader->buffer, newSize)) == NULL)
+            {
+                DieWithError("realloc() failed");
+            }
+            reader->size = newSize;
+        }
+    }
+
+    if ((rcvd = recv(sock, reader->buffer + reader->tail, reader->size - reader->tail, 0)) > 0)
+    {
+        reader->tail += rcvd;
+    }
+    return rcvd;
+}
+
+/* 受信済みのデータから次のフレームを1つ取り出す。
+   取り出せれば1、続きの受信が必要なら0、長さヘッダが不正なら-1を返す */
+int FrameReaderNext(struct FrameReader *reader, char **payload, size_t *payloadLen)
+{
+    unsigned char *p = (unsigned char *)reader->buffer + reader->head; /* 未処理データの先頭 */
+    size_t avail = reader->tail - reader->head;                         /* 未処理データのバイト数 */
+    uint64_t frameLen;                                                  /* ペイロードの長さ */
+    int headerLen;                                                      /* 長さヘッダのバイト数 */
+
+    if (reader->format == FRAME_FIXED32)
+    {
+        if (avail < 4)
+        {
+            return 0;
+        }
+        frameLen = GetUint32(p);
+        headerLen = 4;
+    }
+    else
+    {
+        headerLen = GetVarint(p, avail < FRAME_MAXHDR ? avail : FRAME_MAXHDR, &frameLen);
+        if (headerLen == 0)
+        {
+            /* FRAME_MAXHDRバイト読んでも終わらない長さヘッダは不正 */
+            return avail < FRAME_MAXHDR ? 0 : -1;
+        }
+        if (headerLen < 0)
+        {
+            return -1;
+        }
+    }
+
+    if (frameLen > reader->maxFrame)
+    {
+        return -1;
+    }
+
+    if (avail < headerLen + frameLen)
+    {
+        /* 残りが届くまで待つ。全長を覚えておき、次の受信の前にバッファを用意する */
+        reader->need = headerLen + frameLen;
+        return 0;
+    }
+
+    *payload = (char *)p + headerLen;
+    *payloadLen = frameLen;
+    reader->head += headerLen + frameLen;
+    reader->need = 0;
+    return 1;
+}
+
+/* 長さヘッダをheader（FRAME_MAXHDRバイト以上）に書き込み、そのバイト数を返す */
+int FrameEncodeHeader(int format, uint32_t payloadLen, unsigned char *header)
+{
+    if (format == FRAME_FIXED32)
+    {
+        return PutUint32(header, payloadLen) - header;
+    }
+    return PutVarint(header, payloadLen) - header;
+}
+
+/* iovの内容を全て送信する（ブロッキングソケット用）。
+   途中までしか送れなかったときはiovを進めて続きを送るので、iovの中身は書き換わる。
+   writev()と同じだが、相手が閉じていてもSIGPIPEでプロセスを終了させないよう、sendmsg()にMSG_NOSIGNALを付けて送る */
+ssize_t FrameWritev(int sock, struct iovec *iov, int iovcnt)
+{
+    ssize_t total = 0; /* 送信したバイト数の合計 */
+    ssize_t sent;      /* 1回のsendmsg()で送信したバイト数 */
+    struct msghdr msg; /* 送信するiov */
+
+    memset(&msg, 0, sizeof(msg));
+    while (iovcnt > 0)
+    {
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        if ((sent = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        total += sent;
+
+        /* 送り終えたiovを飛ばし、途中まで送ったiovは残りを指すようにする */
+        while (iovcnt > 0 && (size_t)sent >= iov->iov_len)
+        {
+            sent -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return total;
+}
+
+void FrameWriterInit(struct FrameWriter *writer, int format)
+{
+    memset(writer, 0, sizeof(struct FrameWriter));
+    writer->size = FRAME_INITBUF;
+    writer->format = format;
+    if ((writer->buffer = (char *)malloc(writer->size)) == NULL)
+    {
+        DieWithError("malloc() failed");
+    }
+}
+
+void FrameWriterFree(struct FrameWriter *writer)
+{
+    free(writer->buffer);
+    writer->buffer = NULL;
+}
+
+/* 長さヘッダを付けたフレームを出力バッファの末尾に追加する（まだ送信はしない） */
+void FrameWriterAppend(struct FrameWriter *writer, const char *payload, size_t payloadLen)
+{
+    size_t newSize; /* 広げた後のバッファサイズ */
+
+    if (writer->tail + FRAME_MAXHDR + payloadLen > writer->size)
+    {
+        /* 送信済みの部分を詰め、それでも足りなければ広げる */
+        memmove(writer->buffer, writer->buffer + writer->head, writer->tail - writer->head);
+        writer->tail -= writer->head;
+        writer->head = 0;
+
+        newSize = writer->size;
+        while (writer->tail + FRAME_MAXHDR + payloadLen > newSize)
+        {
+            newSize *= 2;
+        }
+        if (newSize != writer->size)
+        {
+            if ((writer->buffer = (char *)realloc(writer->buffer, newSize)) == NULL)
+            {
+                DieWithError("realloc() failed");
+            }
+            writer->size = newSize;
+        }
+    }
+
+    writer->tail += FrameEncodeHeader(writer->format, payloadLen, (unsigned char *)writer->buffer + writer->tail);
+    memcpy(writer->buffer + writer->tail, payload, payloadLen);
+    writer->tail += payloadLen;
+}
+
+/* 出力バッファの内容を送信する。
+   全て送信できれば1、送信バッファが一杯（EAGAIN）なら0、エラーなら-1を返す */
+int FrameWriterFlush(struct FrameWriter *writer, int sock)
+{
+    ssize_t sent; /* 送信したバイト数 */
+
+    while (writer->head < writer->tail)
+    {
+        if ((sent = send(sock, writer->buffer + writer->head, writer->tail - writer->head, MSG_NOSIGNAL)) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        writer->head += sent;
+    }
+
+    /* 空になったら先頭から使い直す。大きなフレームで広げたバッファは元に戻す */
+    writer->head = writer->tail = 0;
+    if (writer->size > FRAME_INITBUF)
+    {
+        free(writer->buffer);
+        writer->size = FRAME_INITBUF;
+        if ((writer->buffer = (char *)malloc(writer->size)) == NULL)
+        {
+            DieWithError("malloc() failed");
+        }
+    }
+    return 1;
+}
+
+/* 以下のフィールドの関数は、書き込んだ次の位置を返す。
+   1バイトずつ組み立てるので、構造体のパディングやホストのバイト順に依存しない */
+unsigned char *PutUint16(unsigned char *p, uint16_t value)
+{
+    p[0] = (unsigned char)(value >> 8);
+    p[1] = (unsigned char)value;
+    return p + 2;
+}
+
+unsigned char *PutUint32(unsigned char *p, uint32_t value)
+{
+    p[0] = (unsigned char)(value >> 24);
+    p[1] = (unsigned char)(value >> 16);
+    p[2] = (unsigned char)(value >> 8);
+    p[3] = (unsigned char)value;
+    return p + 4;
+}
+
+unsigned char *PutUint64(unsigned char *p, uint64_t value)
+{
+    p = PutUint32(p, (uint32_t)(value >> 32));
+    return PutUint32(p, (uint32_t)value);
+}
+
+unsigned char *PutVarint(unsigned char *p, uint64_t value)
+{
+    /* 下位から7ビットずつ、続きがあれば最上位ビットを立てて並べる */
+    while (value >= 0x80)
+    {
+        *p++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (unsigned char)value;
+    return p;
+}
+
+uint16_t GetUint16(const unsigned char *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+uint32_t GetUint32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+uint64_t GetUint64(const unsigned char *p)
+{
+    return ((uint64_t)GetUint32(p) << 32) | GetUint32(p + 4);
+}
+
+/* lenバイトの中から可変長整数を読み、使ったバイト数を返す。
+   終わりが見つからなければ0、64ビットに収まらなければ-1を返す */
+int GetVarint(const unsigned char *p, size_t len, uint64_t *value)
+{
+    uint64_t result = 0; /* 組み立て中の値 */
+    size_t i;            /* 読んだバイト数 */
+
+    for (i = 0; i < len; i++)
+    {
+        if (i == 9 && p[i] > 1)
+        {
+            return -1;
+        }
+        result |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+        if ((p[i] & 0x80) == 0)
+        {
+            *value = result;
+            return (int)i + 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* 長さヘッダの形式 */
+#define FRAME_FIXED32 0 /* 4バイト固定長（ネットワークバイト順） */
+#define FRAME_VARINT 1  /* 7ビットずつ下位から並べる可変長（1〜5バイト） */
+
+#define FRAME_MAXHDR 5             /* 長さヘッダの最大バイト数 */
+#define FRAME_INITBUF 4096         /* 受信バッファの初期サイズ */
+#define FRAME_DEFAULTMAX (1 << 20) /* 受け付けるフレームの最大長のデフォルト（1MB） */
+
+/* 受信したバイト列からフレームを切り出すデコーダ。
+   ペイロードはコピーせず受信バッファ内を指すポインタで返す */
+struct FrameReader
+{
+    char *buffer;    /* 受信バッファ */
+    size_t size;     /* 受信バッファの大きさ */
+    size_t head;     /* 未処理データの先頭 */
+    size_t tail;     /* 受信済みデータの末尾 */
+    size_t need;     /* 途中まで届いているフレームの全長（ヘッダを含む。不明なら0） */
+    size_t maxFrame; /* 受け付けるペイロードの最大長 */
+    int format;      /* 長さヘッダの形式 */
+};
+
+/* 返信のフレームを溜めておき、まとめて1回のsend()で送る出力バッファ */
+struct FrameWriter
+{
+    char *buffer; /* 出力バッファ */
+    size_t size;  /* 出力バッファの大きさ */
+    size_t head;  /* 未送信データの先頭 */
+    size_t tail;  /* 未送信データの末尾 */
+    int format;   /* 長さヘッダの形式 */
+};
+
+/* 未送信のバイト数 */
+#define FrameWriterPending(writer) ((writer)->tail - (writer)->head)
+
+void DieWithError(char *errorMessage);
+
+/* フレームの受信とデコード */
+void FrameReaderInit(struct FrameReader *reader, int format, size_t maxFrame);
+void FrameReaderFree(struct FrameReader *reader);
+ssize_t FrameReaderRecv(struct FrameReader *reader, int sock);
+int FrameReaderNext(struct FrameReader *reader, char **payload, size_t *payloadLen);
+
+/* フレームのエンコードと送信 */
+int FrameEncodeHeader(int format, uint32_t payloadLen, unsigned char *header);
+ssize_t FrameWritev(int sock, struct iovec *iov, int iovcnt);
+void FrameWriterInit(struct FrameWriter *writer, int format);
+void FrameWriterFree(struct FrameWriter *writer);
+void FrameWriterAppend(struct FrameWriter *writer, const char *payload, size_t payloadLen);
+int FrameWriterFlush(struct FrameWriter *writer, int sock);
+
+/* フィールドのエンコード・デコード（ネットワークバイト順、アラインメント不要） */
+unsigned char *PutUint16(unsigned char *p, uint16_t value);
+unsigned char *PutUint32(unsigned char *p, uint32_t value);
+unsigned char *PutUint64(unsigned char *p, uint64_t value);
+unsigned char *PutVarint(unsigned char *p, uint64_t value);
+uint16_t GetUint16(const unsigned char *p);
+uint32_t GetUint32(const unsigned char *p);
+uint64_t GetUint64(const unsigned char *p);
+int GetVarint(const unsigned char *p, size_t len, uint64_t *value);
@@ -0,0 +1,132 @@
+#include "Framing.h"
+
+#define MSGSIZE 12 /* 預け入れ額(4) + 預け入れ回数(2) + 引き出し額(4) + 引き出し回数(2) */
+
+/* 口座の集計メッセージ（docs/data_encode.md の msgBuf） */
+struct msgBuf
+{
+    uint32_t centsDeposited; /* 預け入れ額 */
+    uint16_t numDeps;        /* 預け入れ回数 */
+    uint32_t centsWithdrawn; /* 引き出し額 */
+    uint16_t numWds;         /* 引き出し回数 */
+};
+
+/* エラー処理関数 */
+void DieWithError(char *errorMessage)
+{
+    perror(errorMessage);
+    exit(1);
+}
+
+/* 構造体をそのまま送らず、フィールドごとに詰めてネットワークバイト順で書き込む */
+void EncodeMsg(const struct msgBuf *msg, unsigned char *p)
+{
+    p = PutUint32(p, msg->centsDeposited);
+    p = PutUint16(p, msg->numDeps);
+    p = PutUint32(p, msg->centsWithdrawn);
+    PutUint16(p, msg->numWds);
+}
+
+void DecodeMsg(const unsigned char *p, struct msgBuf *msg)
+{
+    msg->centsDeposited = GetUint32(p);
+    msg->numDeps = GetUint16(p + 4);
+    msg->centsWithdrawn = GetUint32(p + 6);
+    msg->numWds = GetUint16(p + 10);
+}
+
+int main(int argc, char *argv[])
+{
+    int sock;                           /* ソケットディスクリプタ */
+    struct sockaddr_in echoServAddr;    /* エコーサーバのアドレス */
+    unsigned short echoServPort;        /* エコーサーバのポート */
+    char *servIP;                       /* サーバのIPアドレス */
+    struct msgBuf msg;                  /* 送信するメッセージ */
+    struct msgBuf reply;                /* 受信したメッセージ */
+    unsigned char header[FRAME_MAXHDR]; /* 長さヘッダ */
+    unsigned char body[MSGSIZE];        /* エンコードしたメッセージ */
+    struct iovec iov[2];                /* 長さヘッダとメッセージ */
+    struct FrameReader reader;          /* フレームのデコーダ */
+    char *payload;                      /* 受信したペイロード */
+    size_t payloadLen;                  /* 受信したペイロードの長さ */
+    int format = FRAME_FIXED32;         /* 長さヘッダの形式 */
+    int result;                         /* FrameReaderNext()の戻り値 */
+    int opt;                            /* getopt()の戻り値 */
+
+    while ((opt = getopt(argc, argv, "v")) != -1)
+    {
+        if (opt != 'v')
+        {
+            argc = 0; /* 不明なオプションは使い方を表示して終了 */
+            break;
+        }
+        format = FRAME_VARINT;
+    }
+
+    /* 引数の数が正しいか確認 */
+    if (argc - optind < 5 || argc - optind > 6)
+    {
+        fprintf(stderr, "Usage: %s [-v: varint length header] <Server IP> <Cents Deposited> <Deposits> "
+                        "<Cents Withdrawn> <Withdrawals> [<Echo Port>]\n", argv[0]);
+        exit(1);
+    }
+
+    servIP = argv[optind];
+    msg.centsDeposited = strtoul(argv[optind + 1], NULL, 10);
+    msg.numDeps = atoi(argv[optind + 2]);
+    msg.centsWithdrawn = strtoul(argv[optind + 3], NULL, 10);
+    msg.numWds = atoi(argv[optind + 4]);
+    echoServPort = (argc - optind == 6) ? atoi(argv[optind + 5]) : 7;
+
+    /* ソケットの作成 */
+    if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+    {
+        DieWithError("socket() failed");
+    }
+
+    /* エコーサーバのアドレス構造体を作成 */
+    memset(&echoServAddr, 0, sizeof(echoServAddr));   /* 構造体をゼロで初期化 */
+    echoServAddr.sin_family = AF_INET;                /* インターネットアドレスファミリ */
+    echoServAddr.sin_addr.s_addr = inet_addr(servIP); /* サーバのIPアドレス */
+    echoServAddr.sin_port = htons(echoServPort);      /* サーバのポート */
+
+    /* サーバに接続 */
+    if (connect(sock, (struct sockaddr *)&echoServAddr, sizeof(echoServAddr)) < 0)
+    {
+        DieWithError("connect() failed");
+    }
+
+    /* 長さヘッダとメッセージを別々のバッファに置いたまま、1回のwritev()で送信 */
+    EncodeMsg(&msg, body);
+    iov[0].iov_base = header;
+    iov[0].iov_len = FrameEncodeHeader(format, MSGSIZE, header);
+    iov[1].iov_base = body;
+    iov[1].iov_len = MSGSIZE;
+    if (FrameWritev(sock, iov, 2) < 0)
+    {
+        DieWithError("writev() failed");
+    }
+
+    /* フレーム1つ分がそろうまで受信する */
+    FrameReaderInit(&reader, format, MSGSIZE);
+    while ((result = FrameReaderNext(&reader, &payload, &payloadLen)) == 0)
+    {
+        if (FrameReaderRecv(&reader, sock) <= 0)
+        {
+            DieWithError("recv() failed or connection closed prematurely");
+        }
+    }
+    if (result < 0 || payloadLen != MSGSIZE)
+    {
+        fprintf(stderr, "Invalid frame from server\n");
+        exit(1);
+    }
+
+    DecodeMsg((unsigned char *)payload, &reply);
+    printf("Received: deposited %u cents in %u deposits, withdrew %u cents in %u withdrawals\n",
+           reply.centsDeposited, reply.numDeps, reply.centsWithdrawn, reply.numWds);
+
+    FrameReaderFree(&reader);
+    close(sock); /* ソケットをクローズ */
+    return 0;
+}
@@ -0,0 +1,478 @@
+#define _GNU_SOURCE
+#include "Framing.h"
+#include "../EventLoop/TimerWheel.h"
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <time.h>
+
+#define MAXPENDING SOMAXCONN    /* 未処理の接続要求の最大数 */
+#define MAXEVENTS 1024          /* epoll_wait()で一度に取り出すイベントの最大数 */
+#define HIGHWATER (1024 * 1024) /* 出力バッファがこれを超えたら受信を止めて送信を待つ */
+#define IDLETIMEOUT_MS 60000    /* 受信も送信もない接続を閉じるまでの時間 */
+#define WRITETIMEOUT_MS 10000   /* 返信を送れないまま相手が受信しない接続を閉じるまでの時間 */
+#define FRAMETIMEOUT_MS 10000   /* フレームの最初のバイトから全体が届くまでの制限時間 */
+#define ACCEPTBACKOFFMAX_MS 100 /* 資源が足りないときにaccept()を再開するまでの最大の待ち時間 */
+
+/* 接続ごとの状態 */
+struct PipelineConnection
+{
+    int clntSock;              /* クライアントのソケットディスクリプタ */
+    struct FrameReader reader; /* 受信したリクエストのデコーダ */
+    struct FrameWriter writer; /* 返信を溜める出力バッファ */
+    uint64_t lastActive;       /* 最後にデータを送受信した時刻（ミリ秒） */
+    uint64_t frameStart;       /* 途中まで届いているフレームを受信し始めた時刻（なければ0） */
+    struct Timer timer;        /* 無通信・送信待ち・フレーム受信のタイムアウト */
+};
+
+/* 資源が足りないときに受け入れを止め、タイマーで再開するための状態 */
+struct AcceptBackoff
+{
+    int epfd;           /* epollのファイルディスクリプタ */
+    int servSock;       /* リスニングソケット */
+    int reserveFd;      /* ディスクリプタが尽きたときに接続要求を受け入れて閉じるための予備 */
+    uint64_t delay;     /* 次に受け入れを止める時間（ミリ秒） */
+    struct Timer timer; /* 受け入れを再開する時刻 */
+};
+
+void AcceptNewConnections(int epfd, int servSock);
+void AcceptRetry(void *arg);
+void ShedConnection(struct AcceptBackoff *backoff);
+void HandlePipelineEvent(struct PipelineConnection *conn, unsigned int events);
+int FlushReplies(struct PipelineConnection *conn);
+void SetTCPOption(int sock, int option, int value);
+void CloseConnection(struct PipelineConnection *conn);
+void ArmTimer(struct PipelineConnection *conn);
+uint64_t ConnectionDeadline(struct PipelineConnection *conn);
+void ConnectionTimeout(void *arg);
+uint64_t NowMs(void);
+
+int format = FRAME_FIXED32;         /* 長さヘッダの形式 */
+int useCork = 0;                    /* TCP_NODELAYの代わりにTCP_CORKで送信をまとめる */
+struct TimerWheel wheel;            /* 接続のタイムアウト（1ティック = 1ms） */
+uint64_t now;                       /* epoll_wait()から戻った時刻（ミリ秒） */
+struct AcceptBackoff acceptBackoff; /* 受け入れを止めている間の状態 */
+
+/* エラー処理関数 */
+void DieWithError(char *errorMessage)
+{
+    perror(errorMessage);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int servSock;                         /* サーバのソケットディスクリプタ */
+    int epfd;                             /* epollのファイルディスクリプタ */
+    struct sockaddr_in echoServAddr;      /* エコーサーバのアドレス */
+    unsigned short echoServPort;          /* エコーサーバのポート */
+    struct epoll_event ev;                /* 登録するイベント */
+    struct epoll_event events[MAXEVENTS]; /* 発生したイベント */
+    int nfds;                             /* 発生したイベントの数 */
+    int on = 1;                           /* ソケットオプションの値 */
+    int opt;                              /* getopt()の戻り値 */
+    int i;                                /* ループカウンタ */
+
+    while ((opt = getopt(argc, argv, "vk")) != -1)
+    {
+        switch (opt)
+        {
+        case 'v':
+            format = FRAME_VARINT;
+            break;
+        case 'k':
+            useCork = 1;
+            break;
+        default:
+            argc = 0; /* 不明なオプションは使い方を表示して終了 */
+            break;
+        }
+    }
+
+    /* 引数の数が正しいか確認 */
+    if (argc - optind > 1 || argc == 0)
+    {
+        fprintf(stderr, "Usage: %s [-v: varint length header] [-k: TCP_CORK] [<Server Port: default 7>]\n", argv[0]);
+        exit(1);
+    }
+    echoServPort = (argc - optind == 1) ? atoi(argv[optind]) : 7;
+
+    /* サーバのソケットを作成 */
+    if ((servSock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+    {
+        DieWithError("socket() failed");
+    }
+    if (setsockopt(servSock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0)
+    {
+        DieWithError("setsockopt() failed");
+    }
+
+    /* サーバのアドレス構造体を作成 */
+    memset(&echoServAddr, 0, sizeof(echoServAddr));
+    echoServAddr.sin_family = AF_INET;
+    echoServAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    echoServAddr.sin_port = htons(echoServPort);
+
+    /* サーバのアドレス構造体にソケットをバインドし、接続要求を待機 */
+    if (bind(servSock, (struct sockaddr *)&echoServAddr, sizeof(echoServAddr)) < 0)
+    {
+        DieWithError("bind() failed");
+    }
+    if (listen(servSock, MAXPENDING) < 0)
+    {
+        DieWithError("listen() failed");
+    }
+
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        DieWithError("epoll_create1() failed");
+    }
+
+    /* リスニングソケットはdata.ptrをNULLとして登録し、接続と区別する */
+    if (fcntl(servSock, F_SETFL, O_NONBLOCK | fcntl(servSock, F_GETFL)) < 0)
+    {
+        DieWithError("Unable to put sock into nonblocking mode");
+    }
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, servSock, &ev) < 0)
+    {
+        DieWithError("epoll_ctl() failed");
+    }
+
+    now = NowMs();
+    TimerWheelInit(&wheel, now);
+    acceptBackoff.epfd = epfd;
+    acceptBackoff.servSock = servSock;
+    acceptBackoff.reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    acceptBackoff.delay = 0;
+    TimerInit(&acceptBackoff.timer, AcceptRetry, &acceptBackoff);
+
+    for (;;)
+    {
+        /* いずれかのソケットが読み書き可能になるか、次のタイムアウトの時刻まで待機 */
+        if ((nfds = epoll_wait(epfd, events, MAXEVENTS, (int)TimerWheelNextTimeout(&wheel))) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            DieWithError("epoll_wait() failed");
+        }
+        now = NowMs();
+
+        for (i = 0; i < nfds; i++)
+        {
+            if (events[i].data.ptr == NULL)
+            {
+                AcceptNewConnections(epfd, servSock);
+            }
+            else
+            {
+                HandlePipelineEvent((struct PipelineConnection *)events[i].data.ptr, events[i].events);
+            }
+        }
+
+        /* 期限が来た接続を調べる */
+        TimerWheelAdvance(&wheel, now);
+    }
+}
+
+uint64_t NowMs(void)
+{
+    struct timespec ts; /* 現在時刻 */
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void AcceptNewConnections(int epfd, int servSock)
+{
+    int clntSock;                    /* クライアントのソケットディスクリプタ */
+    struct sockaddr_in echoClntAddr; /* クライアントのアドレス */
+    socklen_t clntLen;               /* クライアントのアドレス構造体の長さ */
+    struct PipelineConnection *conn; /* 接続の状態 */
+    struct epoll_event ev;           /* 登録するイベント */
+    int outOfFds;                    /* ディスクリプタが尽きた */
+
+    /* 資源が足りずに受け入れを止めている間は、タイマーが再開させるまで待つ */
+    if (TimerPending(&acceptBackoff.timer))
+    {
+        return;
+    }
+
+    /* エッジトリガーなので、待機中の接続要求がなくなるまで受け入れる */
+    for (;;)
+    {
+        clntLen = sizeof(echoClntAddr);
+        if ((clntSock = accept4(servSock, (struct sockaddr *)&echoClntAddr, &clntLen, SOCK_NONBLOCK)) < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return;
+            }
+            if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
+            {
+                continue;
+            }
+            if (errno != EMFILE && errno != ENFILE && errno != ENOBUFS && errno != ENOMEM)
+            {
+                DieWithError("accept() failed");
+            }
+
+            /* 1つの接続要求を閉じてクライアントに知らせ、資源が戻るまで受け入れを止める（EpollReactor.cと同じ）。
+               エッジトリガーなので、残りの接続要求はタイマーで受け入れを再開するまで通知されない */
+            outOfFds = (errno == EMFILE || errno == ENFILE);
+            perror("accept() failed");
+            if (outOfFds)
+            {
+                ShedConnection(&acceptBackoff);
+            }
+            acceptBackoff.delay = acceptBackoff.delay == 0 ? 1 : acceptBackoff.delay * 2;
+            if (acceptBackoff.delay > ACCEPTBACKOFFMAX_MS)
+            {
+                acceptBackoff.delay = ACCEPTBACKOFFMAX_MS;
+            }
+            TimerAdd(&wheel, &acceptBackoff.timer, now + acceptBackoff.delay);
+            return;
+        }
+        acceptBackoff.delay = 0;
+
+        printf("Handling client %s\n", inet_ntoa(echoClntAddr.sin_addr));
+
+        /* 返信は自前でまとめて送るので、Nagleアルゴリズムによる遅延は要らない。
+           TCP_CORKを使う場合は、まとめた返信を送り終えるたびに栓を抜いて残りを押し出す */
+        if (useCork)
+        {
+            SetTCPOption(clntSock, TCP_CORK, 1);
+        }
+        else
+        {
+            SetTCPOption(clntSock, TCP_NODELAY, 1);
+        }
+
+        if ((conn = (struct PipelineConnection *)malloc(sizeof(struct PipelineConnection))) == NULL)
+        {
+            /* メモリが足りなければこの接続だけを断る */
+            perror("malloc() failed");
+            close(clntSock);
+            continue;
+        }
+        conn->clntSock = clntSock;
+        FrameReaderInit(&conn->reader, format, FRAME_DEFAULTMAX);
+        FrameWriterInit(&conn->writer, format);
+        conn->lastActive = now;
+        conn->frameStart = 0;
+        TimerInit(&conn->timer, ConnectionTimeout, conn);
+        ArmTimer(conn);
+
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, clntSock, &ev) < 0)
+        {
+            perror("epoll_ctl() failed");
+            CloseConnection(conn);
+        }
+    }
+}
+
+/* 止めていた受け入れを再開する */
+void AcceptRetry(void *arg)
+{
+    struct AcceptBackoff *backoff = (struct AcceptBackoff *)arg; /* 受け入れの状態 */
+
+    AcceptNewConnections(backoff->epfd, backoff->servSock);
+}
+
+/* 予備のディスクリプタを閉じて空きを1つ作り、待機中の接続要求を1つ受け入れてすぐに閉じる */
+void ShedConnection(struct AcceptBackoff *backoff)
+{
+    int clntSock; /* すぐに閉じるソケット */
+
+    if (backoff->reserveFd >= 0)
+    {
+        close(backoff->reserveFd);
+        if ((clntSock = accept(backoff->servSock, NULL, NULL)) >= 0)
+        {
+            close(clntSock);
+        }
+    }
+    backoff->reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+void HandlePipelineEvent(struct PipelineConnection *conn, unsigned int events)
+{
+    char *payload;     /* 受信バッファ内のリクエスト */
+    size_t payloadLen; /* リクエストの長さ */
+    ssize_t rcvd;      /* 受信したバイト数 */
+    int result;        /* FrameReaderNext()の戻り値 */
+
+    if (events & EPOLLERR)
+    {
+        CloseConnection(conn);
+        return;
+    }
+
+    /* 前回送信しきれなかった返信があれば、先に送信する */
+    if (FrameWriterPending(&conn->writer) > 0 && (result = FlushReplies(conn)) <= 0)
+    {
+        if (result < 0)
+        {
+            CloseConnection(conn);
+        }
+        return;
+    }
+
+    /* 受信データがなくなる（EAGAIN）まで受信し、届いた全てのリクエストの返信を出力バッファに溜める */
+    for (;;)
+    {
+        if ((rcvd = FrameReaderRecv(&conn->reader, conn->clntSock)) > 0)
+        {
+            conn->lastActive = now;
+            while ((result = FrameReaderNext(&conn->reader, &payload, &payloadLen)) == 1)
+            {
+                FrameWriterAppend(&conn->writer, payload, payloadLen);
+                conn->frameStart = 0;
+            }
+            if (result < 0)
+            {
+                fprintf(stderr, "Invalid frame header from client %d\n", conn->clntSock);
+                CloseConnection(conn);
+                return;
+            }
+
+            /* 溜まりすぎたら途中でも送信し、送れなければ受信を止めてEPOLLOUTを待つ */
+            if (FrameWriterPending(&conn->writer) > HIGHWATER && (result = FlushReplies(conn)) <= 0)
+            {
+                if (result < 0)
+                {
+                    CloseConnection(conn);
+                }
+                return;
+            }
+        }
+        else if (rcvd == 0)
+        {
+            /* クライアントが切断した */
+            CloseConnection(conn);
+            return;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            /* 1バイトずつ送ってフレームを完成させないクライアント（slowloris）に備え、
+               フレームの途中で受信が止まったら、その時刻からの制限時間を設定する */
+            if (conn->reader.head == conn->reader.tail)
+            {
+                conn->frameStart = 0;
+            }
+            else if (conn->frameStart == 0)
+            {
+                conn->frameStart = now;
+                ArmTimer(conn);
+            }
+            break;
+        }
+        else if (errno != EINTR)
+        {
+            perror("recv() failed");
+            CloseConnection(conn);
+            return;
+        }
+    }
+
+    /* 溜めた返信を1回の送信でまとめて返す */
+    if (FlushReplies(conn) < 0)
+    {
+        CloseConnection(conn);
+    }
+}
+
+/* 出力バッファを送信する。戻り値はFrameWriterFlush()と同じ */
+int FlushReplies(struct PipelineConnection *conn)
+{
+    int result;                                         /* FrameWriterFlush()の戻り値 */
+    size_t pending = FrameWriterPending(&conn->writer); /* 送信前の未送信バイト数 */
+
+    if ((result = FrameWriterFlush(&conn->writer, conn->clntSock)) < 0)
+    {
+        perror("send() failed");
+        return result;
+    }
+    if (FrameWriterPending(&conn->writer) != pending)
+    {
+        conn->lastActive = now;
+    }
+    if (result == 0)
+    {
+        /* 送り残しがある間は、相手が受信しなければ短い時間で打ち切る */
+        ArmTimer(conn);
+    }
+    else if (result > 0 && useCork)
+    {
+        /* 栓を一度抜くと、MSSに満たない最後のセグメントもすぐに送られる */
+        SetTCPOption(conn->clntSock, TCP_CORK, 0);
+        SetTCPOption(conn->clntSock, TCP_CORK, 1);
+    }
+    return result;
+}
+
+void SetTCPOption(int sock, int option, int value)
+{
+    if (setsockopt(sock, IPPROTO_TCP, option, &value, sizeof(value)) < 0)
+    {
+        perror("setsockopt() failed");
+    }
+}
+
+void CloseConnection(struct PipelineConnection *conn)
+{
+    FrameReaderFree(&conn->reader);
+    FrameWriterFree(&conn->writer);
+    TimerCancel(&wheel, &conn->timer);
+
+    /* close()するとepollの監視対象からも自動的に外れる */
+    close(conn->clntSock);
+
+    printf("\tClient disconnected: %d\n", conn->clntSock);
+
+    free(conn);
+}
+
+/* 接続の期限。送受信のたびにタイマーを登録し直さず、期限が来たときに最新の状態から計算し直す */
+uint64_t ConnectionDeadline(struct PipelineConnection *conn)
+{
+    uint64_t deadline; /* 期限 */
+
+    deadline = conn->lastActive + (FrameWriterPending(&conn->writer) > 0 ? WRITETIMEOUT_MS : IDLETIMEOUT_MS);
+    if (conn->frameStart != 0 && conn->frameStart + FRAMETIMEOUT_MS < deadline)
+    {
+        deadline = conn->frameStart + FRAMETIMEOUT_MS;
+    }
+    return deadline;
+}
+
+/* 期限がタイマーの設定より早まったときだけ登録し直す */
+void ArmTimer(struct PipelineConnection *conn)
+{
+    uint64_t deadline = ConnectionDeadline(conn); /* 期限 */
+
+    if (!TimerPending(&conn->timer) || deadline < conn->timer.expires)
+    {
+        TimerAdd(&wheel, &conn->timer, deadline);
+    }
+}
+
+void ConnectionTimeout(void *arg)
+{
+    struct PipelineConnection *conn = (struct PipelineConnection *)arg; /* 期限が来た接続 */
+    uint64_t deadline = ConnectionDeadline(conn);                       /* 本当の期限 */
+
+    if (deadline > now)
+    {
+        TimerAdd(&wheel, &conn->timer, deadline);
+        return;
+    }
+
+    printf("\tClient timed out: %d\n", conn->clntSock);
+    CloseConnection(conn);
+}
@@ -0,0 +1,153 @@
+#include "Framing.h"
+
+#define MAXPENDING 5 /* 未処理の接続要求の最大数 */
+#define MAXBATCH 64  /* 1回のwritev()でまとめて返すフレームの最大数 */
+
+/* エラー処理関数 */
+void DieWithError(char *errorMessage)
+{
+    perror(errorMessage);
+    exit(1);
+}
+
+void HandleFramedClient(int clntSocket, int format)
+{
+    struct FrameReader reader;                     /* フレームのデコーダ */
+    struct iovec iov[MAXBATCH * 2];                /* 長さヘッダとペイロードを交互に並べる */
+    unsigned char headers[MAXBATCH][FRAME_MAXHDR]; /* 返信の長さヘッダ */
+    char *payload;                                 /* 受信バッファ内のペイロード */
+    size_t payloadLen;                             /* ペイロードの長さ */
+    int numFrames;                                 /* まとめたフレームの数 */
+    int result;                                    /* FrameReaderNext()の戻り値 */
+    ssize_t rcvd;                                  /* 受信したバイト数 */
+
+    FrameReaderInit(&reader, format, FRAME_DEFAULTMAX);
+
+    for (;;)
+    {
+        /* クライアントからのデータを受信（フレームの途中で区切れていてもよい） */
+        if ((rcvd = FrameReaderRecv(&reader, clntSocket)) == 0)
+        {
+            break; /* クライアントが切断した */
+        }
+        if (rcvd < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("recv() failed");
+            break;
+        }
+
+        /* 届いたフレームを全て取り出し、受信バッファを指したままiovに並べて返す */
+        numFrames = 0;
+        while ((result = FrameReaderNext(&reader, &payload, &payloadLen)) == 1)
+        {
+            iov[numFrames * 2].iov_base = headers[numFrames];
+            iov[numFrames * 2].iov_len = FrameEncodeHeader(format, payloadLen, headers[numFrames]);
+            iov[numFrames * 2 + 1].iov_base = payload;
+            iov[numFrames * 2 + 1].iov_len = payloadLen;
+            if (++numFrames == MAXBATCH)
+            {
+                if (FrameWritev(clntSocket, iov, numFrames * 2) < 0)
+                {
+                    break;
+                }
+                numFrames = 0;
+            }
+        }
+        /* 送信に失敗したらこの接続だけを閉じる（numFramesがMAXBATCHのままなら、途中の送信に失敗した） */
+        if (numFrames == MAXBATCH || (numFrames > 0 && FrameWritev(clntSocket, iov, numFrames * 2) < 0))
+        {
+            perror("writev() failed");
+            break;
+        }
+
+        if (result < 0)
+        {
+            fprintf(stderr, "Invalid frame header from client %d\n", clntSocket);
+            break;
+        }
+    }
+
+    FrameReaderFree(&reader);
+    close(clntSocket); /* クライアントのソケットをクローズ */
+
+    printf("\tClient disconnected: %d\n", clntSocket);
+}
+
+int main(int argc, char *argv[])
+{
+    int servSock;                    /* サーバのソケットディスクリプタ */
+    int clntSock;                    /* クライアントのソケットディスクリプタ */
+    struct sockaddr_in echoServAddr; /* エコーサーバのアドレス */
+    struct sockaddr_in echoClntAddr; /* クライアントのアドレス */
+    unsigned short echoServPort;     /* エコーサーバのポート */
+    unsigned int clntLen;            /* クライアントのアドレス構造体の長さ */
+    int format = FRAME_FIXED32;      /* 長さヘッダの形式 */
+    int opt;                         /* getopt()の戻り値 */
+
+    while ((opt = getopt(argc, argv, "v")) != -1)
+    {
+        if (opt != 'v')
+        {
+            argc = 0; /* 不明なオプションは使い方を表示して終了 */
+            break;
+        }
+        format = FRAME_VARINT;
+    }
+
+    /* 引数の数が正しいか確認 */
+    if (argc - optind != 1)
+    {
+        fprintf(stderr, "Usage: %s [-v: varint length header] <Server Port>\n", argv[0]);
+        exit(1);
+    }
+
+    /* エコーサーバのポートを指定 */
+    echoServPort = atoi(argv[optind]);
+
+    /* ソケットの作成 */
+    if ((servSock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+    {
+        DieWithError("socket() failed");
+    }
+
+    /* サーバのアドレス構造体を作成 */
+    memset(&echoServAddr, 0, sizeof(echoServAddr));   /* 構造体をゼロで初期化 */
+    echoServAddr.sin_family = AF_INET;                /* インターネットアドレスファミリ */
+    echoServAddr.sin_addr.s_addr = htonl(INADDR_ANY); /* 任意のIPアドレス */
+    echoServAddr.sin_port = htons(echoServPort);      /* サーバのポート */
+
+    /* サーバのアドレス構造体にソケットをバインド */
+    if (bind(servSock, (struct sockaddr *)&echoServAddr, sizeof(echoServAddr)) < 0)
+    {
+        DieWithError("bind() failed");
+    }
+
+    /* クライアントからの接続要求を待機 */
+    if (listen(servSock, MAXPENDING) < 0)
+    {
+        DieWithError("listen() failed");
+    }
+
+    for (;;)
+    {
+        /* クライアントのアドレス構造体の長さを初期化 */
+        clntLen = sizeof(echoClntAddr);
+
+        /* クライアントからの接続要求を受け入れ */
+        if ((clntSock = accept(servSock, (struct sockaddr *)&echoClntAddr, &clntLen)) < 0)
+        {
+            /* 受け入れる前にクライアントがリセットした場合などは、次の接続要求を待つ */
+            perror("accept() failed");
+            continue;
+        }
+
+        /* クライアントの処理を行う */
+        printf("Handling client %s\n", inet_ntoa(echoClntAddr.sin_addr));
+        HandleFramedClient(clntSock, format);
+    }
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include "Framing.h"
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <time.h>
+
+/* エラー処理関数 */
+void DieWithError(char *errorMessage)
+{
+    perror(errorMessage);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int sock;                        /* ソケットディスクリプタ */
+    struct sockaddr_in echoServAddr; /* エコーサーバのアドレス */
+    unsigned short echoServPort;     /* エコーサーバのポート */
+    char *servIP;                    /* サーバのIPアドレス */
+    int format = FRAME_FIXED32;      /* 長さヘッダの形式 */
+    int depth = 16;                  /* 応答を待たずに送るリクエストの最大数 */
+    long total = 100000;             /* 送信するリクエストの数 */
+    int payloadSize = 32;            /* リクエスト1つのバイト数 */
+    char *request;                   /* 送信するペイロード */
+    struct FrameReader reader;       /* 返信のデコーダ */
+    struct FrameWriter writer;       /* リクエストを溜める出力バッファ */
+    char *payload;                   /* 受信したペイロード */
+    size_t payloadLen;               /* 受信したペイロードの長さ */
+    long sent = 0;                   /* 送信したリクエストの数 */
+    long done = 0;                   /* 返信を受け取ったリクエストの数 */
+    struct pollfd pfd;               /* poll()で待つソケット */
+    struct timespec start, end;      /* 計測の開始・終了時刻 */
+    double elapsed;                  /* 計測時間（秒） */
+    ssize_t rcvd;                    /* 受信したバイト数 */
+    int result;                      /* FrameReaderNext()の戻り値 */
+    int on = 1;                      /* ソケットオプションの値 */
+    int opt;                         /* getopt()の戻り値 */
+
+    while ((opt = getopt(argc, argv, "vp:n:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'v':
+            format = FRAME_VARINT;
+            break;
+        case 'p':
+            depth = atoi(optarg);
+            break;
+        case 'n':
+            total = atol(optarg);
+            break;
+        case 's':
+            payloadSize = atoi(optarg);
+            break;
+        default:
+            depth = 0; /* 不明なオプションは使い方を表示して終了 */
+            break;
+        }
+    }
+
+    /* 引数の数が正しいか確認 */
+    if (optind >= argc || argc - optind > 2 || depth < 1 || total < 1 || payloadSize < 0)
+    {
+        fprintf(stderr, "Usage: %s [-v: varint length header] [-p <Pipeline Depth: default 16>] "
+                        "[-n <Requests: default 100000>] [-s <Payload Bytes: default 32>] <Server IP> [<Echo Port>]\n",
+                argv[0]);
+        exit(1);
+    }
+    servIP = argv[optind];
+    echoServPort = (argc - optind == 2) ? atoi(argv[optind + 1]) : 7;
+
+    if ((request = (char *)malloc(payloadSize + 1)) == NULL)
+    {
+        DieWithError("malloc() failed");
+    }
+    memset(request, 'x', payloadSize);
+
+    /* ソケットの作成 */
+    if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+    {
+        DieWithError("socket() failed");
+    }
+
+    /* エコーサーバのアドレス構造体を作成 */
+    memset(&echoServAddr, 0, sizeof(echoServAddr));
+    echoServAddr.sin_family = AF_INET;
+    echoServAddr.sin_addr.s_addr = inet_addr(servIP);
+    echoServAddr.sin_port = htons(echoServPort);
+
+    /* サーバに接続 */
+    if (connect(sock, (struct sockaddr *)&echoServAddr, sizeof(echoServAddr)) < 0)
+    {
+        DieWithError("connect() failed");
+    }
+
+    /* リクエストは自前でまとめて送るのでNagleアルゴリズムを無効にする。
+       送信と受信を並行して進めるため非ブロッキングにする
+       （ブロッキングのまま送り続けると、受信を止めたサーバと互いに待ち合う） */
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (fcntl(sock, F_SETFL, O_NONBLOCK | fcntl(sock, F_GETFL)) < 0)
+    {
+        DieWithError("Unable to put sock into nonblocking mode");
+    }
+
+    FrameReaderInit(&reader, format, payloadSize);
+    FrameWriterInit(&writer, format);
+    pfd.fd = sock;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (done < total)
+    {
+        /* 応答待ちがdepth個になるまでリクエストを溜め、まとめて送信する */
+        while (sent - done < depth && sent < total)
+        {
+            FrameWriterAppend(&writer, request, payloadSize);
+            sent++;
+        }
+        if (FrameWriterFlush(&writer, sock) < 0)
+        {
+            DieWithError("send() failed");
+        }
+
+        /* 送り残しがあれば送信できるようになるのも待つ */
+        pfd.events = POLLIN | (FrameWriterPending(&writer) > 0 ? POLLOUT : 0);
+        if (poll(&pfd, 1, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            DieWithError("poll() failed");
+        }
+
+        /* 受信できるだけ受信し、届いた返信を全て数える */
+        while ((rcvd = FrameReaderRecv(&reader, sock)) != 0)
+        {
+            if (rcvd < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    break;
+                }
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                DieWithError("recv() failed");
+            }
+            while ((result = FrameReaderNext(&reader, &payload, &payloadLen)) == 1)
+            {
+                if (payloadLen != (size_t)payloadSize)
+                {
+                    result = -1;
+                    break;
+                }
+                done++;
+            }
+            if (result < 0)
+            {
+                fprintf(stderr, "Invalid frame from server\n");
+                exit(1);
+            }
+        }
+        if (rcvd == 0)
+        {
+            DieWithError("connection closed prematurely");
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%ld requests, pipeline depth %d, %d bytes payload, %.3f seconds\n", done, depth, payloadSize, elapsed);
+    printf("throughput: %.1f req/s\n", done / elapsed);
+
+    FrameReaderFree(&reader);
+    FrameWriterFree(&writer);
+    close(sock); /* ソケットをクローズ */
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include "TCPEchoServer.h"
+#include "BufferPool.h"
+
+void BufferPoolInit(struct BufferPool *pool)
+{
+    memset(pool, 0, sizeof(struct BufferPool));
+}
+
+char *BufferPoolAcquire(struct BufferPool *pool, int bufClass)
+{
+    char *slab;                              /* 新しく確保したスラブ */
+    char *buffer;                            /* 取り出したバッファ */
+    size_t size = BufferClassSize(bufClass); /* バッファサイズ */
+    size_t off;                              /* スラブ内の位置 */
+
+    /* 空きがなければスラブを確保し、同じ大きさのバッファに切り分けて空きリストに繋ぐ */
+    if (pool->freeList[bufClass] == NULL)
+    {
+        if ((slab = (char *)malloc(SLABSIZE)) == NULL)
+        {
+            DieWithError("malloc() failed");
+        }
+        for (off = 0; off + size <= SLABSIZE; off += size)
+        {
+            *(void **)(slab + off) = pool->freeList[bufClass];
+            pool->freeList[bufClass] = slab + off;
+        }
+    }
+
+    buffer = (char *)pool->freeList[bufClass];
+    pool->freeList[bufClass] = *(void **)buffer;
+    return buffer;
+}
+
+void BufferPoolRelease(struct BufferPool *pool, char *buffer, int bufClass)
+{
+    /* 空きリストの先頭に戻す（スラブはOSに返さず再利用する） */
+    *(void **)buffer = pool->freeList[bufClass];
+    pool->freeList[bufClass] = buffer;
+}
@@ -0,0 +1,17 @@
+#define BUFCLASSES 5                                /* バッファの大きさの段階数 */
+#define MINBUFSIZE 4096                             /* 最小のバッファサイズ（4KB） */
+#define MAXBUFSIZE (MINBUFSIZE << (BUFCLASSES - 1)) /* 最大のバッファサイズ（64KB） */
+#define SLABSIZE (MAXBUFSIZE * 4)                   /* 一度に確保して切り分けるスラブの大きさ */
+
+/* 大きさの段階ごとに空きバッファを繋いだスラブアロケータ */
+struct BufferPool
+{
+    void *freeList[BUFCLASSES]; /* 段階ごとの空きバッファ（先頭に次へのポインタを置く） */
+};
+
+/* 段階（0〜BUFCLASSES-1）に対応するバッファサイズ */
+#define BufferClassSize(bufClass) (MINBUFSIZE << (bufClass))
+
+void BufferPoolInit(struct BufferPool *pool);
+char *BufferPoolAcquire(struct BufferPool *pool, int bufClass);
+void BufferPoolRelease(struct BufferPool *pool, char *buffer, int bufClass);
@@ -0,0 +1,577 @@
+#define _GNU_SOURCE
+#include "TCPEchoServer.h"
+#include "BufferPool.h"
+#include "TimerWheel.h"
+#include "Shutdown.h"
+#include "../TCP-Echo/Listener.h"
+#include <sys/epoll.h>
+#include <time.h>
+
+#define MAXEVENTS 1024          /* epoll_wait()で一度に取り出すイベントの最大数 */
+#define IDLETIMEOUT_MS 60000    /* 受信も送信もない接続を閉じるまでの時間 */
+#define WRITETIMEOUT_MS 10000   /* 送信待ちのまま相手が受信しない接続を閉じるまでの時間 */
+#define ACCEPTBACKOFFMAX_MS 100 /* 資源が足りないときにaccept()を再開するまでの最大の待ち時間 */
+
+/* 接続ごとの状態 */
+enum ConnState
+{
+    CONN_READING, /* クライアントからの受信待ち */
+    CONN_WRITING  /* 送信しきれなかったデータの送信待ち */
+};
+
+/* 接続ごとの状態機械 */
+struct Connection
+{
+    int clntSock;            /* クライアントのソケットディスクリプタ */
+    enum ConnState state;    /* 接続の状態 */
+    int pendingOff;          /* 未送信データの先頭位置 */
+    int pendingLen;          /* 未送信データのバイト数 */
+    int bufClass;            /* 次に使うバッファの大きさの段階 */
+    char *echoBuffer;        /* エコーバッファ（待機中はNULL） */
+    uint64_t lastActive;     /* 最後にデータを送受信した時刻（ミリ秒） */
+    struct Timer timer;      /* 無通信・送信待ちのタイムアウト */
+    struct Reactor *reactor; /* この接続を処理するイベントループ */
+    struct Connection *prev; /* 使用中の接続のリスト */
+    struct Connection *next;
+};
+
+/* イベントループ（スレッド）ごとの状態 */
+struct Reactor
+{
+    int epfd;                  /* epollのファイルディスクリプタ */
+    int servSock;              /* リスニングソケット */
+    struct BufferPool pool;    /* 受信バッファのプール */
+    struct TimerWheel wheel;   /* 接続のタイムアウト（1ティック = 1ms） */
+    uint64_t now;              /* epoll_wait()から戻った時刻（ミリ秒） */
+    int reserveFd;             /* ディスクリプタが尽きたときに接続要求を受け入れて閉じるための予備 */
+    struct Timer acceptTimer;  /* 資源が足りないときにaccept()を再開する時刻 */
+    uint64_t acceptBackoff;    /* 次に受け入れを止める時間（ミリ秒） */
+    int handoffSock;           /* 次のプロセスにリスニングソケットを渡すUnixドメインソケット（なければ-1） */
+    int handoffPeer;           /* リスニングソケットを渡して応答を待っている相手（なければ-1） */
+    struct Timer handoffTimer; /* 相手の応答を待つ期限 */
+    struct Connection *conns;  /* 使用中の接続のリスト */
+    int numConns;              /* 使用中の接続の数 */
+    int draining;              /* 受け入れを止め、残っている接続の完了を待っている */
+    struct Timer drainTimer;   /* 残っている接続を打ち切る時刻 */
+};
+
+void AcceptNewConnections(struct Reactor *reactor);
+void AcceptRetry(void *arg);
+void ShedConnection(struct Reactor *reactor);
+void HandleConnectionEvent(struct Reactor *reactor, struct Connection *conn, unsigned int events);
+int FlushPending(struct Reactor *reactor, struct Connection *conn);
+void ReleaseBuffer(struct Reactor *reactor, struct Connection *conn);
+void CloseConnection(struct Reactor *reactor, struct Connection *conn);
+void ConnectionTimeout(void *arg);
+void StartDrain(struct Reactor *reactor);
+void DrainTimeout(void *arg);
+void StartHandoff(struct Reactor *reactor);
+void FinishHandoff(struct Reactor *reactor);
+void HandoffTimeout(void *arg);
+
+/* handoffSockを指定すると、そこに接続してきた次のプロセスにリスニングソケットを渡してから終了処理を始める。
+   SIGTERM/SIGINTでも終了処理を始め、全ての接続が閉じたら戻る */
+void RunEpollReactor(int servSock, int handoffSock)
+{
+    struct Reactor reactor;               /* イベントループの状態 */
+    int nfds;                             /* 発生したイベントの数 */
+    int i;                                /* ループカウンタ */
+    int stopRequested = 0;                /* 終了要求またはソケットの受け渡しがあった */
+    struct epoll_event ev;                /* 登録するイベント */
+    struct epoll_event events[MAXEVENTS]; /* 発生したイベント */
+
+    if ((reactor.epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        DieWithError("epoll_create1() failed");
+    }
+    reactor.servSock = servSock;
+    BufferPoolInit(&reactor.pool);
+    reactor.now = NowMs();
+    TimerWheelInit(&reactor.wheel, reactor.now);
+    reactor.reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    TimerInit(&reactor.acceptTimer, AcceptRetry, &reactor);
+    reactor.acceptBackoff = 0;
+    reactor.handoffSock = handoffSock;
+    reactor.handoffPeer = -1;
+    TimerInit(&reactor.handoffTimer, HandoffTimeout, &reactor);
+    reactor.conns = NULL;
+    reactor.numConns = 0;
+    reactor.draining = 0;
+    TimerInit(&reactor.drainTimer, DrainTimeout, &reactor);
+
+    /* リスニングソケットはdata.ptrをNULLとして登録し、接続と区別する */
+    SetNonBlocking(servSock);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(reactor.epfd, EPOLL_CTL_ADD, servSock, &ev) < 0)
+    {
+        DieWithError("epoll_ctl() failed");
+    }
+
+    /* 終了要求のeventfdは全てのイベントループで共有する。エッジトリガーで登録すれば、
+       読み出さなくても各ループに1回ずつ通知される */
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &shutdownFd;
+    if (shutdownFd >= 0 && epoll_ctl(reactor.epfd, EPOLL_CTL_ADD, shutdownFd, &ev) < 0)
+    {
+        DieWithError("epoll_ctl() failed");
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = &reactor.handoffSock;
+    if (handoffSock >= 0 && epoll_ctl(reactor.epfd, EPOLL_CTL_ADD, handoffSock, &ev) < 0)
+    {
+        DieWithError("epoll_ctl() failed");
+    }
+
+    /* 終了処理を始めたら、全ての接続が閉じるまで回す */
+    while (!reactor.draining || reactor.numConns > 0)
+    {
+        /* いずれかのソケットが読み書き可能になるか、次のタイムアウトの時刻まで待機 */
+        if ((nfds = epoll_wait(reactor.epfd, events, MAXEVENTS, (int)TimerWheelNextTimeout(&reactor.wheel))) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            DieWithError("epoll_wait() failed");
+        }
+        reactor.now = NowMs();
+
+        for (i = 0; i < nfds; i++)
+        {
+            if (events[i].data.ptr == NULL)
+            {
+                AcceptNewConnections(&reactor);
+            }
+            else if (events[i].data.ptr == &shutdownFd)
+            {
+                stopRequested = 1;
+            }
+            else if (events[i].data.ptr == &reactor.handoffSock)
+            {
+                StartHandoff(&reactor);
+            }
+            else if (events[i].data.ptr == &reactor.handoffPeer)
+            {
+                /* 同じ回のイベントで既に閉じていれば何もしない */
+                if (reactor.handoffPeer < 0)
+                {
+                    continue;
+                }
+                /* 次のプロセスがリスニングソケットを受け取ったと応答したときだけ、こちらは受け入れをやめる。
+                   失敗したら誰もリスニングソケットを持たなくならないよう、これまでどおり受け入れを続ける */
+                switch (ReceiveHandoffAck(reactor.handoffPeer))
+                {
+                case 1:
+                    FinishHandoff(&reactor);
+                    stopRequested = 1;
+                    break;
+                case -1:
+                    fprintf(stderr, "listening socket handoff was not acknowledged, keep accepting\n");
+                    FinishHandoff(&reactor);
+                    break;
+                }
+            }
+            else
+            {
+                HandleConnectionEvent(&reactor, (struct Connection *)events[i].data.ptr, events[i].events);
+            }
+        }
+
+        /* 接続をまとめて閉じるので、今回のイベントを全て処理し終えてから始める
+           （後ろのイベントが閉じた接続を指していることがある） */
+        if (stopRequested && !reactor.draining)
+        {
+            StartDrain(&reactor);
+        }
+
+        /* 期限が来た接続を調べる */
+        TimerWheelAdvance(&reactor.wheel, reactor.now);
+    }
+
+    close(reactor.epfd);
+}
+
+void AcceptNewConnections(struct Reactor *reactor)
+{
+    int clntSock;            /* クライアントのソケットディスクリプタ */
+    struct Connection *conn; /* 接続の状態 */
+    struct epoll_event ev;   /* 登録するイベント */
+    int outOfFds;            /* ディスクリプタが尽きた */
+
+    /* 資源が足りずに受け入れを止めている間は、タイマーが再開させるまで待つ */
+    if (TimerPending(&reactor->acceptTimer))
+    {
+        return;
+    }
+
+    /* エッジトリガーなので、待機中の接続要求がなくなるまで受け入れる */
+    for (;;)
+    {
+        /* 10万を超える接続を1つのスレッドで扱うので、接続ごとに標準出力へ書かない（標準出力が詰まると
+           全ての接続が止まる）。クライアントのアドレスも要らない */
+        if ((clntSock = accept4(reactor->servSock, NULL, NULL, SOCK_NONBLOCK)) < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return;
+            }
+            if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
+            {
+                continue;
+            }
+            if (errno != EMFILE && errno != ENFILE && errno != ENOBUFS && errno != ENOMEM)
+            {
+                DieWithError("accept() failed");
+            }
+
+            /* 1つの接続要求を閉じてクライアントに知らせ、接続が閉じられて資源が戻るまで受け入れを止める。
+               エッジトリガーなので、止めたままにすると残りの接続要求は二度と通知されない。
+               タイマーで受け入れを再開し、待つ時間は資源が足りない間は倍々に延ばす */
+            outOfFds = (errno == EMFILE || errno == ENFILE);
+            perror("accept() failed");
+            if (outOfFds)
+            {
+                ShedConnection(reactor);
+            }
+            reactor->acceptBackoff = reactor->acceptBackoff == 0 ? 1 : reactor->acceptBackoff * 2;
+            if (reactor->acceptBackoff > ACCEPTBACKOFFMAX_MS)
+            {
+                reactor->acceptBackoff = ACCEPTBACKOFFMAX_MS;
+            }
+            TimerAdd(&reactor->wheel, &reactor->acceptTimer, reactor->now + reactor->acceptBackoff);
+            return;
+        }
+        reactor->acceptBackoff = 0;
+
+        if ((conn = (struct Connection *)malloc(sizeof(struct Connection))) == NULL)
+        {
+            /* メモリが足りなければこの接続だけを断る */
+            perror("malloc() failed");
+            close(clntSock);
+            continue;
+        }
+        conn->clntSock = clntSock;
+        conn->state = CONN_READING;
+        conn->pendingOff = 0;
+        conn->pendingLen = 0;
+        conn->bufClass = 0;
+        conn->echoBuffer = NULL;
+        conn->lastActive = reactor->now;
+        conn->reactor = reactor;
+        conn->prev = NULL;
+        conn->next = reactor->conns;
+        if (reactor->conns != NULL)
+        {
+            reactor->conns->prev = conn;
+        }
+        reactor->conns = conn;
+        reactor->numConns++;
+
+        /* 無通信のまま居座る接続（slowloris）を閉じるため、受け入れた時点からタイマーを動かす */
+        TimerInit(&conn->timer, ConnectionTimeout, conn);
+        TimerAdd(&reactor->wheel, &conn->timer, reactor->now + IDLETIMEOUT_MS);
+
+        /* 読み書き両方をエッジトリガーで一度だけ登録する（以後epoll_ctl()は不要） */
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, clntSock, &ev) < 0)
+        {
+            perror("epoll_ctl() failed");
+            CloseConnection(reactor, conn);
+        }
+    }
+}
+
+/* 止めていた受け入れを再開する */
+void AcceptRetry(void *arg)
+{
+    AcceptNewConnections((struct Reactor *)arg);
+}
+
+/* 予備のディスクリプタを閉じて空きを1つ作り、待機中の接続要求を1つ受け入れてすぐに閉じる。
+   受け入れずにおくと接続要求はlisten()のキューに残り、クライアントは応答のないまま待たされ続ける */
+void ShedConnection(struct Reactor *reactor)
+{
+    int clntSock; /* すぐに閉じるソケット */
+
+    if (reactor->reserveFd >= 0)
+    {
+        close(reactor->reserveFd);
+        if ((clntSock = accept(reactor->servSock, NULL, NULL)) >= 0)
+        {
+            close(clntSock);
+        }
+    }
+    reactor->reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+void HandleConnectionEvent(struct Reactor *reactor, struct Connection *conn, unsigned int events)
+{
+    int recvMsgSize; /* 受信メッセージのサイズ */
+    int bufSize;     /* 現在のバッファサイズ */
+
+    if (events & EPOLLERR)
+    {
+        CloseConnection(reactor, conn);
+        return;
+    }
+
+    /* 前回送信しきれなかったデータがあれば、先に送信する */
+    if (conn->state == CONN_WRITING && !FlushPending(reactor, conn))
+    {
+        return;
+    }
+
+    /* 受信データがなくなる（EAGAIN）まで受信してエコーバック */
+    for (;;)
+    {
+        /* データが届いたときだけプールからバッファを借りる */
+        if (conn->echoBuffer == NULL)
+        {
+            conn->echoBuffer = BufferPoolAcquire(&reactor->pool, conn->bufClass);
+        }
+        bufSize = BufferClassSize(conn->bufClass);
+
+        recvMsgSize = recv(conn->clntSock, conn->echoBuffer, bufSize, 0);
+        if (recvMsgSize > 0)
+        {
+            conn->lastActive = reactor->now;
+            conn->pendingOff = 0;
+            conn->pendingLen = recvMsgSize;
+            if (!FlushPending(reactor, conn))
+            {
+                return;
+            }
+
+            /* バッファが一杯になったら次は大きいバッファで、ほとんど空なら小さいバッファで受信する */
+            if (recvMsgSize == bufSize && conn->bufClass < BUFCLASSES - 1)
+            {
+                ReleaseBuffer(reactor, conn);
+                conn->bufClass++;
+            }
+            else if (recvMsgSize < bufSize / 4 && conn->bufClass > 0)
+            {
+                ReleaseBuffer(reactor, conn);
+                conn->bufClass--;
+            }
+        }
+        else if (recvMsgSize == 0)
+        {
+            /* クライアントが切断した */
+            CloseConnection(reactor, conn);
+            return;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            /* 終了処理中は、受信したデータを全てエコーし終えた時点で閉じる */
+            if (reactor->draining)
+            {
+                CloseConnection(reactor, conn);
+                return;
+            }
+
+            /* 待機中の接続はバッファを持たない */
+            ReleaseBuffer(reactor, conn);
+            return;
+        }
+        else if (errno != EINTR)
+        {
+            perror("recv() failed");
+            CloseConnection(reactor, conn);
+            return;
+        }
+    }
+}
+
+/* 未送信データを送信する。全て送信できれば1、送信待ちまたは切断なら0を返す */
+int FlushPending(struct Reactor *reactor, struct Connection *conn)
+{
+    int sentSize; /* 送信したバイト数 */
+
+    while (conn->pendingLen > 0)
+    {
+        /* 相手が閉じていてもSIGPIPEでプロセスを終了させない */
+        sentSize = send(conn->clntSock, conn->echoBuffer + conn->pendingOff, conn->pendingLen, MSG_NOSIGNAL);
+        if (sentSize < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                /* 送信バッファが空くまで受信を止め、EPOLLOUTを待つ。
+                   相手が受信しないまま居座らないよう、送信待ちの期限を設定する */
+                if (conn->state != CONN_WRITING)
+                {
+                    conn->state = CONN_WRITING;
+                    TimerAdd(&reactor->wheel, &conn->timer, conn->lastActive + WRITETIMEOUT_MS);
+                }
+                return 0;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("send() failed");
+            CloseConnection(reactor, conn);
+            return 0;
+        }
+        conn->pendingOff += sentSize;
+        conn->pendingLen -= sentSize;
+        conn->lastActive = reactor->now;
+    }
+
+    conn->state = CONN_READING;
+    return 1;
+}
+
+void ReleaseBuffer(struct Reactor *reactor, struct Connection *conn)
+{
+    if (conn->echoBuffer != NULL)
+    {
+        BufferPoolRelease(&reactor->pool, conn->echoBuffer, conn->bufClass);
+        conn->echoBuffer = NULL;
+    }
+}
+
+void CloseConnection(struct Reactor *reactor, struct Connection *conn)
+{
+    ReleaseBuffer(reactor, conn);
+    TimerCancel(&reactor->wheel, &conn->timer);
+
+    if (conn->prev != NULL)
+    {
+        conn->prev->next = conn->next;
+    }
+    else
+    {
+        reactor->conns = conn->next;
+    }
+    if (conn->next != NULL)
+    {
+        conn->next->prev = conn->prev;
+    }
+    reactor->numConns--;
+
+    /* close()するとepollの監視対象からも自動的に外れる */
+    close(conn->clntSock);
+
+    free(conn);
+}
+
+/* 接続のタイマーの期限切れ。
+   送受信のたびにタイマーを登録し直すと手間がかかるので、最後に送受信した時刻だけを記録しておき、
+   期限が来たときにその時刻から数え直す */
+void ConnectionTimeout(void *arg)
+{
+    struct Connection *conn = (struct Connection *)arg; /* 期限が来た接続 */
+    struct Reactor *reactor = conn->reactor;             /* 接続を処理するイベントループ */
+    uint64_t deadline;                                   /* 本当の期限 */
+
+    /* 送信待ちの間は、相手が受信しなければ短い時間で打ち切る */
+    deadline = conn->lastActive + (conn->state == CONN_WRITING ? WRITETIMEOUT_MS : IDLETIMEOUT_MS);
+    if (deadline > reactor->now)
+    {
+        TimerAdd(&reactor->wheel, &conn->timer, deadline);
+        return;
+    }
+
+    CloseConnection(reactor, conn);
+}
+
+/* 終了処理を始める。受け入れをやめ、受信待ちの接続は届いているデータをエコーし終えたら閉じる。
+   送信待ちの接続は送り終えてから閉じ、DRAINTIMEOUT_MSまでに終わらない接続は打ち切る */
+void StartDrain(struct Reactor *reactor)
+{
+    struct Connection *conn; /* 調べる接続 */
+    struct Connection *next; /* 次に調べる接続（connは閉じることがある） */
+
+    reactor->draining = 1;
+
+    TimerCancel(&reactor->wheel, &reactor->acceptTimer);
+
+    /* リスニングソケットを次のプロセスに渡していると、close()してもソケットは閉じず、
+       epollの監視対象からも外れないので、先に明示的に外す */
+    epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, reactor->servSock, NULL);
+    close(reactor->servSock);
+    if (reactor->handoffSock >= 0)
+    {
+        close(reactor->handoffSock);
+        reactor->handoffSock = -1;
+    }
+    FinishHandoff(reactor);
+
+    printf("Draining %d connections\n", reactor->numConns);
+
+    for (conn = reactor->conns; conn != NULL; conn = next)
+    {
+        next = conn->next;
+        if (conn->state == CONN_READING)
+        {
+            HandleConnectionEvent(reactor, conn, EPOLLIN);
+        }
+    }
+
+    TimerAdd(&reactor->wheel, &reactor->drainTimer, reactor->now + DRAINTIMEOUT_MS);
+}
+
+/* 期限までに終わらなかった接続を打ち切る */
+void DrainTimeout(void *arg)
+{
+    struct Reactor *reactor = (struct Reactor *)arg; /* 終了処理中のイベントループ */
+
+    printf("Drain deadline reached, closing %d connections\n", reactor->numConns);
+    while (reactor->conns != NULL)
+    {
+        CloseConnection(reactor, reactor->conns);
+    }
+}
+
+/* 受け渡し用のソケットに接続してきた次のプロセスにリスニングソケットを渡し、応答をイベントループで待つ。
+   ここで応答を待ってブロックすると、黙っている相手が全ての接続のエコーを止められるので、
+   相手のソケットをepollに登録し、HANDOFFACKTIMEOUT_MSの期限をタイマーで付ける */
+void StartHandoff(struct Reactor *reactor)
+{
+    int peer;              /* 次のプロセスとの接続 */
+    struct epoll_event ev; /* 登録するイベント */
+
+    /* レベルトリガーなので、待っている接続要求は全て受け入れる。応答を待っている間に来た相手は断る */
+    while ((peer = AcceptHandoffPeer(reactor->handoffSock)) >= 0)
+    {
+        if (reactor->handoffPeer >= 0 || SendListenSocket(peer, reactor->servSock) < 0)
+        {
+            close(peer);
+            continue;
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = &reactor->handoffPeer;
+        if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, peer, &ev) < 0)
+        {
+            perror("epoll_ctl() failed");
+            close(peer);
+            continue;
+        }
+        reactor->handoffPeer = peer;
+        TimerAdd(&reactor->wheel, &reactor->handoffTimer, reactor->now + HANDOFFACKTIMEOUT_MS);
+    }
+}
+
+/* 応答を待っている相手を閉じる（close()でepollの監視対象からも外れる） */
+void FinishHandoff(struct Reactor *reactor)
+{
+    if (reactor->handoffPeer < 0)
+    {
+        return;
+    }
+    TimerCancel(&reactor->wheel, &reactor->handoffTimer);
+    close(reactor->handoffPeer);
+    reactor->handoffPeer = -1;
+}
+
+/* 期限までに応答がなかった。相手がリスニングソケットを使っているとは限らないので、受け入れを続ける */
+void HandoffTimeout(void *arg)
+{
+    struct Reactor *reactor = (struct Reactor *)arg; /* 受け渡し中のイベントループ */
+
+    fprintf(stderr, "listening socket handoff was not acknowledged, keep accepting\n");
+    FinishHandoff(reactor);
+}
@@ -0,0 +1,164 @@
+#include "TCPEchoServer.h"
+#include "IoUring.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#define ENTERRETRY_MS 1 /* io_uring_enter()が一時的に失敗したとき、呼び直すまでの待ち時間（ミリ秒） */
+
+void IoUringInit(struct IoUring *ring, unsigned entries)
+{
+    struct io_uring_params params; /* io_uring_setup()のパラメータ */
+    size_t sqSize, cqSize;         /* SQ・CQのリングの大きさ */
+    char *sqPtr, *cqPtr;           /* mmap()したSQ・CQのリング */
+
+    memset(&params, 0, sizeof(params));
+    if ((ring->ringFd = syscall(__NR_io_uring_setup, entries, &params)) < 0)
+    {
+        DieWithError("io_uring_setup() failed");
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        fprintf(stderr, "kernel too old for this io_uring server\n");
+        exit(1);
+    }
+
+    /* SQとCQは1回のmmap()で両方マップできる */
+    sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (cqSize > sqSize)
+    {
+        sqSize = cqSize;
+    }
+    sqPtr = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_SQ_RING);
+    if (sqPtr == MAP_FAILED)
+    {
+        DieWithError("mmap() failed");
+    }
+    cqPtr = sqPtr;
+
+    ring->sqHead = (unsigned *)(sqPtr + params.sq_off.head);
+    ring->sqTail = (unsigned *)(sqPtr + params.sq_off.tail);
+    ring->sqMask = *(unsigned *)(sqPtr + params.sq_off.ring_mask);
+    ring->sqEntries = params.sq_entries;
+    ring->sqArray = (unsigned *)(sqPtr + params.sq_off.array);
+    ring->sqeTail = *ring->sqTail;
+    ring->sqeSubmitted = ring->sqeTail;
+
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        DieWithError("mmap() failed");
+    }
+
+    ring->cqHead = (unsigned *)(cqPtr + params.cq_off.head);
+    ring->cqTail = (unsigned *)(cqPtr + params.cq_off.tail);
+    ring->cqMask = *(unsigned *)(cqPtr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cqPtr + params.cq_off.cqes);
+}
+
+/* 空きSQEを1つ確保する。SQが満杯ならNULLを返す */
+struct io_uring_sqe *IoUringGetSqe(struct IoUring *ring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned index;
+
+    if (ring->sqeTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) >= ring->sqEntries)
+    {
+        return NULL;
+    }
+
+    index = ring->sqeTail & ring->sqMask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqArray[index] = index;
+    ring->sqeTail++;
+    return sqe;
+}
+
+/* 確保済みのSQEをまとめて1回のシステムコールで投入し、waitNr個の完了を待つ */
+int IoUringSubmitAndWait(struct IoUring *ring, unsigned waitNr)
+{
+    unsigned toSubmit = ring->sqeTail - ring->sqeSubmitted;
+    struct timespec retry = {0, ENTERRETRY_MS * 1000000L}; /* 呼び直すまでの待ち時間 */
+    int ret;
+
+    /* SQEの書き込みが見えてから末尾を進める */
+    __atomic_store_n(ring->sqTail, ring->sqeTail, __ATOMIC_RELEASE);
+
+    ret = syscall(__NR_io_uring_enter, ring->ringFd, toSubmit, waitNr, waitNr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    /* カーネルが受け取ったのは戻り値の数だけ。失敗したときに全て渡したことにすると、
+       SQに残ったSQEは次の呼び出しの投入数に数えられず、いつまでも投入されない */
+    if (ret > 0)
+    {
+        ring->sqeSubmitted += ret;
+    }
+    /* EAGAIN（カーネルのメモリ不足）やEBUSY（完了キューのあふれ）は一時的なので、呼び出し元の次のループで投入し直す。
+       すぐに呼び直すと同じエラーで即座に戻って空回りするので、少し待ってから戻る */
+    if (ret < 0 && (errno == EBUSY || errno == EAGAIN))
+    {
+        nanosleep(&retry, NULL);
+    }
+    else if (ret < 0 && errno != EINTR)
+    {
+        DieWithError("io_uring_enter() failed");
+    }
+    return ret;
+}
+
+/* 完了キューの先頭のCQEを返す。空ならNULLを返す */
+struct io_uring_cqe *IoUringPeekCqe(struct IoUring *ring)
+{
+    unsigned head = *ring->cqHead;
+
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cqMask];
+}
+
+/* 先頭のCQEを処理済みにする */
+void IoUringCqeSeen(struct IoUring *ring)
+{
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+/* 受信バッファをカーネルに預ける「提供バッファリング」を登録する */
+struct io_uring_buf_ring *IoUringSetupBufRing(struct IoUring *ring, unsigned entries, int bgid)
+{
+    struct io_uring_buf_ring *bufRing; /* 提供バッファリング */
+    struct io_uring_buf_reg reg;       /* 登録パラメータ */
+
+    bufRing = mmap(NULL, entries * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufRing == MAP_FAILED)
+    {
+        DieWithError("mmap() failed");
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)bufRing;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (syscall(__NR_io_uring_register, ring->ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        DieWithError("io_uring_register(IORING_REGISTER_PBUF_RING) failed");
+    }
+
+    bufRing->tail = 0;
+    return bufRing;
+}
+
+/* バッファを1つ提供バッファリングに戻す */
+void IoUringBufRingAdd(struct io_uring_buf_ring *bufRing, unsigned entries, void *addr, unsigned len, int bid)
+{
+    unsigned short tail = bufRing->tail;
+    struct io_uring_buf *buf = &bufRing->bufs[tail & (entries - 1)];
+
+    buf->addr = (unsigned long)addr;
+    buf->len = len;
+    buf->bid = bid;
+    __atomic_store_n(&bufRing->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
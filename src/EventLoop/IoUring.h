@@ -0,0 +1,27 @@
+#include <linux/io_uring.h>
+
+/* liburingを使わずにio_uringを操作するための最小限のラッパー */
+struct IoUring
+{
+    int ringFd;                /* io_uringのファイルディスクリプタ */
+    unsigned *sqHead;          /* 投入キュー（SQ）の先頭（カーネルが更新） */
+    unsigned *sqTail;          /* 投入キューの末尾（アプリケーションが更新） */
+    unsigned *sqArray;         /* 投入キューのインデックス配列 */
+    unsigned sqMask;           /* 投入キューのマスク */
+    unsigned sqEntries;        /* 投入キューの要素数 */
+    unsigned sqeTail;          /* 次に確保するSQEの位置 */
+    unsigned sqeSubmitted;     /* カーネルに渡し済みのSQEの位置 */
+    struct io_uring_sqe *sqes; /* 投入キューのエントリ（SQE） */
+    unsigned *cqHead;          /* 完了キュー（CQ）の先頭（アプリケーションが更新） */
+    unsigned *cqTail;          /* 完了キューの末尾（カーネルが更新） */
+    unsigned cqMask;           /* 完了キューのマスク */
+    struct io_uring_cqe *cqes; /* 完了キューのエントリ（CQE） */
+};
+
+void IoUringInit(struct IoUring *ring, unsigned entries);
+struct io_uring_sqe *IoUringGetSqe(struct IoUring *ring);
+int IoUringSubmitAndWait(struct IoUring *ring, unsigned waitNr);
+struct io_uring_cqe *IoUringPeekCqe(struct IoUring *ring);
+void IoUringCqeSeen(struct IoUring *ring);
+struct io_uring_buf_ring *IoUringSetupBufRing(struct IoUring *ring, unsigned entries, int bgid);
+void IoUringBufRingAdd(struct io_uring_buf_ring *bufRing, unsigned entries, void *addr, unsigned len, int bid);
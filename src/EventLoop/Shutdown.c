@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+#include "TCPEchoServer.h"
+#include "Shutdown.h"
+#include <signal.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define HANDOFFTIMEOUT_SECS 5 /* 前のプロセスからリスニングソケットを受け取るまで待つ時間 */
+#define HANDOFFTAG 'L'        /* リスニングソケットに添える本文 */
+#define HANDOFFACK 'A'        /* 受け取った側が返す応答 */
+
+void ShutdownSignalHandler(int signalType);
+
+int shutdownFd = -1;
+volatile sig_atomic_t shutdownRequested = 0; /* 終了要求を受けた */
+
+/* SIGTERM/SIGINTを受けたらeventfdに書き込み、全てのイベントループのepoll_wait()を起こす。
+   シグナルハンドラではexit()もprintf()も呼ばず、終了処理はイベントループに任せる */
+void InstallShutdownHandler(void)
+{
+    struct sigaction handler; /* シグナルハンドラ */
+
+    if ((shutdownFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+        DieWithError("eventfd() failed");
+    }
+
+    handler.sa_handler = ShutdownSignalHandler;
+    if (sigfillset(&handler.sa_mask) < 0)
+    {
+        DieWithError("sigfillset() failed");
+    }
+    handler.sa_flags = SA_RESTART;
+    if (sigaction(SIGTERM, &handler, 0) < 0 || sigaction(SIGINT, &handler, 0) < 0)
+    {
+        DieWithError("sigaction() failed");
+    }
+}
+
+void ShutdownSignalHandler(int signalType)
+{
+    uint64_t one = 1; /* eventfdに加える値 */
+
+    /* 終了処理中に2回目の要求が来たら、接続の完了を待たずに終了する */
+    if (shutdownRequested)
+    {
+        _exit(1);
+    }
+    shutdownRequested = 1;
+
+    /* write()は非同期シグナル安全 */
+    write(shutdownFd, &one, sizeof(one));
+}
+
+/* 次に起動するプロセスにリスニングソケットを渡すためのUnixドメインソケットを作る。
+   前のプロセスが同じパスで待っていてもよいよう、先にパスを削除する（前のプロセスは受け渡しを終えている）。
+   他のユーザーが接続できないよう、パスは所有者だけが読み書きできる0600で作る */
+int CreateHandoffSocket(const char *path)
+{
+    int sock;                /* 受け渡し用のリスニングソケット */
+    struct sockaddr_un addr; /* 受け渡し用のアドレス */
+    mode_t oldMask;          /* 元のumask */
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    {
+        DieWithError("socket() failed");
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    /* bind()がパスを作るときの許可はumaskで決まるので、作る間だけ所有者以外を外す */
+    oldMask = umask(0177);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        DieWithError("bind() failed");
+    }
+    umask(oldMask);
+    if (listen(sock, 1) < 0)
+    {
+        DieWithError("listen() failed");
+    }
+
+    return sock;
+}
+
+/* 受け渡し用のソケットに接続してきた新しいプロセスとの接続を、ノンブロッキングで受け入れる。
+   リスニングソケットを渡すと、相手は同じポートの接続を全て受け入れられるようになるので、
+   SO_PEERCREDで相手の実効ユーザーIDを確かめ、このプロセスと違えば断る。受け入れなかったら-1を返す */
+int AcceptHandoffPeer(int handoffSock)
+{
+    int peer;          /* 新しいプロセスとの接続 */
+    struct ucred cred; /* 相手のプロセスの資格情報 */
+    socklen_t credLen; /* credの長さ */
+
+    if ((peer = accept4(handoffSock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0)
+    {
+        /* 通知の後に相手が接続をやめた場合など */
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED)
+        {
+            perror("accept() failed");
+        }
+        return -1;
+    }
+
+    credLen = sizeof(cred);
+    if (getsockopt(peer, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) < 0 || cred.uid != geteuid())
+    {
+        fprintf(stderr, "listening socket handoff refused: peer is not uid %u\n", (unsigned)geteuid());
+        close(peer);
+        return -1;
+    }
+
+    return peer;
+}
+
+/* 新しいプロセスに、SCM_RIGHTSでリスニングソケットを渡す。カーネル内のソケット（と受け入れキューに溜まった
+   接続要求）はそのまま共有されるので、渡している間に届いた接続要求も失われない。
+   接続したばかりのソケットの送信バッファは空なので、ノンブロッキングでも1バイトの本文は送れる。
+   送れなければ-1を返す。送れても相手が受け取ったとは限らないので、呼び出し元は
+   ReceiveHandoffAck()で応答を確かめるまで受け入れを続ける */
+int SendListenSocket(int peer, int servSock)
+{
+    char tag = HANDOFFTAG;                  /* 本文（SCM_RIGHTSは1バイト以上の本文と一緒に送る） */
+    struct iovec iov = {&tag, sizeof(tag)}; /* 本文 */
+    struct msghdr msg;                      /* 送信するメッセージ */
+    struct cmsghdr *cmsg;                   /* 補助データ */
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;                              /* 補助データのバッファ */
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &servSock, sizeof(int));
+
+    if (sendmsg(peer, &msg, MSG_NOSIGNAL) < 0)
+    {
+        perror("sendmsg() failed");
+        return -1;
+    }
+    return 0;
+}
+
+/* 新しいプロセスの応答をノンブロッキングで読む。受け取ったという応答なら1、まだ届いていなければ0、
+   相手が応答せずに閉じたか違う応答を返したら-1を返す。受け取った相手が途中で終了していれば
+   誰もリスニングソケットを持たなくなるので、呼び出し元は1のときだけ受け入れをやめる */
+int ReceiveHandoffAck(int peer)
+{
+    char ack;  /* 新しいプロセスの応答 */
+    ssize_t n; /* 受信したバイト数 */
+
+    if ((n = recv(peer, &ack, sizeof(ack), 0)) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return 0;
+    }
+    return (n == sizeof(ack) && ack == HANDOFFACK) ? 1 : -1;
+}
+
+/* 前のプロセスの受け渡し用ソケットに接続し、リスニングソケットを受け取る。
+   前のプロセスがいなければ-1を返す（呼び出し元が新しくソケットを作る） */
+int ReceiveListenSocket(const char *path)
+{
+    int sock;                                          /* 前のプロセスとの接続 */
+    int servSock = -1;                                 /* 受け取ったリスニングソケット */
+    char tag;                                          /* 本文 */
+    char ack = HANDOFFACK;                             /* 受け取ったという応答 */
+    struct iovec iov = {&tag, sizeof(tag)};            /* 本文 */
+    struct msghdr msg;                                 /* 受信するメッセージ */
+    struct cmsghdr *cmsg;                              /* 補助データ */
+    struct sockaddr_un addr;                           /* 受け渡し用のアドレス */
+    struct timeval timeout = {HANDOFFTIMEOUT_SECS, 0}; /* 受信のタイムアウト */
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;                                         /* 補助データのバッファ */
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        DieWithError("socket() failed");
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) > 0)
+    {
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            {
+                memcpy(&servSock, CMSG_DATA(cmsg), sizeof(int));
+            }
+        }
+    }
+
+    /* 受け取ったことを前のプロセスに知らせる。届かなければ前のプロセスも受け入れを続けるが、
+       同じリスニングソケットを共有しているだけなので、接続要求はどちらかが受け入れる */
+    if (servSock >= 0)
+    {
+        send(sock, &ack, sizeof(ack), MSG_NOSIGNAL);
+    }
+    close(sock);
+
+    return servSock;
+}
@@ -0,0 +1,12 @@
+#define DRAINTIMEOUT_MS 30000     /* 終了要求から、残っている接続を打ち切るまでの時間 */
+#define HANDOFFACKTIMEOUT_MS 1000 /* 渡したリスニングソケットを受け取ったという応答を待つ時間 */
+
+/* SIGTERM/SIGINTで書き込まれるeventfd。イベントループはこれをepollで監視して終了処理を始める */
+extern int shutdownFd;
+
+void InstallShutdownHandler(void);
+int CreateHandoffSocket(const char *path);
+int AcceptHandoffPeer(int handoffSock);
+int SendListenSocket(int peer, int servSock);
+int ReceiveHandoffAck(int peer);
+int ReceiveListenSocket(const char *path);
@@ -0,0 +1,60 @@
+#include "TCPEchoServer.h"
+#include "Shutdown.h"
+
+int main(int argc, char const *argv[])
+{
+    int servSock;                /* サーバのソケットディスクリプタ */
+    const char *servAddress;     /* サーバのポート番号、またはunix:<パス>など */
+    int rcvBufSize = 0;          /* SO_RCVBUF（0ならカーネルの既定値） */
+    int sndBufSize = 0;          /* SO_SNDBUF（0ならカーネルの既定値） */
+    const char *handoffPath;     /* リスニングソケットを受け渡すUnixドメインソケットのパス */
+    int handoffSock = -1;        /* 次のプロセスにリスニングソケットを渡すソケット */
+
+    /* 引数の数をチェック */
+    if (argc > 5)
+    {
+        fprintf(stderr, "Usage: %s [<Server Port or Address: default 7> [<SO_RCVBUF> [<SO_SNDBUF> [<Handoff Socket Path>]]]]\n",
+                argv[0]);
+        exit(1);
+    }
+    servAddress = (argc >= 2) ? argv[1] : "7";
+    if (argc >= 3)
+    {
+        rcvBufSize = atoi(argv[2]);
+    }
+    if (argc >= 4)
+    {
+        sndBufSize = atoi(argv[3]);
+    }
+    handoffPath = (argc >= 5) ? argv[4] : NULL;
+
+    /* 大量の同時接続に備えてディスクリプタ数の上限を引き上げる */
+    RaiseFileLimit();
+
+    /* 前のプロセスが動いていれば、そのリスニングソケットを受け取る。
+       同じソケットで受け入れを続けるので、入れ替わりの間に届いた接続要求も失われない */
+    if (handoffPath != NULL && (servSock = ReceiveListenSocket(handoffPath)) >= 0)
+    {
+        printf("Took over the listening socket from the previous process\n");
+    }
+    else
+    {
+        /* サーバのソケットを作成 */
+        servSock = CreateServerSocket(servAddress);
+    }
+
+    /* 受け入れたソケットはリスニングソケットのバッファサイズを引き継ぐ */
+    SetSocketBufferSizes(servSock, rcvBufSize, sndBufSize);
+
+    /* SIGTERMで受け入れをやめ、残っている接続が終わるのを待ってから終了する */
+    InstallShutdownHandler();
+    if (handoffPath != NULL)
+    {
+        handoffSock = CreateHandoffSocket(handoffPath);
+    }
+
+    /* 単一スレッドのepollイベントループで全ての接続を処理する */
+    RunEpollReactor(servSock, handoffSock);
+
+    return 0;
+}
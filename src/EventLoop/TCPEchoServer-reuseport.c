@@ -0,0 +1,93 @@
+#include "TCPEchoServer.h"
+#include "Shutdown.h"
+#include <pthread.h>
+
+#define DEFAULT_BACKLOG 4096 /* リスニングソケットごとの待機中の接続要求の最大数 */
+
+/* ワーカースレッド関数 */
+void *ReactorMain(void *arg);
+
+/* ワーカースレッドに渡す構造体 */
+struct ReactorArgs
+{
+    int servSock; /* このワーカー専用のリスニングソケット */
+    int cpu;      /* 固定するCPU番号 */
+};
+
+int main(int argc, char const *argv[])
+{
+    const char *servPort;          /* サーバのポート番号（SO_REUSEPORTはTCPだけ） */
+    long numWorkers;               /* ワーカースレッド（リアクター）の数 */
+    int backlog;                   /* 受け入れキューの長さ */
+    long i;                        /* ループカウンタ */
+    pthread_t *threadIDs;          /* スレッドID */
+    struct ReactorArgs *reactors;  /* ワーカーごとの引数 */
+    int *cpus;                     /* 実行を許されたCPUの番号 */
+    int numCPUs;                   /* 実行を許されたCPUの数 */
+
+    /* 引数の数をチェック */
+    if (argc > 4)
+    {
+        fprintf(stderr, "Usage: %s [<Server Port: default 7> [<Workers: default CPUs> [<Backlog: default %d>]]]\n",
+                argv[0], DEFAULT_BACKLOG);
+        exit(1);
+    }
+    servPort = (argc >= 2) ? argv[1] : "7";
+    cpus = GetAllowedCPUs(&numCPUs);
+    numWorkers = (argc >= 3) ? atol(argv[2]) : numCPUs;
+    backlog = (argc >= 4) ? atoi(argv[3]) : DEFAULT_BACKLOG;
+    if (numWorkers < 1)
+    {
+        numWorkers = 1;
+    }
+
+    RaiseFileLimit();
+
+    if ((threadIDs = (pthread_t *)malloc(sizeof(pthread_t) * numWorkers)) == NULL ||
+        (reactors = (struct ReactorArgs *)malloc(sizeof(struct ReactorArgs) * numWorkers)) == NULL)
+    {
+        DieWithError("malloc() failed");
+    }
+
+    /* ワーカーごとにSO_REUSEPORTのリスニングソケットを作成する。
+       バインドの失敗はスレッド生成前にここで検出する。i番目のワーカーは、実行を許されたCPUのi番目に固定する */
+    for (i = 0; i < numWorkers; i++)
+    {
+        reactors[i].servSock = CreateListenSocket(servPort, backlog, 1);
+        reactors[i].cpu = cpus[i % numCPUs];
+    }
+    free(cpus);
+
+    /* SIGTERMで全てのワーカーが受け入れをやめ、残っている接続が終わるのを待ってから終了する */
+    InstallShutdownHandler();
+
+    /* ワーカースレッドを生成（各スレッドが自分のイベントループを持つ） */
+    for (i = 0; i < numWorkers; i++)
+    {
+        if (pthread_create(&threadIDs[i], NULL, ReactorMain, (void *)&reactors[i]) != 0)
+        {
+            DieWithError("pthread_create() failed");
+        }
+    }
+
+    printf("%ld reactors listening on port %s (backlog %d)\n", numWorkers, servPort, backlog);
+
+    for (i = 0; i < numWorkers; i++)
+    {
+        pthread_join(threadIDs[i], NULL);
+    }
+
+    return 0;
+}
+
+void *ReactorMain(void *arg)
+{
+    struct ReactorArgs *reactor = (struct ReactorArgs *)arg;
+
+    /* 受け入れとエコー処理を同じCPUで完結させる */
+    PinThreadToCPU(reactor->cpu);
+
+    RunEpollReactor(reactor->servSock, -1);
+
+    return (NULL);
+}
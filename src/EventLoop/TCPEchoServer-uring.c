@@ -0,0 +1,32 @@
+#include "TCPEchoServer.h"
+
+int main(int argc, char const *argv[])
+{
+    int servSock;                /* サーバのソケットディスクリプタ */
+    const char *servAddress;     /* サーバのポート番号、またはunix:<パス>など */
+
+    /* 引数の数をチェック */
+    if (argc > 2)
+    {
+        fprintf(stderr, "Usage: %s [<Server Port or Address: default 7>]\n", argv[0]);
+        exit(1);
+    }
+    else if (argc == 2)
+    {
+        servAddress = argv[1];
+    }
+    else
+    {
+        servAddress = "7";
+    }
+
+    RaiseFileLimit();
+
+    /* サーバのソケットを作成 */
+    servSock = CreateServerSocket(servAddress);
+
+    /* 単一スレッドのio_uringループで全ての接続を処理する */
+    RunUringReactor(servSock);
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+#define _GNU_SOURCE
+#include "TCPEchoServer.h"
+#include "../TCP-Echo/Listener.h"
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define MAXPENDING SOMAXCONN /* 待機中の接続要求の最大数（大量接続を想定してカーネル上限を使う） */
+
+void DieWithError(char *errorMessage)
+{
+    perror(errorMessage);
+    exit(1);
+}
+
+/* 待ち受けるアドレスはポート番号のほか、unix:<パス> などで指定できる（../TCP-Echo/Listener.hを参照） */
+int CreateServerSocket(const char *address)
+{
+    return CreateListenSocket(address, MAXPENDING, 0);
+}
+
+int CreateListenSocket(const char *address, int backlog, int reusePort)
+{
+    /* 再起動時にTIME_WAIT中のポートでもバインドできるようにする。
+       SO_REUSEPORT: 同じポートに複数のソケットをバインドし、
+       カーネルが接続要求をソケットごとの受け入れキューに振り分ける */
+    return CreateListener(address, backlog, LISTEN_REUSEADDR | (reusePort ? LISTEN_REUSEPORT : 0));
+}
+
+void SetNonBlocking(int sock)
+{
+    /* ソケットを非ブロッキングモードに設定 */
+    if (fcntl(sock, F_SETFL, O_NONBLOCK | fcntl(sock, F_GETFL)) < 0)
+    {
+        DieWithError("Unable to put sock into nonblocking mode");
+    }
+}
+
+void SetSocketBufferSizes(int sock, int rcvBufSize, int sndBufSize)
+{
+    /* 0のときはカーネルの自動調整に任せる（明示的に設定すると自動調整は無効になる） */
+    if (rcvBufSize > 0 && setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvBufSize, sizeof(rcvBufSize)) < 0)
+    {
+        DieWithError("setsockopt(SO_RCVBUF) failed");
+    }
+    if (sndBufSize > 0 && setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndBufSize, sizeof(sndBufSize)) < 0)
+    {
+        DieWithError("setsockopt(SO_SNDBUF) failed");
+    }
+}
+
+void RaiseFileLimit(void)
+{
+    struct rlimit limit; /* ファイルディスクリプタ数の上限 */
+
+    /* 10万以上の接続を保持できるよう、ソフトリミットをハードリミットまで引き上げる */
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0)
+    {
+        DieWithError("getrlimit() failed");
+    }
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+    {
+        DieWithError("setrlimit() failed");
+    }
+}
+
+/* このプロセスが実行を許されたCPUの番号を小さい順に並べた配列を返し、その数をnumCPUsに入れる。
+   オンラインのCPUが0から連番とは限らず、cpusetやtasksetで一部のCPUしか使えないこともあるので、
+   sched_getaffinity()の集合から作る。返した配列は呼び出し元がfree()する */
+int *GetAllowedCPUs(int *numCPUs)
+{
+    cpu_set_t cpuset; /* 実行を許可されたCPUの集合 */
+    int *cpus;        /* CPUの番号 */
+    int cpu;          /* 調べるCPUの番号 */
+
+    if (sched_getaffinity(0, sizeof(cpuset), &cpuset) < 0)
+    {
+        DieWithError("sched_getaffinity() failed");
+    }
+    if ((cpus = (int *)malloc(sizeof(int) * CPU_COUNT(&cpuset))) == NULL)
+    {
+        DieWithError("malloc() failed");
+    }
+
+    *numCPUs = 0;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &cpuset))
+        {
+            cpus[(*numCPUs)++] = cpu;
+        }
+    }
+    return cpus;
+}
+
+void PinThreadToCPU(int cpu)
+{
+    cpu_set_t cpuset; /* 実行を許可するCPUの集合 */
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+
+    /* 呼び出し元のスレッドを指定したCPUに固定する */
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+    {
+        fprintf(stderr, "pthread_setaffinity_np() failed for CPU %d\n", cpu);
+    }
+}
+
+uint64_t NowMs(void)
+{
+    struct timespec ts; /* 現在時刻 */
+
+    /* ミリ秒の精度で足りるので、システムコールにならない粗い時計を使う */
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,21 @@
+#include <stdio.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+
+void DieWithError(char *errorMessage);
+int CreateServerSocket(const char *address);
+int CreateListenSocket(const char *address, int backlog, int reusePort);
+int *GetAllowedCPUs(int *numCPUs);
+void PinThreadToCPU(int cpu);
+void SetNonBlocking(int sock);
+void SetSocketBufferSizes(int sock, int rcvBufSize, int sndBufSize);
+void RaiseFileLimit(void);
+uint64_t NowMs(void);
+void RunEpollReactor(int servSock, int handoffSock);
+void RunUringReactor(int servSock);
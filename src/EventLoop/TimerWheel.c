@@ -0,0 +1,175 @@
+#include <stddef.h>
+#include "TimerWheel.h"
+
+void LinkTimer(struct TimerWheel *wheel, struct Timer *timer);
+void CascadeSlot(struct TimerWheel *wheel, int level, int index);
+
+void TimerWheelInit(struct TimerWheel *wheel, uint64_t now)
+{
+    int level, i;
+
+    for (level = 0; level < WHEELLEVELS; level++)
+    {
+        for (i = 0; i < WHEELSIZE; i++)
+        {
+            wheel->slots[level][i].next = wheel->slots[level][i].prev = &wheel->slots[level][i];
+        }
+    }
+    wheel->current = now;
+    wheel->count = 0;
+}
+
+void TimerInit(struct Timer *timer, TimerFunc func, void *arg)
+{
+    timer->next = timer->prev = NULL;
+    timer->func = func;
+    timer->arg = arg;
+}
+
+/* 期限を設定して登録する（登録中なら期限を変更する）。スロットのリストに繋ぐだけなのでO(1) */
+void TimerAdd(struct TimerWheel *wheel, struct Timer *timer, uint64_t expires)
+{
+    if (TimerPending(timer))
+    {
+        TimerCancel(wheel, timer);
+    }
+
+    /* 期限を過ぎていれば次のティックで呼ぶ。遠すぎる期限は最後の段に収まるよう切り詰める */
+    if (expires <= wheel->current)
+    {
+        expires = wheel->current + 1;
+    }
+    if (expires - wheel->current > WHEELMAXDELAY)
+    {
+        expires = wheel->current + WHEELMAXDELAY;
+    }
+    timer->expires = expires;
+
+    LinkTimer(wheel, timer);
+    wheel->count++;
+}
+
+/* 期限までの残りに応じた段のスロットに繋ぐ。
+   n段目には残りが 256^n 以上 256^(n+1) 未満のタイマーを、期限の第nバイトの位置に置く */
+void LinkTimer(struct TimerWheel *wheel, struct Timer *timer)
+{
+    uint64_t delta = timer->expires - wheel->current; /* 期限までの残り */
+    int level = 0;                                    /* 繋ぐ段 */
+    struct Timer *slot;                               /* 繋ぐスロットの番兵 */
+
+    while (level < WHEELLEVELS - 1 && delta >= (1ULL << (WHEELBITS * (level + 1))))
+    {
+        level++;
+    }
+    slot = &wheel->slots[level][(timer->expires >> (WHEELBITS * level)) & WHEELMASK];
+
+    timer->next = slot;
+    timer->prev = slot->prev;
+    slot->prev->next = timer;
+    slot->prev = timer;
+}
+
+/* 登録を取り消す。リストから外すだけなのでO(1) */
+void TimerCancel(struct TimerWheel *wheel, struct Timer *timer)
+{
+    if (!TimerPending(timer))
+    {
+        return;
+    }
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+    wheel->count--;
+}
+
+/* 上の段のスロットのタイマーを全て取り出し、現在時刻からの残りに応じて下の段に繋ぎ直す */
+void CascadeSlot(struct TimerWheel *wheel, int level, int index)
+{
+    struct Timer *slot = &wheel->slots[level][index]; /* 振り分け直すスロットの番兵 */
+    struct Timer *timer;                              /* 取り出したタイマー */
+    struct Timer *next;                               /* 次のタイマー */
+
+    timer = slot->next;
+    slot->next = slot->prev = slot;
+    while (timer != slot)
+    {
+        next = timer->next;
+        LinkTimer(wheel, timer);
+        timer = next;
+    }
+}
+
+/* 時刻をnowまで進め、期限切れになったタイマーの関数を呼ぶ */
+void TimerWheelAdvance(struct TimerWheel *wheel, uint64_t now)
+{
+    struct Timer expired; /* 処理中のスロットから取り出したタイマー */
+    struct Timer *slot;   /* 処理中のスロットの番兵 */
+    struct Timer *timer;  /* 取り出したタイマー */
+    uint64_t next;        /* 次に処理する時刻 */
+    int level;            /* 振り分け直す段 */
+
+    while (wheel->current < now)
+    {
+        /* タイマーがなければ1ティックずつ進める必要はない */
+        if (wheel->count == 0)
+        {
+            wheel->current = now;
+            break;
+        }
+
+        /* 0段目が1周したら、1段目の次のスロットを0段目に振り分ける（1段目が1周したら2段目も…）。
+           残りはこれから処理するティックから数えるので、先に現在時刻を進めておく */
+        next = ++wheel->current;
+        for (level = 1; level < WHEELLEVELS && ((next >> (WHEELBITS * (level - 1))) & WHEELMASK) == 0; level++)
+        {
+            CascadeSlot(wheel, level, (next >> (WHEELBITS * level)) & WHEELMASK);
+        }
+
+        slot = &wheel->slots[0][next & WHEELMASK];
+        if (slot->next == slot)
+        {
+            continue;
+        }
+
+        /* 関数の中でタイマーを登録・取り消ししても壊れないよう、スロットの中身を別のリストに移してから処理する。
+           0段目のスロットには期限がちょうどこのティックのタイマーしかない */
+        expired.next = slot->next;
+        expired.prev = slot->prev;
+        expired.next->prev = &expired;
+        expired.prev->next = &expired;
+        slot->next = slot->prev = slot;
+
+        while ((timer = expired.next) != &expired)
+        {
+            timer->prev->next = timer->next;
+            timer->next->prev = timer->prev;
+            timer->next = timer->prev = NULL;
+            wheel->count--;
+            timer->func(timer->arg);
+        }
+    }
+}
+
+/* 次にタイマーを調べるべき時刻までのティック数を返す。タイマーがなければ-1を返す。
+   0段目が1周する時点では上の段から振り分け直すので、実際の期限より早めに返すことがある */
+long TimerWheelNextTimeout(struct TimerWheel *wheel)
+{
+    long ticks;         /* 現在時刻からのティック数 */
+    long untilCascade;  /* 0段目が1周するまでのティック数 */
+    struct Timer *slot; /* 調べるスロットの番兵 */
+
+    if (wheel->count == 0)
+    {
+        return -1;
+    }
+    untilCascade = WHEELSIZE - (long)(wheel->current & WHEELMASK);
+    for (ticks = 1; ticks < untilCascade; ticks++)
+    {
+        slot = &wheel->slots[0][(wheel->current + ticks) & WHEELMASK];
+        if (slot->next != slot)
+        {
+            return ticks;
+        }
+    }
+    return untilCascade;
+}
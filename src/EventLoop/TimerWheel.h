@@ -0,0 +1,40 @@
+#include <stdint.h>
+
+#define WHEELLEVELS 4              /* ホイールの段数 */
+#define WHEELBITS 8                /* 1段のスロット数のビット数 */
+#define WHEELSIZE (1 << WHEELBITS) /* 1段のスロット数 */
+#define WHEELMASK (WHEELSIZE - 1)
+#define WHEELMAXDELAY ((1ULL << (WHEELBITS * WHEELLEVELS)) - 1) /* 登録できる最大の待ち時間（ティック） */
+
+/* タイマーが期限切れになったときに呼ぶ関数 */
+typedef void (*TimerFunc)(void *arg);
+
+/* タイマー。呼び出し側の構造体に埋め込んで使い、登録・取り消しでmallocしない */
+struct Timer
+{
+    struct Timer *next; /* 同じスロットの次のタイマー（未登録ならNULL） */
+    struct Timer *prev; /* 同じスロットの前のタイマー */
+    uint64_t expires;   /* 期限（ティック） */
+    TimerFunc func;     /* 期限切れで呼ぶ関数 */
+    void *arg;          /* 関数に渡す引数 */
+};
+
+/* 階層型タイミングホイール。
+   0段目は1ティック、1段目は256ティック、2段目は65536ティック…ごとのスロットを持ち、
+   上の段のスロットは下の段が1周するたびに下の段へ振り分け直す */
+struct TimerWheel
+{
+    struct Timer slots[WHEELLEVELS][WHEELSIZE]; /* スロットごとのタイマーの環状リスト（先頭は番兵） */
+    uint64_t current;                           /* 処理済みの時刻（ティック） */
+    unsigned long count;                        /* 登録中のタイマーの数 */
+};
+
+/* 登録中かどうか */
+#define TimerPending(timer) ((timer)->next != NULL)
+
+void TimerWheelInit(struct TimerWheel *wheel, uint64_t now);
+void TimerInit(struct Timer *timer, TimerFunc func, void *arg);
+void TimerAdd(struct TimerWheel *wheel, struct Timer *timer, uint64_t expires);
+void TimerCancel(struct TimerWheel *wheel, struct Timer *timer);
+void TimerWheelAdvance(struct TimerWheel *wheel, uint64_t now);
+long TimerWheelNextTimeout(struct TimerWheel *wheel);
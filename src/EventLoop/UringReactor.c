@@ -0,0 +1,552 @@
+#include "TCPEchoServer.h"
+#include "IoUring.h"
+#include "TimerWheel.h"
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+
+#define URING_ENTRIES 4096      /* SQの要素数 */
+#define NUMBUFS 4096            /* 提供バッファの数（2のべき乗） */
+#define BUFSIZE 4096            /* 提供バッファ1つの大きさ */
+#define BGID 0                  /* 提供バッファのグループID */
+#define IDLETIMEOUT_MS 60000    /* 受信も送信もない接続を閉じるまでの時間 */
+#define WRITETIMEOUT_MS 10000   /* 送信待ちのまま相手が受信しない接続を閉じるまでの時間 */
+#define TICK_MS 1000            /* タイマーを調べる間隔（IORING_OP_TIMEOUTで起きる） */
+#define ACCEPTBACKOFFMAX_MS 100 /* 資源が足りないときにacceptを登録し直すまでの最大の待ち時間 */
+
+/* user_dataに操作の種類・ソケット・バッファ番号を詰める */
+#define OP_ACCEPT 0
+#define OP_RECV 1
+#define OP_SEND 2
+#define OP_TICK 3
+#define OP_ACCEPTRETRY 4
+#define ENCODE_DATA(op, fd, bid) (((unsigned long long)(fd) << 32) | ((unsigned long long)(bid) << 8) | (op))
+#define DATA_OP(data) ((int)((data)&0xff))
+#define DATA_BID(data) ((int)(((data) >> 8) & 0xffffff))
+#define DATA_FD(data) ((int)((data) >> 32))
+
+/* 接続ごとの状態 */
+struct UringConnection
+{
+    int fd;                  /* クライアントのソケットディスクリプタ */
+    int queueHead;           /* 送信待ちバッファの先頭（-1なら空） */
+    int queueTail;           /* 送信待ちバッファの末尾 */
+    int sendsInFlight;       /* 投入済みで完了していない送信の数 */
+    int closing;             /* 受信が終了した（EOFまたはエラー） */
+    int failed;              /* 送信に失敗した */
+    int dirty;               /* 送信待ちリストに入っている */
+    int starved;             /* バッファ不足で受信が止まっている */
+    uint64_t lastActive;     /* 最後にデータを送受信した時刻（ミリ秒） */
+    struct Timer timer;      /* 無通信・送信待ちのタイムアウト */
+    struct UringServer *srv; /* この接続を処理するサーバー */
+};
+
+/* サーバー全体の状態 */
+struct UringServer
+{
+    struct IoUring ring;               /* io_uring */
+    struct io_uring_buf_ring *bufRing; /* 提供バッファリング */
+    char *buffers;                     /* 提供バッファの実体 */
+    int bufNext[NUMBUFS];              /* 送信待ちキューの次のバッファ */
+    int bufLen[NUMBUFS];               /* バッファに受信したバイト数 */
+    struct UringConnection *conns;     /* ソケットディスクリプタで引く接続表 */
+    int connCap;                       /* 接続表の大きさ（ディスクリプタ数の上限） */
+    int *dirtyList;                    /* 送信を投入すべき接続 */
+    int dirtyCount;                    /* dirtyListの要素数 */
+    int *starvedList;                  /* 受信の再開を待つ接続 */
+    int starvedCount;                  /* starvedListの要素数 */
+    int recycled;                      /* このバッチでバッファを返却した */
+    int servSock;                      /* リスニングソケット */
+    struct TimerWheel wheel;           /* 接続のタイムアウト（1ティック = 1ms） */
+    uint64_t now;                      /* 完了を待って戻った時刻（ミリ秒） */
+    int tickArmed;                     /* タイマーを調べるIORING_OP_TIMEOUTを投入済み */
+    struct __kernel_timespec tick;     /* タイマーを調べる間隔 */
+    int reserveFd;                     /* ディスクリプタが尽きたときに接続要求を受け入れて閉じるための予備 */
+    long acceptBackoff;                /* 次にacceptを止める時間（ミリ秒） */
+    struct __kernel_timespec acceptTs; /* acceptを登録し直すまでの待ち時間 */
+};
+
+struct io_uring_sqe *UringGetSqe(struct UringServer *srv);
+void UringArmAccept(struct UringServer *srv);
+void UringArmRecv(struct UringServer *srv, int fd);
+void UringRecycleBuffer(struct UringServer *srv, int bid);
+void UringHandleAccept(struct UringServer *srv, struct io_uring_cqe *cqe);
+void UringHandleRecv(struct UringServer *srv, struct io_uring_cqe *cqe);
+void UringHandleSend(struct UringServer *srv, struct io_uring_cqe *cqe);
+void UringSubmitSends(struct UringServer *srv, int fd);
+void UringMaybeClose(struct UringServer *srv, int fd);
+void UringArmTick(struct UringServer *srv);
+void UringAcceptBackoff(struct UringServer *srv);
+void UringShedConnection(struct UringServer *srv);
+void UringConnectionTimeout(void *arg);
+
+void RunUringReactor(int servSock)
+{
+    struct UringServer *srv;  /* サーバーの状態 */
+    struct io_uring_cqe *cqe; /* 完了したI/O */
+    int i;                    /* ループカウンタ */
+    int starvedCount;         /* 受信を再開する接続の数 */
+    struct rlimit limit;      /* ディスクリプタ数の上限 */
+
+    if ((srv = (struct UringServer *)calloc(1, sizeof(struct UringServer))) == NULL)
+    {
+        DieWithError("calloc() failed");
+    }
+    srv->servSock = servSock;
+
+    /* 接続表はディスクリプタ数の上限の大きさで一度だけ確保する（触れるまでページは割り当てられない）。
+       接続にタイマーを埋め込むので、reallocで動かすとホイールのリストが壊れる */
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0)
+    {
+        DieWithError("getrlimit() failed");
+    }
+    srv->connCap = limit.rlim_cur > (1 << 24) ? (1 << 24) : (int)limit.rlim_cur;
+    if ((srv->conns = (struct UringConnection *)calloc(srv->connCap, sizeof(struct UringConnection))) == NULL ||
+        (srv->dirtyList = (int *)calloc(srv->connCap, sizeof(int))) == NULL ||
+        (srv->starvedList = (int *)calloc(srv->connCap, sizeof(int))) == NULL)
+    {
+        DieWithError("calloc() failed");
+    }
+
+    srv->now = NowMs();
+    TimerWheelInit(&srv->wheel, srv->now);
+    srv->tick.tv_sec = TICK_MS / 1000;
+    srv->tick.tv_nsec = TICK_MS % 1000 * 1000000;
+    srv->reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    IoUringInit(&srv->ring, URING_ENTRIES);
+
+    /* 受信バッファはカーネルに預け、データが届いたときに初めて割り当てさせる。
+       待機中の接続はバッファを1つも持たない */
+    if ((srv->buffers = (char *)malloc((size_t)NUMBUFS * BUFSIZE)) == NULL)
+    {
+        DieWithError("malloc() failed");
+    }
+    srv->bufRing = IoUringSetupBufRing(&srv->ring, NUMBUFS, BGID);
+    for (i = 0; i < NUMBUFS; i++)
+    {
+        IoUringBufRingAdd(srv->bufRing, NUMBUFS, srv->buffers + (size_t)i * BUFSIZE, BUFSIZE, i);
+    }
+
+    UringArmAccept(srv);
+
+    for (;;)
+    {
+        /* 溜まったSQEを1回のシステムコールで投入し、少なくとも1つの完了を待つ */
+        IoUringSubmitAndWait(&srv->ring, 1);
+        srv->now = NowMs();
+
+        /* 届いている完了を全て処理する */
+        while ((cqe = IoUringPeekCqe(&srv->ring)) != NULL)
+        {
+            switch (DATA_OP(cqe->user_data))
+            {
+            case OP_ACCEPT:
+                UringHandleAccept(srv, cqe);
+                break;
+            case OP_RECV:
+                UringHandleRecv(srv, cqe);
+                break;
+            case OP_SEND:
+                UringHandleSend(srv, cqe);
+                break;
+            case OP_TICK:
+                srv->tickArmed = 0;
+                break;
+            case OP_ACCEPTRETRY:
+                UringArmAccept(srv);
+                break;
+            }
+            IoUringCqeSeen(&srv->ring);
+        }
+
+        /* 受信したデータを接続ごとにリンクした送信SQEとしてまとめて積む */
+        for (i = 0; i < srv->dirtyCount; i++)
+        {
+            srv->conns[srv->dirtyList[i]].dirty = 0;
+            UringSubmitSends(srv, srv->dirtyList[i]);
+            UringMaybeClose(srv, srv->dirtyList[i]);
+        }
+        srv->dirtyCount = 0;
+
+        /* バッファが返却されたら、バッファ不足で止まっていた受信を再開する */
+        if (srv->recycled && srv->starvedCount > 0)
+        {
+            starvedCount = srv->starvedCount;
+            srv->starvedCount = 0;
+            for (i = 0; i < starvedCount; i++)
+            {
+                srv->conns[srv->starvedList[i]].starved = 0;
+                if (!srv->conns[srv->starvedList[i]].closing)
+                {
+                    UringArmRecv(srv, srv->starvedList[i]);
+                }
+            }
+        }
+        srv->recycled = 0;
+
+        /* 期限が来た接続を調べる。接続があるときだけ、TICK_MSごとに起きるタイムアウトを投入しておく */
+        TimerWheelAdvance(&srv->wheel, srv->now);
+        if (!srv->tickArmed && srv->wheel.count > 0)
+        {
+            UringArmTick(srv);
+        }
+    }
+}
+
+/* SQEを1つ確保する。SQが満杯なら投入してから確保し直す */
+struct io_uring_sqe *UringGetSqe(struct UringServer *srv)
+{
+    struct io_uring_sqe *sqe;
+
+    while ((sqe = IoUringGetSqe(&srv->ring)) == NULL)
+    {
+        IoUringSubmitAndWait(&srv->ring, 0);
+    }
+    return sqe;
+}
+
+void UringArmAccept(struct UringServer *srv)
+{
+    struct io_uring_sqe *sqe = UringGetSqe(srv);
+
+    /* マルチショットaccept: 1つのSQEで接続を受け入れ続ける */
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = srv->servSock;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = ENCODE_DATA(OP_ACCEPT, 0, 0);
+}
+
+void UringArmRecv(struct UringServer *srv, int fd)
+{
+    struct io_uring_sqe *sqe = UringGetSqe(srv);
+
+    /* マルチショットrecv: 届いたデータごとに提供バッファを1つ選んでCQEを返し続ける */
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BGID;
+    sqe->user_data = ENCODE_DATA(OP_RECV, fd, 0);
+}
+
+void UringArmTick(struct UringServer *srv)
+{
+    struct io_uring_sqe *sqe = UringGetSqe(srv);
+
+    /* 完了数を待たない（off = 0）純粋なタイムアウト。期限が来ると-ETIMEで完了する */
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)&srv->tick;
+    sqe->len = 1;
+    sqe->off = 0;
+    sqe->user_data = ENCODE_DATA(OP_TICK, 0, 0);
+    srv->tickArmed = 1;
+}
+
+/* 資源が足りずにacceptが失敗したとき、すぐに登録し直すと同じエラーで即座に完了して空回りするので、
+   IORING_OP_TIMEOUTで待ってから登録し直す。待つ時間は資源が足りない間は倍々に延ばす */
+void UringAcceptBackoff(struct UringServer *srv)
+{
+    struct io_uring_sqe *sqe;
+
+    srv->acceptBackoff = srv->acceptBackoff == 0 ? 1 : srv->acceptBackoff * 2;
+    if (srv->acceptBackoff > ACCEPTBACKOFFMAX_MS)
+    {
+        srv->acceptBackoff = ACCEPTBACKOFFMAX_MS;
+    }
+    srv->acceptTs.tv_sec = srv->acceptBackoff / 1000;
+    srv->acceptTs.tv_nsec = srv->acceptBackoff % 1000 * 1000000;
+
+    sqe = UringGetSqe(srv);
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)&srv->acceptTs;
+    sqe->len = 1;
+    sqe->off = 0;
+    sqe->user_data = ENCODE_DATA(OP_ACCEPTRETRY, 0, 0);
+}
+
+/* 予備のディスクリプタを閉じて空きを1つ作り、待機中の接続要求を1つ受け入れてすぐに閉じる
+   （EpollReactor.cのShedConnection()と同じ）。リスニングソケットはブロッキングなので、
+   接続要求が残っているときだけaccept()する */
+void UringShedConnection(struct UringServer *srv)
+{
+    struct pollfd pfd; /* リスニングソケットの状態 */
+    int clntSock;      /* すぐに閉じるソケット */
+
+    if (srv->reserveFd >= 0)
+    {
+        close(srv->reserveFd);
+        pfd.fd = srv->servSock;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 0) > 0 && (clntSock = accept(srv->servSock, NULL, NULL)) >= 0)
+        {
+            close(clntSock);
+        }
+    }
+    srv->reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+void UringRecycleBuffer(struct UringServer *srv, int bid)
+{
+    IoUringBufRingAdd(srv->bufRing, NUMBUFS, srv->buffers + (size_t)bid * BUFSIZE, BUFSIZE, bid);
+    srv->recycled = 1;
+}
+
+void UringHandleAccept(struct UringServer *srv, struct io_uring_cqe *cqe)
+{
+    int clntSock = cqe->res;                  /* クライアントのソケットディスクリプタ */
+    int more = cqe->flags & IORING_CQE_F_MORE; /* マルチショットが続いている */
+    struct UringConnection *conn;             /* 接続の状態 */
+    int on = 1;                               /* 有効にするオプションの値 */
+
+    if (clntSock < 0)
+    {
+        errno = -clntSock;
+        switch (errno)
+        {
+        case EINTR:
+        case ECONNABORTED: /* 受け入れる前にクライアントがリセットした */
+        case EPROTO:
+            break;
+        case EMFILE:
+        case ENFILE:
+            UringShedConnection(srv);
+            /* fall through */
+        default:
+            /* 資源が足りない。待ってから登録し直す */
+            perror("accept() failed");
+            if (!more)
+            {
+                UringAcceptBackoff(srv);
+                return;
+            }
+        }
+        if (!more)
+        {
+            UringArmAccept(srv);
+        }
+        return;
+    }
+    srv->acceptBackoff = 0;
+
+    /* マルチショットが終了していたら登録し直す */
+    if (!more)
+    {
+        UringArmAccept(srv);
+    }
+
+    if (clntSock >= srv->connCap)
+    {
+        close(clntSock);
+        return;
+    }
+    conn = &srv->conns[clntSock];
+    memset(conn, 0, sizeof(struct UringConnection));
+    conn->fd = clntSock;
+    conn->queueHead = -1;
+    conn->queueTail = -1;
+    conn->srv = srv;
+    conn->lastActive = srv->now;
+    TimerInit(&conn->timer, UringConnectionTimeout, conn);
+    TimerAdd(&srv->wheel, &conn->timer, srv->now + IDLETIMEOUT_MS);
+
+    /* BUFSIZEを超えるメッセージは提供バッファ1つずつのリンクした送信に分かれる。Nagleが有効だと
+       2つ目以降の小さなセグメントがクライアントの遅延ACKを待って40ms近く遅れるので、すぐに送らせる
+       （Unixドメインのソケットでは失敗するが、Nagleもないので無視する） */
+    setsockopt(clntSock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    UringArmRecv(srv, clntSock);
+}
+
+void UringHandleRecv(struct UringServer *srv, struct io_uring_cqe *cqe)
+{
+    int fd = DATA_FD(cqe->user_data);               /* クライアントのソケットディスクリプタ */
+    struct UringConnection *conn = &srv->conns[fd]; /* 接続の状態 */
+    int bid;                                        /* 選ばれた提供バッファの番号 */
+
+    if (cqe->res > 0)
+    {
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        conn->lastActive = srv->now;
+
+        if (conn->failed)
+        {
+            UringRecycleBuffer(srv, bid);
+        }
+        else
+        {
+            /* 送信待ちキューの末尾に繋ぎ、このバッチの最後にまとめて送信する */
+            srv->bufLen[bid] = cqe->res;
+            srv->bufNext[bid] = -1;
+            if (conn->queueTail < 0)
+            {
+                conn->queueHead = bid;
+            }
+            else
+            {
+                srv->bufNext[conn->queueTail] = bid;
+            }
+            conn->queueTail = bid;
+
+            if (!conn->dirty)
+            {
+                conn->dirty = 1;
+                srv->dirtyList[srv->dirtyCount++] = fd;
+            }
+        }
+
+        /* バッファ不足などでマルチショットが終了していたら登録し直す */
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+        {
+            UringArmRecv(srv, fd);
+        }
+    }
+    else if (cqe->res == -ENOBUFS)
+    {
+        /* 提供バッファが尽きたので、送信が完了してバッファが戻るまで受信を止める */
+        if (!conn->starved)
+        {
+            conn->starved = 1;
+            srv->starvedList[srv->starvedCount++] = fd;
+        }
+    }
+    else
+    {
+        /* クライアントが切断した、またはエラー */
+        conn->closing = 1;
+        UringMaybeClose(srv, fd);
+    }
+}
+
+void UringSubmitSends(struct UringServer *srv, int fd)
+{
+    struct UringConnection *conn = &srv->conns[fd]; /* 接続の状態 */
+    struct io_uring_sqe *sqe = NULL;                /* 送信SQE */
+    int bid;                                        /* 送信するバッファの番号 */
+    int chainLen = 0;                               /* リンクするSQEの数 */
+
+    /* 送信中のチェーンがあるときは、完了してから次のチェーンを積む（順序を保つため） */
+    if (conn->sendsInFlight > 0 || conn->queueHead < 0)
+    {
+        return;
+    }
+
+    /* チェーンの途中でSQが満杯にならないよう、空きが足りなければ先に投入する */
+    for (bid = conn->queueHead; bid >= 0; bid = srv->bufNext[bid])
+    {
+        chainLen++;
+    }
+    if (chainLen > URING_ENTRIES / 2)
+    {
+        chainLen = URING_ENTRIES / 2;
+    }
+    if (srv->ring.sqEntries - (srv->ring.sqeTail - *srv->ring.sqHead) < (unsigned)chainLen)
+    {
+        IoUringSubmitAndWait(&srv->ring, 0);
+    }
+
+    /* 送信SQEをIOSQE_IO_LINKで繋ぎ、カーネルに順番どおり実行させる */
+    while (conn->queueHead >= 0 && conn->sendsInFlight < chainLen)
+    {
+        bid = conn->queueHead;
+        conn->queueHead = srv->bufNext[bid];
+        if (conn->queueHead < 0)
+        {
+            conn->queueTail = -1;
+        }
+
+        if (sqe != NULL)
+        {
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+        sqe = UringGetSqe(srv);
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = (unsigned long)(srv->buffers + (size_t)bid * BUFSIZE);
+        sqe->len = srv->bufLen[bid];
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+        sqe->user_data = ENCODE_DATA(OP_SEND, fd, bid);
+        conn->sendsInFlight++;
+    }
+}
+
+void UringHandleSend(struct UringServer *srv, struct io_uring_cqe *cqe)
+{
+    int fd = DATA_FD(cqe->user_data);               /* クライアントのソケットディスクリプタ */
+    int bid = DATA_BID(cqe->user_data);             /* 送信したバッファの番号 */
+    struct UringConnection *conn = &srv->conns[fd]; /* 接続の状態 */
+
+    if (cqe->res != srv->bufLen[bid] && !conn->failed)
+    {
+        /* 送信に失敗したら受信側も止め、recvの終了を経て接続を閉じる */
+        conn->failed = 1;
+        shutdown(fd, SHUT_RDWR);
+    }
+
+    /* 送信が終わったバッファをカーネルに返す */
+    UringRecycleBuffer(srv, bid);
+    conn->lastActive = srv->now;
+    conn->sendsInFlight--;
+
+    if (conn->sendsInFlight > 0)
+    {
+        return;
+    }
+
+    if (conn->failed)
+    {
+        /* 送信できなかったデータは捨ててバッファを返す */
+        while (conn->queueHead >= 0)
+        {
+            bid = conn->queueHead;
+            conn->queueHead = srv->bufNext[bid];
+            UringRecycleBuffer(srv, bid);
+        }
+        conn->queueTail = -1;
+    }
+    else if (conn->queueHead >= 0 && !conn->dirty)
+    {
+        conn->dirty = 1;
+        srv->dirtyList[srv->dirtyCount++] = fd;
+    }
+
+    UringMaybeClose(srv, fd);
+}
+
+void UringMaybeClose(struct UringServer *srv, int fd)
+{
+    struct UringConnection *conn = &srv->conns[fd]; /* 接続の状態 */
+
+    /* 受信が終わり、送信も全て完了してから閉じる */
+    if (conn->closing && conn->sendsInFlight == 0 && conn->queueHead < 0 && !conn->dirty)
+    {
+        TimerCancel(&srv->wheel, &conn->timer);
+        close(fd);
+        conn->closing = 0;
+    }
+}
+
+/* 接続のタイマーの期限切れ（EpollReactor.cのConnectionTimeout()と同じく、期限が来たときに
+   最後に送受信した時刻から数え直す）。期限を過ぎていれば送信の失敗と同じくshutdown()し、
+   マルチショットrecvの終了と送信の完了を経て接続を閉じる */
+void UringConnectionTimeout(void *arg)
+{
+    struct UringConnection *conn = (struct UringConnection *)arg; /* 期限が来た接続 */
+    struct UringServer *srv = conn->srv;                          /* 接続を処理するサーバー */
+    uint64_t deadline;                                            /* 本当の期限 */
+
+    /* 送信待ちの間は、相手が受信しなければ短い時間で打ち切る */
+    deadline = conn->lastActive +
+               (conn->sendsInFlight > 0 || conn->queueHead >= 0 ? WRITETIMEOUT_MS : IDLETIMEOUT_MS);
+    if (deadline > srv->now)
+    {
+        TimerAdd(&srv->wheel, &conn->timer, deadline);
+        return;
+    }
+
+    printf("\tClient timed out: %d\n", conn->fd);
+    conn->failed = 1;
+    shutdown(conn->fd, SHUT_RDWR);
+}
@@ -5,20 +5,20 @@ int main(int argc, char const *argv[])
 {
     int servSock;                    /* サーバーのソケットディスクリプタ */
     int clntSock;                    /* クライアントのソケットディスクリプタ */
-    unsigned short echoServPort;     /* サーバーのポート */
+    const char *servAddress;         /* サーバーのポート、またはunix:<パス>など */
     pid_t processID;                 /* プロセスID */
     unsigned int childProcCount = 0; /* 子プロセスの数 */
 
     /* 引数をチェック */
     if (argc != 2)
     {
-        fprintf(stderr, "Usage: %s <Server Port>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <Server Port or Address>\n", argv[0]);
         exit(1);
     }
-    echoServPort = atoi(argv[1]); /* 1つ目の引数: ポート */
+    servAddress = argv[1]; /* 1つ目の引数: ポート（unix:<パス> などのアドレスも指定できる） */
 
     /* サーバーのソケットを作成 */
-    servSock = CreateTCPClientSocket(echoServPort);
+    servSock = CreateServerSocket(servAddress);
 
     for (;;)
     {
@@ -28,8 +28,9 @@ int main(int argc, char const *argv[])
         /* プロセスをフォーク */
         if ((processID = fork()) < 0)
         {
-            /* fork() に失敗 */
-            DieWithError("fork() failed");
+            /* fork() に失敗（プロセス数の上限など）したら、この接続だけを断って受け入れを続ける */
+            perror("fork() failed");
+            close(clntSock);
         }
         else if (processID == 0)
         {
@@ -40,10 +41,12 @@ int main(int argc, char const *argv[])
             HandleTCPClient(clntSock);
             exit(0);
         }
-
-        printf("with child process: %d\n", processID);
-        close(clntSock);  /* 親プロセスはクライアントのソケットをクローズ */
-        childProcCount++; /* 子プロセスの数をインクリメント */
+        else
+        {
+            printf("with child process: %d\n", processID);
+            close(clntSock);  /* 親プロセスはクライアントのソケットをクローズ */
+            childProcCount++; /* 子プロセスの数をインクリメント */
+        }
 
         /* ゾンビプロセスの処理 */
         while (childProcCount)
@@ -0,0 +1,256 @@
+#include "TCPEchoServer.h"
+#include <sys/wait.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+#define DEFAULT_WORKERS 4  /* 事前に生成する子プロセス数のデフォルト */
+#define WORKERMINLIFE 1    /* これより短い秒数で終了した子プロセスは、すぐには生成し直さない */
+#define RESPAWNMAXDELAY 32  /* 生成し直すまでの待ち時間の上限（秒） */
+
+/* 子プロセスの枠 */
+struct WorkerSlot
+{
+    pid_t pid;        /* 子プロセスのプロセスID（空きなら0） */
+    time_t startedAt; /* 生成した時刻 */
+    time_t respawnAt; /* 空きのとき、生成し直す時刻 */
+    int delay;        /* 次に待たせる秒数（すぐに終了するたびに倍にする） */
+};
+
+/* 子プロセスを生成する。失敗したら-1を返す */
+pid_t SpawnWorker(int servSock);
+/* 時刻が来た空きの枠に子プロセスを生成し、次に生成し直す時刻にSIGALRMを予約する */
+void RespawnWorkers(int servSock, struct WorkerSlot *workers, int numWorkers);
+/* 子プロセスの処理（接続の受け入れとエコーを繰り返す） */
+void WorkerLoop(int servSock);
+/* SIGCHLD, SIGALRM, SIGTERM, SIGINTを処理するシグナルハンドラ */
+void SupervisorSignalHandler(int signalType);
+
+volatile sig_atomic_t childExited = 0; /* 子プロセスが終了した */
+volatile sig_atomic_t respawnDue = 0;  /* 生成し直す時刻になった */
+volatile sig_atomic_t terminating = 0; /* 終了要求を受けた */
+
+int main(int argc, char const *argv[])
+{
+    int servSock;                /* サーバーのソケットディスクリプタ */
+    const char *servAddress;     /* サーバーのポート、またはunix:<パス>など */
+    int numWorkers;              /* 子プロセスの数 */
+    struct WorkerSlot *workers;  /* 子プロセスの枠 */
+    pid_t processID;             /* 終了した子プロセスのプロセスID */
+    time_t now;                  /* 現在時刻 */
+    struct sigaction handler;    /* シグナルハンドラ */
+    sigset_t blockMask;          /* 待機中以外はブロックするシグナル */
+    sigset_t waitMask;           /* sigsuspend()中のシグナルマスク */
+    int i;                       /* ループカウンタ */
+
+    /* 引数をチェック */
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "Usage: %s <Server Port or Address> [<Workers: default %d>]\n", argv[0], DEFAULT_WORKERS);
+        exit(1);
+    }
+    servAddress = argv[1];                                      /* 1つ目の引数: ポート */
+    numWorkers = (argc == 3) ? atoi(argv[2]) : DEFAULT_WORKERS; /* 2つ目の引数: 子プロセス数 */
+    if (numWorkers < 1)
+    {
+        numWorkers = 1;
+    }
+
+    if ((workers = (struct WorkerSlot *)calloc(numWorkers, sizeof(struct WorkerSlot))) == NULL)
+    {
+        DieWithError("malloc() failed");
+    }
+
+    /* シグナルハンドラを設定 */
+    handler.sa_handler = SupervisorSignalHandler;
+    if (sigfillset(&handler.sa_mask) < 0)
+    {
+        DieWithError("sigfillset() failed");
+    }
+    handler.sa_flags = 0;
+    if (sigaction(SIGCHLD, &handler, 0) < 0 || sigaction(SIGALRM, &handler, 0) < 0 ||
+        sigaction(SIGTERM, &handler, 0) < 0 || sigaction(SIGINT, &handler, 0) < 0)
+    {
+        DieWithError("sigaction() failed");
+    }
+
+    /* フラグの確認とsigsuspend()の間にシグナルを取りこぼさないよう、普段はブロックしておく */
+    sigemptyset(&blockMask);
+    sigaddset(&blockMask, SIGCHLD);
+    sigaddset(&blockMask, SIGALRM);
+    sigaddset(&blockMask, SIGTERM);
+    sigaddset(&blockMask, SIGINT);
+    if (sigprocmask(SIG_BLOCK, &blockMask, &waitMask) < 0)
+    {
+        DieWithError("sigprocmask() failed");
+    }
+
+    /* サーバーのソケットを作成（子プロセスはこのソケットを継承して accept() する） */
+    servSock = CreateServerSocket(servAddress);
+
+    /* 起動時に一度だけ子プロセスを生成する（全ての枠の生成し直す時刻は0なので、すぐに生成する） */
+    RespawnWorkers(servSock, workers, numWorkers);
+
+    /* 監視ループ: 接続ごとの fork() や waitpid() は行わない */
+    while (!terminating)
+    {
+        /* シグナルが届くまで待機 */
+        sigsuspend(&waitMask);
+
+        if (!childExited && !respawnDue)
+        {
+            continue;
+        }
+        childExited = 0;
+        respawnDue = 0;
+
+        /* 終了した子プロセスを回収して枠を空ける。起動してすぐに終了した子プロセスの枠は、
+           生成し直すまでの待ち時間を倍にする（起動直後に落ち続けるときに fork() を繰り返さない） */
+        now = time(NULL);
+        while ((processID = waitpid((pid_t)-1, NULL, WNOHANG)) > 0)
+        {
+            for (i = 0; i < numWorkers; i++)
+            {
+                if (workers[i].pid == processID)
+                {
+                    workers[i].pid = 0;
+                    if (now - workers[i].startedAt < WORKERMINLIFE)
+                    {
+                        workers[i].delay = workers[i].delay == 0 ? 1 : workers[i].delay * 2;
+                        if (workers[i].delay > RESPAWNMAXDELAY)
+                        {
+                            workers[i].delay = RESPAWNMAXDELAY;
+                        }
+                    }
+                    else
+                    {
+                        workers[i].delay = 0;
+                    }
+                    workers[i].respawnAt = now + workers[i].delay;
+                    printf("worker %d exited, respawning in %d s\n", processID, workers[i].delay);
+                    break;
+                }
+            }
+        }
+
+        if (!terminating)
+        {
+            RespawnWorkers(servSock, workers, numWorkers);
+        }
+    }
+
+    /* 子プロセスを全て終了させる */
+    alarm(0);
+    for (i = 0; i < numWorkers; i++)
+    {
+        if (workers[i].pid > 0)
+        {
+            kill(workers[i].pid, SIGTERM);
+        }
+    }
+    while (wait(NULL) > 0 || errno == EINTR)
+    {
+        ;
+    }
+
+    close(servSock);
+    return 0;
+}
+
+pid_t SpawnWorker(int servSock)
+{
+    pid_t processID; /* プロセスID */
+
+    fflush(stdout); /* 未出力のバッファが子プロセスにコピーされないようにする */
+    if ((processID = fork()) < 0)
+    {
+        /* EAGAINなどは一時的なことが多いので、監視プロセスは終了せず、後で生成し直す */
+        perror("fork() failed");
+        return -1;
+    }
+    else if (processID == 0)
+    {
+        /* 子プロセス: 親から継承したシグナルの設定を元に戻す */
+        sigset_t emptyMask;
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGALRM, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        sigemptyset(&emptyMask);
+        sigprocmask(SIG_SETMASK, &emptyMask, NULL);
+
+        WorkerLoop(servSock);
+        exit(0);
+    }
+
+    printf("with child process: %d\n", processID);
+    return processID;
+}
+
+void RespawnWorkers(int servSock, struct WorkerSlot *workers, int numWorkers)
+{
+    time_t now = time(NULL); /* 現在時刻 */
+    time_t next = 0;         /* 次に生成し直す時刻（なければ0） */
+    pid_t processID;         /* 生成した子プロセスのプロセスID */
+    int i;                   /* ループカウンタ */
+
+    for (i = 0; i < numWorkers; i++)
+    {
+        if (workers[i].pid > 0)
+        {
+            continue;
+        }
+        if (workers[i].respawnAt <= now)
+        {
+            if ((processID = SpawnWorker(servSock)) > 0)
+            {
+                workers[i].pid = processID;
+                workers[i].startedAt = now;
+                continue;
+            }
+            /* fork() に失敗した枠は空けたままにして、待ち時間を倍にして試し直す */
+            workers[i].delay = workers[i].delay == 0 ? 1 : workers[i].delay * 2;
+            if (workers[i].delay > RESPAWNMAXDELAY)
+            {
+                workers[i].delay = RESPAWNMAXDELAY;
+            }
+            workers[i].respawnAt = now + workers[i].delay;
+        }
+        if (next == 0 || workers[i].respawnAt < next)
+        {
+            next = workers[i].respawnAt;
+        }
+    }
+
+    /* 空きの枠が残っていれば、最も早い時刻にSIGALRMで起こしてもらう */
+    alarm(next == 0 ? 0 : (unsigned int)(next > now ? next - now : 1));
+}
+
+void WorkerLoop(int servSock)
+{
+    int clntSock; /* クライアントのソケットディスクリプタ */
+
+    /* 全ての子プロセスが同じリスニングソケットで accept() を待つ。
+       接続要求が来るとカーネルがどれか1つの子プロセスを起こす */
+    for (;;)
+    {
+        clntSock = AcceptTCPConnection(servSock);
+        HandleTCPClient(clntSock);
+    }
+}
+
+void SupervisorSignalHandler(int signalType)
+{
+    if (signalType == SIGCHLD)
+    {
+        childExited = 1;
+    }
+    else if (signalType == SIGALRM)
+    {
+        respawnDue = 1;
+    }
+    else
+    {
+        terminating = 1;
+    }
+}
@@ -1,7 +1,21 @@
 #include "TCPEchoServer.h"
+#include "../TCP-Echo/Listener.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
 
-#define MAXPENDING 5   /* 待機中の接続要求の最大数 */
-#define RCVBUFSIZE 256 /* 受信バッファサイズ */
+#define MAXPENDING 5            /* 待機中の接続要求の最大数 */
+#define RCVBUFSIZE 256          /* 受信バッファサイズ */
+#define ACCEPTBACKOFFMAX_MS 100 /* accept()を再試行するまでの最大の待ち時間（ミリ秒） */
+#define IDLETIMEOUT_MS 60000    /* 何も受信しない接続を閉じるまでの時間（ミリ秒） */
+#define WRITETIMEOUT_MS 10000   /* 相手が受信せず送信が進まない接続を閉じるまでの時間（ミリ秒） */
+
+void ShedConnection(int servSock);
+void SetConnectionDeadlines(int clntSock);
+
+/* ディスクリプタが尽きたときに、待機中の接続要求を受け入れて閉じるための予備のディスクリプタ
+   （子プロセスはそれぞれ自分の複製を持つ） */
+int reserveFd = -1;
 
 void DieWithError(char *errorMessage)
 {
@@ -9,34 +23,14 @@ void DieWithError(char *errorMessage)
     exit(1);
 }
 
-int CreateTCPClientSocket(unsigned short port)
+/* 待ち受けるアドレスはポート番号のほか、unix:<パス> などで指定できる（../TCP-Echo/Listener.hを参照） */
+int CreateServerSocket(const char *address)
 {
     int sock;
-    struct sockaddr_in echoServAddr;
-
-    /* サーバのソケットを作成 */
-    if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
-    {
-        DieWithError("socket() failed");
-    }
-
-    /* サーバのアドレス構造体を作成 */
-    memset(&echoServAddr, 0, sizeof(echoServAddr));
-    echoServAddr.sin_family = AF_INET;
-    echoServAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    echoServAddr.sin_port = htons(port);
 
-    /* サーバのアドレス構造体にソケットをバインド */
-    if (bind(sock, (struct sockaddr *)&echoServAddr, sizeof(echoServAddr)) < 0)
-    {
-        DieWithError("bind() failed");
-    }
+    sock = CreateListener(address, MAXPENDING, 0);
 
-    /* クライアントからの接続要求を待機 */
-    if (listen(sock, MAXPENDING) < 0)
-    {
-        DieWithError("listen() failed");
-    }
+    reserveFd = open("/dev/null", O_RDONLY);
 
     return sock;
 }
@@ -44,47 +38,137 @@ int CreateTCPClientSocket(unsigned short port)
 int AcceptTCPConnection(int servSock)
 {
     int clntSock;
-    struct sockaddr_in echoClntAddr;
+    struct sockaddr_storage echoClntAddr;
     unsigned int clntLen;
+    char clntName[INET6_ADDRSTRLEN + 8];
 
-    /* クライアントのアドレス構造体の長さを初期化 */
-    clntLen = sizeof(echoClntAddr);
+    long backoffMs = 0; /* 次に再試行するまでの待ち時間（ミリ秒） */
+    struct timespec backoff;
 
-    /* クライアントからの接続要求を受け入れ */
-    if ((clntSock = accept(servSock, (struct sockaddr *)&echoClntAddr, &clntLen)) < 0)
+    for (;;)
     {
-        DieWithError("accept() failed");
+        /* クライアントのアドレス構造体の長さを初期化 */
+        clntLen = sizeof(echoClntAddr);
+
+        /* クライアントからの接続要求を受け入れ */
+        if ((clntSock = accept(servSock, (struct sockaddr *)&echoClntAddr, &clntLen)) >= 0)
+        {
+            break;
+        }
+
+        /* 1つの接続要求のエラーや資源の不足でサーバー全体を止めない。
+           リスニングソケットそのものが使えない場合（EBADF, EINVALなど）だけ終了する */
+        switch (errno)
+        {
+        case EINTR:
+        case ECONNABORTED: /* 受け入れる前にクライアントがリセットした */
+        case EPROTO:
+        case ENETDOWN:
+        case ENETUNREACH:
+        case EHOSTUNREACH:
+        case EHOSTDOWN:
+        case ENONET:
+        case ENOPROTOOPT:
+        case EOPNOTSUPP:
+            continue;
+        case EMFILE:
+        case ENFILE:
+            ShedConnection(servSock);
+            break;
+        case ENOBUFS:
+        case ENOMEM:
+        case EPERM:
+            break;
+        default:
+            DieWithError("accept() failed");
+        }
+
+        /* 資源が足りないときは、接続が閉じられて資源が戻るまで待つ間隔を倍々に延ばす */
+        perror("accept() failed");
+        backoffMs = backoffMs == 0 ? 1 : backoffMs * 2;
+        if (backoffMs > ACCEPTBACKOFFMAX_MS)
+        {
+            backoffMs = ACCEPTBACKOFFMAX_MS;
+        }
+        backoff.tv_sec = backoffMs / 1000;
+        backoff.tv_nsec = backoffMs % 1000 * 1000000;
+        nanosleep(&backoff, NULL);
     }
 
-    printf("Handling client %s\n", inet_ntoa(echoClntAddr.sin_addr));
+    FormatPeerAddress((struct sockaddr *)&echoClntAddr, clntName, sizeof(clntName));
+    printf("Handling client %s\n", clntName);
+
+    SetConnectionDeadlines(clntSock);
 
     return clntSock;
 }
 
+/* ブロッキングの送受信に期限を付ける。接続ごとにプロセスが1つ張り付くので、
+   何も送らない・受信しないクライアントがプロセスを持ったままにならないようにする。
+   期限を過ぎるとrecv()/send()はEAGAINで戻り、接続を閉じる */
+void SetConnectionDeadlines(int clntSock)
+{
+    struct timeval timeout; /* 送受信の期限 */
+
+    timeout.tv_sec = IDLETIMEOUT_MS / 1000;
+    timeout.tv_usec = IDLETIMEOUT_MS % 1000 * 1000;
+    setsockopt(clntSock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    timeout.tv_sec = WRITETIMEOUT_MS / 1000;
+    timeout.tv_usec = WRITETIMEOUT_MS % 1000 * 1000;
+    setsockopt(clntSock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+/* 予備のディスクリプタを閉じて空きを1つ作り、待機中の接続要求を1つ受け入れてすぐに閉じる。
+   受け入れずにおくと接続要求はlisten()のキューに残り、クライアントは応答のないまま待たされ続ける */
+void ShedConnection(int servSock)
+{
+    int clntSock; /* すぐに閉じるソケット */
+
+    if (reserveFd < 0)
+    {
+        reserveFd = open("/dev/null", O_RDONLY);
+        return;
+    }
+
+    close(reserveFd);
+    if ((clntSock = accept(servSock, NULL, NULL)) >= 0)
+    {
+        close(clntSock);
+    }
+    reserveFd = open("/dev/null", O_RDONLY);
+}
+
 void HandleTCPClient(int clntSocket)
 {
     char echoBuffer[RCVBUFSIZE]; /* エコー文字列のバッファ */
     int recvMsgSize;             /* 受信メッセージのサイズ */
+    int sentMsgSize;             /* 送信したメッセージのサイズ */
 
-    /* クライアントからのメッセージを受信 */
+    /* クライアントからのメッセージを受信（期限を過ぎたらEAGAINで戻る） */
     if ((recvMsgSize = recv(clntSocket, echoBuffer, RCVBUFSIZE, 0)) < 0)
     {
-        DieWithError("recv() failed");
+        perror(errno == EAGAIN ? "recv() timed out" : "recv() failed"); /* この接続だけを閉じる */
     }
 
     /* 受信したデータをクライアントにエコーバック */
     while (recvMsgSize > 0)
     {
-        /* クライアントにデータを送信 */
-        if (send(clntSocket, echoBuffer, recvMsgSize, 0) != recvMsgSize)
+        /* クライアントにデータを送信（相手が閉じていてもSIGPIPEでプロセスを終了させない） */
+        if ((sentMsgSize = send(clntSocket, echoBuffer, recvMsgSize, MSG_NOSIGNAL)) != recvMsgSize)
         {
-            DieWithError("send() failed");
+            /* 一部だけ送れて戻ったのは、送信の期限を過ぎたとき */
+            if (sentMsgSize >= 0)
+            {
+                errno = EAGAIN;
+            }
+            perror(errno == EAGAIN ? "send() timed out" : "send() failed"); /* この接続だけを閉じる */
+            break;
         }
 
         /* クライアントからのメッセージを受信 */
         if ((recvMsgSize = recv(clntSocket, echoBuffer, RCVBUFSIZE, 0)) < 0)
         {
-            DieWithError("recv() failed");
+            perror(errno == EAGAIN ? "recv() timed out" : "recv() failed"); /* この接続だけを閉じる */
         }
     }
 
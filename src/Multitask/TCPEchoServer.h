@@ -7,5 +7,5 @@
 
 void DieWithError(char *errorMessage);
 void HandleTCPClient(int clntSocket);
-int CreateTCPClientSocket(unsigned short port);
+int CreateServerSocket(const char *address);
 int AcceptTCPConnection(int servSock);
\ No newline at end of file
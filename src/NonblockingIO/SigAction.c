@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <signal.h>
 #include <unistd.h>
 
@@ -9,15 +10,20 @@ void DieWithError(const char *errorMessage)
     exit(1);
 }
 
+volatile sig_atomic_t interrupted = 0; /* SIGINTを受けた */
+
+/* ハンドラではフラグを立てるだけにする。printf()やexit()は非同期シグナル安全でなく、
+   割り込まれた処理の途中でロックやバッファを壊すことがある */
 void InterruptSignalHandler(int signalType)
 {
-    printf("Interrupt Received. Exiting program.\n");
-    exit(1);
+    interrupted = 1;
 }
 
 int main(int argc, char const *argv[])
 {
     struct sigaction handler; /* シグナルハンドラ */
+    sigset_t blockMask;       /* 待機中以外はブロックするシグナル */
+    sigset_t origMask;        /* sigsuspend()中のシグナルマスク（元のマスク） */
 
     /* InterruptSignalHandler()をハンドラ関数として設定 */
     handler.sa_handler = InterruptSignalHandler;
@@ -33,10 +39,23 @@ int main(int argc, char const *argv[])
         DieWithError("sigaction() failed");
     }
 
-    for (;;)
+    /* フラグを確かめてからpause()するまでの間にシグナルが届くと、ハンドラはフラグを立てるが
+       pause()は次のシグナルまで戻らない。普段はブロックしておき、sigsuspend()で
+       マスクを外すのと待機を1つの操作で行う */
+    sigemptyset(&blockMask);
+    sigaddset(&blockMask, SIGINT);
+    if (sigprocmask(SIG_BLOCK, &blockMask, &origMask) < 0)
+    {
+        DieWithError("sigprocmask() failed");
+    }
+
+    while (!interrupted)
     {
-        pause(); /* プログラムが終了するまで待機 */
+        sigsuspend(&origMask); /* シグナルを受けるまで待機 */
     }
 
+    /* 終了処理はハンドラから戻った後、通常の流れの中で行う */
+    printf("Interrupt Received. Exiting program.\n");
+
     return 0;
 }
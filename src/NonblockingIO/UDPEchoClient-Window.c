@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include "../EventLoop/TimerWheel.h"
+
+#define ECHOMAX 65507        /* データグラムの最大長 */
+#define SEQSIZE 8            /* ペイロードの先頭に置くシーケンス番号のバイト数 */
+#define MAXTRIES 5           /* 1つのリクエストを送信する最大回数 */
+#define INITRTO_US 1000000   /* 最初のRTT測定までのRTO（RFC 6298の1秒） */
+#define MINRTO_US 2000       /* RTOの下限（LAN向けにRFC 6298の1秒より小さくする） */
+#define MAXRTO_US 60000000   /* RTOの上限 */
+#define CLOCKGRAN_US 1000    /* タイマーの粒度（タイミングホイールの1ティック = 1ms） */
+
+/* 応答待ちのリクエスト */
+struct Request
+{
+    uint64_t seq;         /* シーケンス番号 */
+    int inUse;            /* 応答待ち */
+    int tries;            /* 送信した回数 */
+    uint64_t firstSentUs; /* 最初に送信した時刻 */
+    long sentRto;         /* 最後に送信したときのRTO */
+    struct Timer timer;   /* 再送タイマー */
+};
+
+/* TCPと同じ方法（RFC 6298）で求めるRTTの推定値（マイクロ秒） */
+struct RttEstimator
+{
+    long srtt;     /* 平滑化したRTT */
+    long rttvar;   /* RTTのばらつき */
+    long rto;      /* 再送タイムアウト */
+    int hasSample; /* RTTを1回以上測定した */
+};
+
+void DieWithError(const char *errorMessage);
+uint64_t NowUs(void);
+void SendRequest(struct Request *req);
+void RetransmitTimeout(void *arg);
+void HandleReplies(void);
+void UpdateRtt(long rtt);
+
+int sock;                      /* ソケットディスクリプタ */
+int payloadSize = 32;          /* リクエスト1つのバイト数 */
+char *payload;                 /* 送信するデータ */
+int windowSize = 32;           /* 応答を待たずに送れるリクエストの最大数 */
+struct Request *window;        /* 応答待ちのリクエスト（シーケンス番号 % windowSize の位置に置く） */
+struct TimerWheel wheel;       /* 再送タイマーのタイミングホイール（ミリ秒単位） */
+struct RttEstimator est;       /* RTTの推定値 */
+unsigned long completed = 0;   /* 応答を受け取ったリクエスト数 */
+unsigned long lost = 0;        /* MAXTRIES回送っても応答がなかったリクエスト数 */
+unsigned long transmitted = 0; /* 送信したデータグラム数（再送を含む） */
+unsigned long retransmits = 0; /* 再送したデータグラム数 */
+unsigned long duplicates = 0;  /* 応答待ちでないシーケンス番号の応答の数 */
+uint64_t minRtt = UINT64_MAX;  /* 最小の応答時間 */
+uint64_t maxRtt = 0;           /* 最大の応答時間 */
+uint64_t sumRtt = 0;           /* 応答時間の合計 */
+
+int main(int argc, char *argv[])
+{
+    struct sockaddr_in echoServAddr; /* エコーサーバのアドレス */
+    unsigned short echoServPort;     /* エコーサーバのポート */
+    char *servIP;                    /* サーバのIPアドレス */
+    unsigned long total = 10000;     /* 送信するリクエスト数 */
+    uint64_t nextSeq = 0;            /* 次に送るリクエストのシーケンス番号 */
+    struct pollfd pfd;               /* poll()で待つソケット */
+    uint64_t startUs;                /* 計測の開始時刻 */
+    double elapsed;                  /* 計測時間（秒） */
+    struct Request *req;             /* 送信するリクエスト */
+    int opt;                         /* getopt()の戻り値 */
+
+    while ((opt = getopt(argc, argv, "w:n:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'w':
+            windowSize = atoi(optarg);
+            break;
+        case 'n':
+            total = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            payloadSize = atoi(optarg);
+            break;
+        default:
+            windowSize = 0; /* 不明なオプションは使い方を表示して終了 */
+            break;
+        }
+    }
+
+    /* 引数の数が正しいか確認 */
+    if (optind >= argc || argc - optind > 2 || windowSize < 1 || total < 1 ||
+        payloadSize < SEQSIZE || payloadSize > ECHOMAX)
+    {
+        fprintf(stderr, "Usage: %s [-w <Window: default 32>] [-n <Requests: default 10000>] "
+                        "[-s <Payload Bytes: %d-%d, default 32>] <Server IP> [<Server Port>]\n",
+                argv[0], SEQSIZE, ECHOMAX);
+        exit(1);
+    }
+    servIP = argv[optind];
+    echoServPort = (argc - optind == 2) ? atoi(argv[optind + 1]) : 7;
+
+    if ((payload = (char *)malloc(payloadSize)) == NULL ||
+        (window = (struct Request *)calloc(windowSize, sizeof(struct Request))) == NULL)
+    {
+        DieWithError("malloc() failed");
+    }
+    memset(payload, 'x', payloadSize);
+
+    /* UDPによるデータグラムソケットを作成する */
+    if ((sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+    {
+        DieWithError("socket() failed");
+    }
+
+    /* サーバーのアドレス構造体を作成 */
+    memset(&echoServAddr, 0, sizeof(echoServAddr));
+    echoServAddr.sin_family = AF_INET;
+    echoServAddr.sin_addr.s_addr = inet_addr(servIP);
+    echoServAddr.sin_port = htons(echoServPort);
+
+    /* 送信先を固定し、サーバー以外からのデータグラムを受け取らない */
+    if (connect(sock, (struct sockaddr *)&echoServAddr, sizeof(echoServAddr)) < 0)
+    {
+        DieWithError("connect() failed");
+    }
+    if (fcntl(sock, F_SETFL, O_NONBLOCK | fcntl(sock, F_GETFL)) < 0)
+    {
+        DieWithError("Unable to put sock into nonblocking mode");
+    }
+
+    est.rto = INITRTO_US;
+    startUs = NowUs();
+    TimerWheelInit(&wheel, startUs / 1000);
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+
+    while (completed + lost < total)
+    {
+        /* ウィンドウに空きがある間、新しいリクエストを送る。
+           一番古い応答待ちのリクエストの位置に追いついたら、その応答か再送の打ち切りを待つ */
+        while (nextSeq < total && !window[nextSeq % windowSize].inUse)
+        {
+            req = &window[nextSeq % windowSize];
+            req->seq = nextSeq++;
+            req->inUse = 1;
+            req->tries = 0;
+            req->firstSentUs = NowUs();
+            TimerInit(&req->timer, RetransmitTimeout, req);
+            SendRequest(req);
+        }
+
+        /* 応答か、次の再送タイマーの期限を待つ（SIGALRMは使わない） */
+        if (poll(&pfd, 1, (int)TimerWheelNextTimeout(&wheel)) < 0 && errno != EINTR)
+        {
+            DieWithError("poll() failed");
+        }
+
+        HandleReplies();
+
+        /* 期限が来たリクエストを再送する */
+        TimerWheelAdvance(&wheel, NowUs() / 1000);
+    }
+
+    elapsed = (NowUs() - startUs) / 1e6;
+    printf("requests: %lu  completed: %lu  lost: %lu  window: %d  payload: %d bytes  %.3f seconds\n",
+           total, completed, lost, windowSize, payloadSize, elapsed);
+    printf("datagrams sent: %lu  retransmits: %lu (%.2f%%)  duplicate replies: %lu\n",
+           transmitted, retransmits, transmitted ? 100.0 * retransmits / transmitted : 0.0, duplicates);
+    printf("throughput: %.1f req/s\n", completed / elapsed);
+    if (completed > 0)
+    {
+        printf("response time (us): min %llu  avg %.1f  max %llu\n", (unsigned long long)minRtt,
+               (double)sumRtt / completed, (unsigned long long)maxRtt);
+    }
+    printf("srtt: %ld us  rttvar: %ld us  rto: %ld us\n", est.srtt, est.rttvar, est.rto);
+
+    close(sock);
+    return 0;
+}
+
+void DieWithError(const char *errorMessage)
+{
+    perror(errorMessage);
+    exit(1);
+}
+
+uint64_t NowUs(void)
+{
+    struct timespec ts; /* 現在時刻 */
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* シーケンス番号をペイロードの先頭に書いて送信し、再送タイマーをRTO後に設定する */
+void SendRequest(struct Request *req)
+{
+    uint32_t seqNet[2]; /* ネットワークバイト順のシーケンス番号 */
+
+    seqNet[0] = htonl((uint32_t)(req->seq >> 32));
+    seqNet[1] = htonl((uint32_t)req->seq);
+    memcpy(payload, seqNet, SEQSIZE);
+
+    /* 送信バッファが一杯で送れなくても、再送タイマーで送り直す */
+    if (send(sock, payload, payloadSize, 0) < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+        errno != ECONNREFUSED)
+    {
+        DieWithError("send() failed");
+    }
+    req->tries++;
+    req->sentRto = est.rto;
+    transmitted++;
+
+    TimerAdd(&wheel, &req->timer, (NowUs() + est.rto + 999) / 1000);
+}
+
+/* 再送タイマーの期限切れ */
+void RetransmitTimeout(void *arg)
+{
+    struct Request *req = (struct Request *)arg; /* 応答のないリクエスト */
+
+    /* 送信回数の上限に達したら、失われたリクエストとして数えてウィンドウから外す */
+    if (req->tries >= MAXTRIES)
+    {
+        req->inUse = 0;
+        lost++;
+        return;
+    }
+
+    /* TCPと同じくRTOを倍にして再送する（次にRTTを測定できたら計算し直す）。
+       ウィンドウの全てのリクエストが同じ損失でまとめて期限切れになっても倍にするのは1回だけにするため、
+       今のRTOで送ったリクエストの期限切れでだけ倍にし、それより前のRTOで送ったものは今のRTOで送り直す */
+    if (req->sentRto == est.rto)
+    {
+        est.rto = est.rto * 2 > MAXRTO_US ? MAXRTO_US : est.rto * 2;
+    }
+    retransmits++;
+    SendRequest(req);
+}
+
+/* 届いた応答を全て受信し、シーケンス番号で応答待ちのリクエストと突き合わせる（順不同） */
+void HandleReplies(void)
+{
+    char echoBuffer[ECHOMAX]; /* 受信バッファ */
+    int respLen;              /* 受信したバイト数 */
+    uint32_t seqNet[2];       /* ネットワークバイト順のシーケンス番号 */
+    uint64_t seq;             /* 応答のシーケンス番号 */
+    uint64_t rtt;             /* 応答時間 */
+    struct Request *req;      /* 応答に対応するリクエスト */
+
+    for (;;)
+    {
+        if ((respLen = recv(sock, echoBuffer, sizeof(echoBuffer), 0)) < 0)
+        {
+            if (errno == EINTR || errno == ECONNREFUSED)
+            {
+                continue; /* ICMPポート到達不能は再送タイマーに任せる */
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return;
+            }
+            DieWithError("recv() failed");
+        }
+        if (respLen < SEQSIZE)
+        {
+            continue;
+        }
+
+        memcpy(seqNet, echoBuffer, SEQSIZE);
+        seq = ((uint64_t)ntohl(seqNet[0]) << 32) | ntohl(seqNet[1]);
+        req = &window[seq % windowSize];
+        if (!req->inUse || req->seq != seq)
+        {
+            /* 再送した後に元の応答も届いた場合など */
+            duplicates++;
+            continue;
+        }
+
+        rtt = NowUs() - req->firstSentUs;
+        if (req->tries == 1)
+        {
+            /* 再送したリクエストの応答は、どの送信に対するものかわからないので測定に使わない（Karnのアルゴリズム） */
+            UpdateRtt((long)rtt);
+        }
+
+        /* 応答時間は最初の送信から数える */
+        if (rtt < minRtt)
+        {
+            minRtt = rtt;
+        }
+        if (rtt > maxRtt)
+        {
+            maxRtt = rtt;
+        }
+        sumRtt += rtt;
+
+        TimerCancel(&wheel, &req->timer);
+        req->inUse = 0;
+        completed++;
+    }
+}
+
+/* RFC 6298 によるSRTT/RTTVAR/RTOの更新 */
+void UpdateRtt(long rtt)
+{
+    long delta; /* 推定値と測定値の差 */
+
+    if (!est.hasSample)
+    {
+        est.srtt = rtt;
+        est.rttvar = rtt / 2;
+        est.hasSample = 1;
+    }
+    else
+    {
+        delta = est.srtt > rtt ? est.srtt - rtt : rtt - est.srtt;
+        est.rttvar = (3 * est.rttvar + delta) / 4; /* beta = 1/4 */
+        est.srtt = (7 * est.srtt + rtt) / 8;       /* alpha = 1/8 */
+    }
+
+    est.rto = est.srtt + (CLOCKGRAN_US > 4 * est.rttvar ? CLOCKGRAN_US : 4 * est.rttvar);
+    if (est.rto < MINRTO_US)
+    {
+        est.rto = MINRTO_US;
+    }
+    if (est.rto > MAXRTO_US)
+    {
+        est.rto = MAXRTO_US;
+    }
+}
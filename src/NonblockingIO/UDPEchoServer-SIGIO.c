@@ -8,6 +8,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/file.h>
+#include "../Threads/Log.h"
 
 /* エコー文字列の最大長 */
 #define ECHOMAX 255
@@ -56,6 +57,11 @@ int main(int argc, char const *argv[])
         DieWithError("bind() failed");
     }
 
+    /* printf()はシグナルハンドラの中で呼べない（stdoutのロックを持ったまま割り込まれるとデッドロックする）ので、
+       ハンドラではリングにレコードを書くだけにする。リングの確保は安全でないので、ハンドラを設定する前に済ませる */
+    LogInit(LOG_INFO);
+    LogThreadInit();
+
     /* シグナルハンドラを設定 */
     /* 全てのシグナルをマスク（ブロック）する */
     handler.sa_handler = SIGIOHandler;
@@ -82,8 +88,8 @@ int main(int argc, char const *argv[])
         DieWithError("Unable to set process owner to us");
     }
 
-    /* ソケットを非ブロッキングモードに設定 */
-    if (fcntl(sock, F_SETFL, O_NONBLOCK | fcntl(sock, F_GETFL)) < 0)
+    /* ソケットを非ブロッキングモードに設定し、データの到着をSIGIOで通知させる */
+    if (fcntl(sock, F_SETFL, O_NONBLOCK | FASYNC | fcntl(sock, F_GETFL)) < 0)
     {
         DieWithError("Unable to put client sock into nonblocking mode");
     }
@@ -124,7 +130,8 @@ void SIGIOHandler(int signalType)
         }
         else
         {
-            printf("Handling client %s\n", inet_ntoa(echoClntAddr.sin_addr));
+            LogInfo("Handling client %lld.%lld.%lld.%lld:%lld", LOGADDR(echoClntAddr.sin_addr),
+                    (long long)ntohs(echoClntAddr.sin_port));
 
             /* 受信したメッセージをクライアントにエコーバック */
             if (sendto(sock, echoBuffer, recvMsgSize, 0, (struct sockaddr *)&echoClntAddr, sizeof(echoClntAddr)) != recvMsgSize)
@@ -132,11 +139,12 @@ void SIGIOHandler(int signalType)
                 DieWithError("sendto() sent a different number of bytes than expected");
             }
         }
-    } while (clntlen >= 0);
+    } while (recvMsgSize >= 0);
 }
 
+/* errorMessageは文字列リテラルを渡す（ロガースレッドが後から書式として読むため） */
 void DieWithError(const char *errorMessage)
 {
-    perror(errorMessage);
+    LogErrno(LOG_ERROR, errorMessage);
     exit(1);
 }
\ No newline at end of file
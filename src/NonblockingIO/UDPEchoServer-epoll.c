@@ -0,0 +1,354 @@
+#include <stdio.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/* エコー文字列の最大長 */
+#define ECHOMAX 65536
+/* 1回の通知で処理するデータグラムの上限（バックグラウンド処理を待たせすぎないため） */
+#define RECVBUDGET 256
+/* 登録できるバックグラウンド処理の最大数 */
+#define MAXIDLETASKS 16
+/* 他のスレッドから投入できる処理の最大数 */
+#define MAXPOSTED 64
+
+/* バックグラウンド処理の関数 */
+typedef void (*TaskFunc)(void *arg);
+
+/* 一定間隔で実行するバックグラウンド処理 */
+struct IdleTask
+{
+    TaskFunc run;        /* 実行する関数 */
+    void *arg;           /* 関数に渡す引数 */
+    long intervalMs;     /* 実行間隔（ミリ秒） */
+    long long nextRunMs; /* 次に実行する時刻 */
+};
+
+/* 他のスレッドから投入された処理 */
+struct PostedTask
+{
+    TaskFunc run; /* 実行する関数 */
+    void *arg;    /* 関数に渡す引数 */
+};
+
+/* エラーハンドリング関数 */
+void DieWithError(const char *errorMessage);
+/* 単調増加する現在時刻（ミリ秒） */
+long long NowMs(void);
+/* 一定間隔で実行するバックグラウンド処理を登録する */
+void RegisterIdleTask(TaskFunc run, void *arg, long intervalMs);
+/* 他のスレッドからイベントループに処理を投入する */
+void PostTask(TaskFunc run, void *arg);
+/* 期限が来たバックグラウンド処理を実行し、次の期限までのミリ秒を返す */
+int RunIdleTasks(void);
+/* 投入された処理を実行する */
+void RunPostedTasks(void);
+/* 受信したデータグラムをエコーバックする */
+void HandleDatagrams(void);
+/* UDPエコーサーバーとは別の処理をする関数 */
+void UseIdleTime(void *arg);
+/* 統計を表示する（イベントループのスレッドで実行される） */
+void PrintStats(void *arg);
+/* 定期的にPrintStatsを投入するスレッド */
+void *ReporterMain(void *arg);
+
+/* ソケットディスクリプタ */
+int sock;
+/* 他のスレッドからイベントループを起こすeventfd */
+int wakeFd;
+/* バックグラウンド処理 */
+struct IdleTask idleTasks[MAXIDLETASKS];
+int numIdleTasks = 0;
+/* 他のスレッドから投入された処理（postedMutexで保護する） */
+struct PostedTask posted[MAXPOSTED];
+int numPosted = 0;
+pthread_mutex_t postedMutex = PTHREAD_MUTEX_INITIALIZER;
+/* エコーしたデータグラム数と、送信できずに捨てたデータグラム数（イベントループのスレッドだけが触る） */
+unsigned long echoedCount = 0;
+unsigned long droppedCount = 0;
+
+int main(int argc, char const *argv[])
+{
+    struct sockaddr_in echoServAddr; /* エコーサーバのアドレス */
+    unsigned short echoServPort;     /* エコーサーバのポート */
+    int epfd;                        /* epollのファイルディスクリプタ */
+    struct epoll_event ev;           /* 登録するイベント */
+    struct epoll_event events[2];    /* 発生したイベント */
+    int nfds;                        /* 発生したイベントの数 */
+    int timeoutMs;                   /* 次のバックグラウンド処理までの時間 */
+    pthread_t threadID;              /* 統計スレッドのID */
+    int i;                           /* ループカウンタ */
+
+    /* 引数の数が正しいか確認 */
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <Server Port>\n", argv[0]);
+        exit(1);
+    }
+
+    /* 第1引数: サーバのポート */
+    echoServPort = atoi(argv[1]);
+
+    /* ソケットの作成 */
+    if ((sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+    {
+        DieWithError("socket() failed");
+    }
+
+    /* サーバのアドレス構造体を作成 */
+    memset(&echoServAddr, 0, sizeof(echoServAddr));
+    echoServAddr.sin_family = AF_INET;                /* インターネットアドレスファミリ */
+    echoServAddr.sin_addr.s_addr = htonl(INADDR_ANY); /* サーバのIPアドレス */
+    echoServAddr.sin_port = htons(echoServPort);      /* サーバのポート */
+
+    /* ソケットにアドレスをバインド */
+    if (bind(sock, (struct sockaddr *)&echoServAddr, sizeof(echoServAddr)) < 0)
+    {
+        DieWithError("bind() failed");
+    }
+
+    /* ソケットを非ブロッキングモードに設定 */
+    if (fcntl(sock, F_SETFL, O_NONBLOCK | fcntl(sock, F_GETFL)) < 0)
+    {
+        DieWithError("Unable to put client sock into nonblocking mode");
+    }
+
+    /* SIGIOの代わりに、ソケットの受信可能とeventfdをepollで待つ */
+    if ((wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+        DieWithError("eventfd() failed");
+    }
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        DieWithError("epoll_create1() failed");
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = sock;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) < 0)
+    {
+        DieWithError("epoll_ctl() failed");
+    }
+    ev.data.fd = wakeFd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakeFd, &ev) < 0)
+    {
+        DieWithError("epoll_ctl() failed");
+    }
+
+    /* バックグラウンド処理を登録 */
+    RegisterIdleTask(UseIdleTime, NULL, 3000);
+
+    /* 統計はイベントループのスレッドだけが触るので、別スレッドからは処理を投入して表示させる */
+    if (pthread_create(&threadID, NULL, ReporterMain, NULL) != 0)
+    {
+        DieWithError("pthread_create() failed");
+    }
+
+    for (;;)
+    {
+        /* 期限が来たバックグラウンド処理を実行し、次の期限まで待つ */
+        timeoutMs = RunIdleTasks();
+
+        if ((nfds = epoll_wait(epfd, events, 2, timeoutMs)) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            DieWithError("epoll_wait() failed");
+        }
+
+        for (i = 0; i < nfds; i++)
+        {
+            if (events[i].data.fd == sock)
+            {
+                HandleDatagrams();
+            }
+            else
+            {
+                RunPostedTasks();
+            }
+        }
+    }
+}
+
+long long NowMs(void)
+{
+    struct timespec ts; /* 現在時刻 */
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void RegisterIdleTask(TaskFunc run, void *arg, long intervalMs)
+{
+    if (numIdleTasks >= MAXIDLETASKS)
+    {
+        fprintf(stderr, "too many idle tasks\n");
+        exit(1);
+    }
+    idleTasks[numIdleTasks].run = run;
+    idleTasks[numIdleTasks].arg = arg;
+    idleTasks[numIdleTasks].intervalMs = intervalMs;
+    idleTasks[numIdleTasks].nextRunMs = NowMs() + intervalMs;
+    numIdleTasks++;
+}
+
+int RunIdleTasks(void)
+{
+    long long now = NowMs(); /* 現在時刻 */
+    long long nearest = -1;  /* 最も近い次の期限 */
+    int i;                   /* ループカウンタ */
+
+    for (i = 0; i < numIdleTasks; i++)
+    {
+        if (idleTasks[i].nextRunMs <= now)
+        {
+            idleTasks[i].run(idleTasks[i].arg);
+            idleTasks[i].nextRunMs = now + idleTasks[i].intervalMs;
+        }
+        if (nearest < 0 || idleTasks[i].nextRunMs < nearest)
+        {
+            nearest = idleTasks[i].nextRunMs;
+        }
+    }
+
+    /* 処理が1つもなければ無期限に待つ */
+    return (nearest < 0) ? -1 : (int)(nearest - now);
+}
+
+void PostTask(TaskFunc run, void *arg)
+{
+    unsigned long long one = 1; /* eventfdに加える値 */
+
+    pthread_mutex_lock(&postedMutex);
+    if (numPosted < MAXPOSTED)
+    {
+        posted[numPosted].run = run;
+        posted[numPosted].arg = arg;
+        numPosted++;
+    }
+    pthread_mutex_unlock(&postedMutex);
+
+    /* eventfdに書き込んでepoll_wait()を起こす */
+    if (write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        DieWithError("write() to eventfd failed");
+    }
+}
+
+void RunPostedTasks(void)
+{
+    unsigned long long count;           /* eventfdのカウンタ */
+    struct PostedTask tasks[MAXPOSTED]; /* 実行する処理 */
+    int numTasks;                       /* 実行する処理の数 */
+    int i;                              /* ループカウンタ */
+
+    /* eventfdを読んでカウンタを0に戻す */
+    if (read(wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    {
+        DieWithError("read() from eventfd failed");
+    }
+
+    /* ロックを持ったまま処理を実行しないよう、取り出してから実行する */
+    pthread_mutex_lock(&postedMutex);
+    numTasks = numPosted;
+    memcpy(tasks, posted, sizeof(struct PostedTask) * numTasks);
+    numPosted = 0;
+    pthread_mutex_unlock(&postedMutex);
+
+    for (i = 0; i < numTasks; i++)
+    {
+        tasks[i].run(tasks[i].arg);
+    }
+}
+
+void HandleDatagrams(void)
+{
+    struct sockaddr_in echoClntAddr; /* データグラムの送信元アドレス */
+    socklen_t clntLen;               /* クライアントアドレスの長さ */
+    int recvMsgSize;                 /* 受信メッセージのサイズ */
+    int sentMsgSize;                 /* 送信したメッセージのサイズ */
+    static char echoBuffer[ECHOMAX]; /* エコーバッファ */
+    int budget;                      /* この通知で処理できる残りのデータグラム数 */
+
+    /* 入力がなくなるか上限に達するまで処理する。
+       上限に達したらepoll_wait()に戻り、期限の来たバックグラウンド処理を先に実行する
+       （レベルトリガーなので残りのデータグラムはすぐに再通知される） */
+    for (budget = RECVBUDGET; budget > 0; budget--)
+    {
+        clntLen = sizeof(echoClntAddr);
+
+        if ((recvMsgSize = recvfrom(sock, echoBuffer, ECHOMAX, 0, (struct sockaddr *)&echoClntAddr, &clntLen)) < 0)
+        {
+            if (errno == EWOULDBLOCK || errno == EAGAIN)
+            {
+                return;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            DieWithError("recvfrom() failed");
+        }
+
+        /* 受信したメッセージをクライアントにエコーバック */
+        while ((sentMsgSize = sendto(sock, echoBuffer, recvMsgSize, 0, (struct sockaddr *)&echoClntAddr, clntLen)) < 0 &&
+               errno == EINTR)
+        {
+            ;
+        }
+        if (sentMsgSize < 0 && (errno == EBADF || errno == ENOTSOCK || errno == EFAULT))
+        {
+            DieWithError("sendto() failed");
+        }
+        if (sentMsgSize != recvMsgSize)
+        {
+            /* 送信元ポートが0のデータグラム（EINVAL）や送信バッファの不足（EAGAIN）など、
+               失敗はこのデータグラムだけのものなので、数えて捨て、次のデータグラムを処理する */
+            droppedCount++;
+            continue;
+        }
+        echoedCount++;
+    }
+}
+
+void UseIdleTime(void *arg)
+{
+    (void)arg;
+    printf(".");
+    fflush(stdout);
+}
+
+void PrintStats(void *arg)
+{
+    (void)arg;
+    printf("\necho count: %lu, dropped: %lu\n", echoedCount, droppedCount);
+    fflush(stdout);
+}
+
+void *ReporterMain(void *arg)
+{
+    (void)arg;
+
+    for (;;)
+    {
+        sleep(10);
+        PostTask(PrintStats, NULL);
+    }
+
+    return (NULL);
+}
+
+void DieWithError(const char *errorMessage)
+{
+    perror(errorMessage);
+    exit(1);
+}
@@ -0,0 +1,129 @@
+#include "ShmRing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* 受信バッファサイズ */
+#define RCVBUFSIZE 32
+
+/* エラー処理関数 */
+void DieWithError(const char *errorMessage)
+{
+    perror(errorMessage);
+    exit(1);
+}
+
+uint64_t NowNs(void)
+{
+    struct timespec ts; /* 現在時刻 */
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+    int sock;                      /* ランデブー用のソケット */
+    struct sockaddr_un servAddr;   /* ランデブーのアドレス */
+    int memFd;                     /* サーバーから受け取ったmemfd */
+    struct ShmChannel *channel;    /* サーバーと共有するメモリ */
+    char *echoString;              /* エコーサーバに送信する文字列 */
+    char echoBuffer[RCVBUFSIZE];   /* エコーサーバから受信するデータ */
+    unsigned int echoStringLen;    /* エコーサーバに送信する文字列の長さ */
+    int bytesRcvd, totalBytesRcvd; /* エコーサーバから受信したバイト数 */
+    long iterations = 1;           /* 往復させる回数 */
+    long i;
+    uint64_t startNs;              /* 計測を始めた時刻 */
+    uint64_t elapsedNs;            /* 全ての往復にかかった時間 */
+
+    /* 引数の数が正しいか確認 */
+    if ((argc < 3) || (argc > 4))
+    {
+        fprintf(stderr, "Usage: %s <Rendezvous Path> <Echo Word> [<Iterations>]\n", argv[0]);
+        exit(1);
+    }
+
+    echoString = argv[2]; /* ２つ目の引数：エコーサーバに送信する文字列 */
+    if (argc == 4)
+    {
+        iterations = atol(argv[3]);
+    }
+
+    /* ソケットの作成 */
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        DieWithError("socket() failed");
+    }
+
+    /* サーバのランデブーに接続し、共有メモリを受け取る */
+    memset(&servAddr, 0, sizeof(servAddr));
+    servAddr.sun_family = AF_UNIX;
+    strncpy(servAddr.sun_path, argv[1], sizeof(servAddr.sun_path) - 1);
+    if (connect(sock, (struct sockaddr *)&servAddr, sizeof(servAddr)) < 0)
+    {
+        DieWithError("connect() failed");
+    }
+    if ((memFd = ShmReceiveChannel(sock)) < 0)
+    {
+        DieWithError("ShmReceiveChannel() failed");
+    }
+    if ((channel = ShmMapChannel(memFd)) == NULL)
+    {
+        DieWithError("ShmMapChannel() failed");
+    }
+    close(memFd);
+
+    /* エコーサーバに送信する文字列の長さ */
+    echoStringLen = strlen(echoString);
+
+    /* 2回目以降の往復は表示せずに、かかった時間だけを測る */
+    startNs = NowNs();
+    for (i = 0; i < iterations; i++)
+    {
+        /* データを送信 */
+        if (ShmSend(&channel->toServer, echoString, echoStringLen, sock) != echoStringLen)
+        {
+            DieWithError("ShmSend() sent a different number of bytes than expected");
+        }
+
+        /* サーバからのエコーを受信 */
+        totalBytesRcvd = 0;
+        if (i == 0)
+        {
+            printf("Received: ");
+        }
+        while (totalBytesRcvd < echoStringLen)
+        {
+            if ((bytesRcvd = ShmRecv(&channel->toClient, echoBuffer, RCVBUFSIZE - 1, sock)) <= 0)
+            {
+                DieWithError("ShmRecv() failed or connection closed prematurely");
+            }
+            totalBytesRcvd += bytesRcvd; /* 受信したバイト数を加算 */
+            if (i == 0)
+            {
+                echoBuffer[bytesRcvd] = '\0'; /* 文字列の終端を追加 */
+                printf("%s", echoBuffer);     /* 受信した文字列を表示 */
+            }
+        }
+        if (i == 0)
+        {
+            printf("\n");
+        }
+    }
+    elapsedNs = NowNs() - startNs;
+
+    if (iterations > 1)
+    {
+        printf("%ld round trips, %.0f ns per round trip\n", iterations, (double)elapsedNs / iterations);
+    }
+
+    /* サーバーに送信の終わりを知らせてから閉じる */
+    ShmClose(&channel->toServer);
+    ShmUnmapChannel(channel);
+    close(sock);
+    return 0;
+}
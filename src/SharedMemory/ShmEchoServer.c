@@ -0,0 +1,277 @@
+#define _GNU_SOURCE
+#include "../Threads/TCPEchoServer.h"
+#include "../Threads/Admission.h"
+#include "../Threads/Metrics.h"
+#include "../Threads/Log.h"
+#include "ShmRing.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/un.h>
+
+#define MAXPENDING 5     /* 待機中の接続要求の最大数 */
+#define SHMBUFSIZE 65536 /* 共有メモリから1回に読み出す最大のバイト数 */
+
+/* メインスレッド関数 */
+void *ThreadMain(void *arg);
+int CreateRendezvousSocket(const char *path);
+void HandleShmClient(int clntSock);
+
+/* クライアントスレッドに渡す構造体 */
+struct ThreadsArgs
+{
+    int clntSock;
+    int local; /* 共有メモリでやり取りするクライアント */
+};
+
+int main(int argc, char *argv[])
+{
+    int servSock;                   /* TCPのリスニングソケット */
+    int localSock;                  /* 同じホストのクライアントが接続するUnixドメインソケット */
+    int clntSock;                   /* クライアントのソケットディスクリプタ */
+    const char *servAddress;        /* サーバのポート番号、またはunix:<パス>など */
+    struct pollfd fds[2];           /* 接続要求を待つソケット */
+    pthread_t threadID;             /* スレッドID */
+    struct ThreadsArgs *threadArgs; /* スレッド引数 */
+    int result;                     /* pthread_create()の戻り値 */
+    int opt;                        /* getopt()の戻り値 */
+    int i;
+
+    /* TCPのクライアントの受け入れの制限のオプション（../Threads/Admission.hを参照） */
+    while ((opt = getopt(argc, argv, ADMISSIONOPTS)) != -1)
+    {
+        if (!AdmissionOption(opt, optarg))
+        {
+            argc = 0; /* 不明なオプションは使い方を表示して終了 */
+            break;
+        }
+    }
+
+    /* 引数の数をチェック */
+    if (argc == 0 || argc - optind < 1 || argc - optind > 3)
+    {
+        fprintf(stderr, "Usage: %s " ADMISSIONUSAGE " <Rendezvous Path> [<Server Port or Address: default 7> [<Stats Port>]]\n",
+                argv[0]);
+        exit(1);
+    }
+    argc -= optind - 1; /* 以下はオプションを除いた位置引数として数える */
+    argv += optind - 1;
+    if (argc >= 3)
+    {
+        servAddress = argv[2];
+    }
+    else
+    {
+        servAddress = "7";
+    }
+
+    /* 接続ごとのログはリングに書き、ロガースレッドがまとめて標準エラー出力に書き出す */
+    LogInit(LOG_INFO);
+
+    /* 統計ポートを指定したら、127.0.0.1のそのポートでPrometheus形式の統計を返す */
+    if (argc == 4)
+    {
+        MetricsStartServer(atoi(argv[3]));
+    }
+
+    /* memfdを渡した相手が先に終了しても、Unixドメインソケットへの書き込みでプロセスを終了させない */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* 別のホストのクライアントはTCPで、同じホストのクライアントは共有メモリでエコーする */
+    servSock = CreateServerSocket(servAddress);
+    localSock = CreateRendezvousSocket(argv[1]);
+
+    fds[0].fd = servSock;
+    fds[0].events = POLLIN;
+    fds[1].fd = localSock;
+    fds[1].events = POLLIN;
+
+    for (;;)
+    {
+        /* どちらかのソケットに接続要求が来るまで待機 */
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            DieWithError("poll() failed");
+        }
+
+        for (i = 0; i < 2; i++)
+        {
+            if (!(fds[i].revents & POLLIN))
+            {
+                continue;
+            }
+
+            if (i == 0)
+            {
+                /* 制限を超えて断った接続なら次を待つ */
+                if ((clntSock = AcceptTCPConnection(servSock)) < 0)
+                {
+                    continue;
+                }
+            }
+            else if ((clntSock = accept4(localSock, NULL, NULL, SOCK_CLOEXEC)) < 0)
+            {
+                /* 1つの接続要求のエラーではサーバー全体を止めない */
+                MetricsCountError(errno);
+                LogErrno(LOG_WARN, "accept() failed");
+                continue;
+            }
+            else
+            {
+                MetricsAdd(MET_ACCEPTS, 1);
+                LogInfo("Handling local client");
+            }
+
+            /* クライアント引数用にメモリを新しく確保 */
+            if ((threadArgs = (struct ThreadsArgs *)malloc(sizeof(struct ThreadsArgs))) == NULL)
+            {
+                /* メモリが足りなければこの接続だけを断り、受け入れを続ける */
+                MetricsCountError(ENOMEM);
+                LogWrite(LOG_WARN, ENOMEM, "malloc() failed", LOGARGS());
+                AdmissionRelease(clntSock);
+                close(clntSock);
+                MetricsAdd(MET_CLOSES, 1);
+                continue;
+            }
+            threadArgs->clntSock = clntSock;
+            threadArgs->local = (i == 1);
+
+            /* クライアントスレッドを生成 */
+            if ((result = pthread_create(&threadID, NULL, ThreadMain, (void *)threadArgs)) != 0)
+            {
+                /* スレッド数の上限（EAGAIN）に達したら、この接続だけを断る */
+                MetricsCountError(result);
+                LogWrite(LOG_WARN, result, "pthread_create() failed", LOGARGS());
+                free(threadArgs);
+                AdmissionRelease(clntSock);
+                close(clntSock);
+                MetricsAdd(MET_CLOSES, 1);
+                continue;
+            }
+        }
+    }
+}
+
+/* 同じホストのクライアントが共有メモリを受け取りに来るUnixドメインソケットを作る。
+   前回のサーバーが残したパスは先に削除する */
+int CreateRendezvousSocket(const char *path)
+{
+    int sock;                /* リスニングソケット */
+    struct sockaddr_un addr; /* ランデブーのアドレス */
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        DieWithError("socket() failed");
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        DieWithError("bind() failed");
+    }
+    if (listen(sock, MAXPENDING) < 0)
+    {
+        DieWithError("listen() failed");
+    }
+
+    return sock;
+}
+
+void *ThreadMain(void *threadArgs)
+{
+    int clntSock; /* クライアントのソケットディスクリプタ */
+    int local;    /* 共有メモリでやり取りするクライアント */
+
+    /* 戻り時に、スレッドのリソースを割り当て解除 */
+    pthread_detach(pthread_self());
+
+    /* ソケットディスクリプタを引数から取り出す */
+    clntSock = ((struct ThreadsArgs *)threadArgs)->clntSock;
+    local = ((struct ThreadsArgs *)threadArgs)->local;
+    free(threadArgs);
+
+    if (local)
+    {
+        HandleShmClient(clntSock);
+    }
+    else
+    {
+        HandleTCPClient(clntSock);
+    }
+
+    return (NULL);
+}
+
+/* 共有メモリを作ってクライアントに渡し、HandleTCPClient()と同じく受信したバイト列をそのまま返す。
+   Unixドメインソケットは共有メモリを渡した後もクライアントが生きているかを確かめるために開いておく */
+void HandleShmClient(int clntSock)
+{
+    struct ShmChannel *channel;  /* クライアントと共有するメモリ */
+    int memFd;                   /* 共有メモリのmemfd */
+    char echoBuffer[SHMBUFSIZE]; /* エコー文字列のバッファ */
+    ssize_t recvMsgSize;         /* 受信メッセージのサイズ */
+    uint64_t rcvdNs;             /* 受信した時刻 */
+
+    if ((channel = ShmCreateChannel(&memFd)) == NULL)
+    {
+        MetricsCountError(errno);
+        LogErrno(LOG_WARN, "ShmCreateChannel() failed");
+        close(clntSock);
+        MetricsAdd(MET_CLOSES, 1);
+        return;
+    }
+
+    /* memfdを渡したら、サーバー側のディスクリプタは要らない（対応付けは残る） */
+    if (ShmSendChannel(clntSock, memFd) < 0)
+    {
+        MetricsCountError(errno);
+        LogErrno(LOG_DEBUG, "sendmsg() failed");
+        recvMsgSize = 0;
+    }
+    else
+    {
+        MetricsAdd(MET_RECV_CALLS, 1);
+        recvMsgSize = ShmRecv(&channel->toServer, echoBuffer, SHMBUFSIZE, clntSock);
+    }
+    close(memFd);
+
+    /* 受信したデータをクライアントにエコーバック */
+    while (recvMsgSize > 0)
+    {
+        rcvdNs = MetricsNowNs();
+        MetricsAdd(MET_BYTES_IN, recvMsgSize);
+
+        MetricsAdd(MET_SEND_CALLS, 1);
+        if (ShmSend(&channel->toClient, echoBuffer, recvMsgSize, clntSock) != recvMsgSize)
+        {
+            recvMsgSize = -1;
+            break;
+        }
+        MetricsAdd(MET_BYTES_OUT, recvMsgSize);
+        MetricsRecordLatency(MetricsNowNs() - rcvdNs);
+
+        /* クライアントからのメッセージを受信 */
+        MetricsAdd(MET_RECV_CALLS, 1);
+        recvMsgSize = ShmRecv(&channel->toServer, echoBuffer, SHMBUFSIZE, clntSock);
+    }
+
+    /* クライアントが先に終了していたら、TCPのリセットと同じく数える */
+    if (recvMsgSize < 0)
+    {
+        MetricsCountError(ECONNRESET);
+        LogDebug("Local client disappeared");
+    }
+
+    ShmClose(&channel->toClient);
+    ShmUnmapChannel(channel);
+    close(clntSock); /* クライアントのソケットをクローズ */
+    MetricsAdd(MET_CLOSES, 1);
+}
@@ -0,0 +1,318 @@
+#define _GNU_SOURCE
+#include "ShmRing.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* 回って待つ間、同じコアのもう一方のハードウェアスレッドに実行資源を譲る */
+#if defined(__x86_64__) || defined(__i386__)
+#define CpuRelax() __builtin_ia32_pause()
+#else
+#define CpuRelax() atomic_signal_fence(memory_order_seq_cst)
+#endif
+
+/* 共有メモリ上のfutexで別のプロセスと待ち合わせるので、FUTEX_PRIVATE_FLAGは付けない */
+int FutexWait(atomic_uint *addr, unsigned int expected, int timeoutMs)
+{
+    struct timespec timeout = {timeoutMs / 1000, timeoutMs % 1000 * 1000000L}; /* 待つ時間 */
+
+    return syscall(SYS_futex, addr, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+void FutexWake(atomic_uint *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/* 共有メモリを受け渡したUnixドメインソケットで、相手のプロセスが生きているか確かめる。
+   相手が終了するとソケットが閉じられ、recv()が0を返す */
+int PeerAlive(int peerSock)
+{
+    char c; /* 読み捨てない1バイト */
+    ssize_t n;
+
+    if (peerSock < 0)
+    {
+        return 1;
+    }
+    n = recv(peerSock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+}
+
+int RingReadable(struct ShmRing *ring)
+{
+    return atomic_load_explicit(&ring->tail, memory_order_acquire) != atomic_load_explicit(&ring->head, memory_order_relaxed) ||
+           atomic_load_explicit(&ring->closed, memory_order_acquire);
+}
+
+int RingWritable(struct ShmRing *ring)
+{
+    return atomic_load_explicit(&ring->tail, memory_order_relaxed) - atomic_load_explicit(&ring->head, memory_order_acquire) < SHMRINGSIZE;
+}
+
+/* 回って待つ回数。CPUが1つしかなければ、回っている間は相手が動けないので回らずにすぐ眠る */
+int SpinCount(void)
+{
+    static int spinCount = -1; /* 初回に決めた回数（どのスレッドが決めても同じ値になる） */
+
+    if (spinCount < 0)
+    {
+        spinCount = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHMSPINCOUNT : 0;
+    }
+    return spinCount;
+}
+
+/* ready()が真になるまで待つ。相手が同じ時間に別のコアで動いていれば数百ナノ秒で書き込まれるので、
+   まずSHMSPINCOUNT回だけ回って待ち、それでも来なければfutexで眠る。
+   眠る前にwaitingを立ててから条件を確かめ直し、相手は書き込んだ後にwaitingを見るので、起こし損ねない。
+   相手のプロセスがいなくなっていたら-1を返す */
+int ShmWait(struct ShmRing *ring, int (*ready)(struct ShmRing *), atomic_uint *waiting, atomic_uint *signal, int peerSock)
+{
+    unsigned int seen;           /* 眠る前に読んだsignal */
+    int spinCount = SpinCount(); /* 回って待つ回数 */
+    int i;
+
+    for (i = 0; i < spinCount; i++)
+    {
+        if (ready(ring))
+        {
+            return 0;
+        }
+        CpuRelax();
+    }
+
+    for (;;)
+    {
+        atomic_store_explicit(waiting, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        seen = atomic_load_explicit(signal, memory_order_acquire);
+        if (ready(ring))
+        {
+            atomic_store_explicit(waiting, 0, memory_order_relaxed);
+            return 0;
+        }
+        /* 確かめた後に相手が書き込んでいれば、signalが変わっているのでfutexはすぐに戻る */
+        if (FutexWait(signal, seen, SHMPEERCHECKMS) < 0 && errno == ETIMEDOUT && !PeerAlive(peerSock))
+        {
+            atomic_store_explicit(waiting, 0, memory_order_relaxed);
+            return -1;
+        }
+    }
+}
+
+/* 相手が眠ろうとしていれば起こす。相手が回って待っている間はシステムコールを呼ばない */
+void ShmWake(atomic_uint *waiting, atomic_uint *signal)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiting, memory_order_relaxed) &&
+        atomic_exchange_explicit(waiting, 0, memory_order_relaxed))
+    {
+        atomic_fetch_add_explicit(signal, 1, memory_order_release);
+        FutexWake(signal);
+    }
+}
+
+/* 共有メモリを作る。memfdは名前を持たないので、ファイルシステムに後始末の要るファイルが残らない。
+   大きさを封印し、クライアントがftruncate()で縮めてサーバーをSIGBUSで落とせないようにする */
+struct ShmChannel *ShmCreateChannel(int *memFd)
+{
+    struct ShmChannel *channel; /* 共有メモリ */
+    int fd;                     /* memfd */
+
+    if ((fd = memfd_create("echo-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+    {
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(struct ShmChannel)) < 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    if ((channel = mmap(NULL, sizeof(struct ShmChannel), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0)) == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    /* memfdは0で埋められているので、位置やフラグの初期化は要らない */
+    channel->magic = SHMMAGIC;
+    channel->ringSize = SHMRINGSIZE;
+
+    *memFd = fd;
+    return channel;
+}
+
+/* サーバーから受け取ったmemfdを対応付ける。大きさと識別子が合わなければNULLを返す */
+struct ShmChannel *ShmMapChannel(int memFd)
+{
+    struct ShmChannel *channel; /* 共有メモリ */
+    struct stat st;             /* memfdの情報 */
+
+    if (fstat(memFd, &st) < 0 || st.st_size != sizeof(struct ShmChannel))
+    {
+        return NULL;
+    }
+    if ((channel = mmap(NULL, sizeof(struct ShmChannel), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, memFd, 0)) == MAP_FAILED)
+    {
+        return NULL;
+    }
+    if (channel->magic != SHMMAGIC || channel->ringSize != SHMRINGSIZE)
+    {
+        munmap(channel, sizeof(struct ShmChannel));
+        return NULL;
+    }
+
+    return channel;
+}
+
+void ShmUnmapChannel(struct ShmChannel *channel)
+{
+    munmap(channel, sizeof(struct ShmChannel));
+}
+
+/* memfdをSCM_RIGHTSで送る */
+int ShmSendChannel(int sock, int memFd)
+{
+    char tag = 'S';                         /* 本文（SCM_RIGHTSは1バイト以上の本文と一緒に送る） */
+    struct iovec iov = {&tag, sizeof(tag)}; /* 本文 */
+    struct msghdr msg;                      /* 送信するメッセージ */
+    struct cmsghdr *cmsg;                   /* 補助データ */
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;                              /* 補助データのバッファ */
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memFd, sizeof(int));
+
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) < 0 ? -1 : 0;
+}
+
+/* サーバーからmemfdを受け取る。受け取れなければ-1を返す */
+int ShmReceiveChannel(int sock)
+{
+    int memFd = -1;                         /* 受け取ったmemfd */
+    char tag;                               /* 本文 */
+    struct iovec iov = {&tag, sizeof(tag)}; /* 本文 */
+    struct msghdr msg;                      /* 受信するメッセージ */
+    struct cmsghdr *cmsg;                   /* 補助データ */
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;                              /* 補助データのバッファ */
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) <= 0)
+    {
+        return -1;
+    }
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            memcpy(&memFd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    return memFd;
+}
+
+/* lenバイトを全てリングに書き込む（send()と同じく、空きがなければ待つ）。
+   相手のプロセスがいなくなっていたら-1を返す */
+ssize_t ShmSend(struct ShmRing *ring, const void *buf, size_t len, int peerSock)
+{
+    size_t sent = 0;   /* 書き込んだバイト数 */
+    unsigned int tail; /* 書き込む位置 */
+    size_t space;      /* 空いているバイト数 */
+    size_t chunk;      /* 今回書き込むバイト数 */
+    size_t offset;     /* リングの中での書き込む位置 */
+    size_t first;      /* リングの末尾までに書き込むバイト数 */
+
+    while (sent < len)
+    {
+        if (ShmWait(ring, RingWritable, &ring->writerWaiting, &ring->writerSignal, peerSock) < 0)
+        {
+            return -1;
+        }
+
+        tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        space = SHMRINGSIZE - (tail - atomic_load_explicit(&ring->head, memory_order_acquire));
+        chunk = len - sent < space ? len - sent : space;
+        offset = tail & (SHMRINGSIZE - 1);
+        first = chunk < SHMRINGSIZE - offset ? chunk : SHMRINGSIZE - offset;
+        memcpy(ring->data + offset, (const char *)buf + sent, first);
+        memcpy(ring->data, (const char *)buf + sent + first, chunk - first);
+
+        /* データを書き終えてから位置を進める（受信側は位置を見てからデータを読む） */
+        atomic_store_explicit(&ring->tail, tail + chunk, memory_order_release);
+        ShmWake(&ring->readerWaiting, &ring->readerSignal);
+        sent += chunk;
+    }
+
+    return sent;
+}
+
+/* リングから最大lenバイトを読み出す（recv()と同じく、1バイトもなければ待つ）。
+   送信側がShmClose()した後で読み出すものがなければ0、相手のプロセスがいなくなっていたら-1を返す */
+ssize_t ShmRecv(struct ShmRing *ring, void *buf, size_t len, int peerSock)
+{
+    unsigned int head; /* 読み出す位置 */
+    size_t avail;      /* 読み出せるバイト数 */
+    size_t offset;     /* リングの中での読み出す位置 */
+    size_t first;      /* リングの末尾までに読み出すバイト数 */
+
+    if (ShmWait(ring, RingReadable, &ring->readerWaiting, &ring->readerSignal, peerSock) < 0)
+    {
+        return -1;
+    }
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    avail = atomic_load_explicit(&ring->tail, memory_order_acquire) - head;
+    if (avail == 0)
+    {
+        return 0; /* 送信側が閉じた */
+    }
+    if (avail > len)
+    {
+        avail = len;
+    }
+    offset = head & (SHMRINGSIZE - 1);
+    first = avail < SHMRINGSIZE - offset ? avail : SHMRINGSIZE - offset;
+    memcpy(buf, ring->data + offset, first);
+    memcpy((char *)buf + first, ring->data, avail - first);
+
+    /* 読み終えてから位置を進め、送信側に場所を返す */
+    atomic_store_explicit(&ring->head, head + avail, memory_order_release);
+    ShmWake(&ring->writerWaiting, &ring->writerSignal);
+
+    return avail;
+}
+
+/* これ以上書き込まないことを受信側に知らせる（TCPのFINに当たる） */
+void ShmClose(struct ShmRing *ring)
+{
+    atomic_store_explicit(&ring->closed, 1, memory_order_release);
+    ShmWake(&ring->readerWaiting, &ring->readerSignal);
+}
@@ -0,0 +1,44 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef CACHELINE
+#define CACHELINE 64 /* キャッシュラインのサイズ */
+#endif
+#define SHMRINGSIZE 65536   /* 片方向のリングのバイト数（2のべき乗） */
+#define SHMMAGIC 0x53484d31 /* 共有メモリの先頭に置く識別子（"SHM1"） */
+#define SHMSPINCOUNT 20000  /* futexで眠る前に、相手の書き込みを待って回る回数 */
+#define SHMPEERCHECKMS 1000 /* 眠っている間に、相手のプロセスが生きているか確かめる間隔（ミリ秒） */
+
+/* 片方向のSPSCバイトリング。書き込むのは送信側だけ、読み出すのは受信側だけなので、ロックは要らない。
+   位置は32ビットで持ち、差を取ればラップアラウンドしても読み出せるバイト数になる */
+struct ShmRing
+{
+    _Alignas(CACHELINE) atomic_uint tail;          /* 次に書き込む位置（送信側が進める） */
+    atomic_uint closed;                            /* 送信側がもう書き込まない */
+    _Alignas(CACHELINE) atomic_uint head;          /* 次に読み出す位置（受信側が進める） */
+    _Alignas(CACHELINE) atomic_uint readerWaiting; /* 受信側がデータを待って眠ろうとしている */
+    atomic_uint readerSignal;                      /* 受信側が眠るfutex（送信側が起こすたびに増やす） */
+    atomic_uint writerWaiting;                     /* 送信側が空きを待って眠ろうとしている */
+    atomic_uint writerSignal;                      /* 送信側が眠るfutex（受信側が起こすたびに増やす） */
+    _Alignas(CACHELINE) char data[SHMRINGSIZE];    /* データ */
+};
+
+/* memfdに置く共有メモリ全体。サーバーが作り、Unixドメインソケットでクライアントに渡す */
+struct ShmChannel
+{
+    uint32_t magic;          /* SHMMAGIC */
+    uint32_t ringSize;       /* SHMRINGSIZE（サーバーとクライアントで一致しているか確かめる） */
+    struct ShmRing toServer; /* クライアントからサーバーへのリング */
+    struct ShmRing toClient; /* サーバーからクライアントへのリング */
+};
+
+struct ShmChannel *ShmCreateChannel(int *memFd);
+struct ShmChannel *ShmMapChannel(int memFd);
+void ShmUnmapChannel(struct ShmChannel *channel);
+int ShmSendChannel(int sock, int memFd);
+int ShmReceiveChannel(int sock);
+ssize_t ShmSend(struct ShmRing *ring, const void *buf, size_t len, int peerSock);
+ssize_t ShmRecv(struct ShmRing *ring, void *buf, size_t len, int peerSock);
+void ShmClose(struct ShmRing *ring);
@@ -0,0 +1,93 @@
+#include <string.h>
+#include "Histogram.h"
+
+void HistogramInit(struct Histogram *hist)
+{
+    memset(hist, 0, sizeof(struct Histogram));
+}
+
+/* 値からバケット番号を求める */
+int HistogramIndex(uint64_t value)
+{
+    int shift; /* 値を右シフトしてSUBBUCKETS未満に収める量 */
+
+    /* SUBBUCKETS未満の値はそのままバケット番号にする（誤差なし） */
+    if (value < SUBBUCKETS)
+    {
+        return (int)value;
+    }
+
+    /* 上位SUBBUCKETBITSビットだけを残し、シフト量ごとにSUBBUCKETS/2個のバケットを使う */
+    shift = (63 - __builtin_clzll(value)) - (SUBBUCKETBITS - 1);
+    return SUBBUCKETS + (shift - 1) * (SUBBUCKETS / 2) + (int)((value >> shift) - (SUBBUCKETS / 2));
+}
+
+/* バケット番号から、そのバケットの代表値（中央値）を求める */
+uint64_t HistogramValue(int index)
+{
+    int shift;      /* バケットのシフト量 */
+    uint64_t lower; /* バケットの下限 */
+
+    if (index < SUBBUCKETS)
+    {
+        return (uint64_t)index;
+    }
+
+    shift = (index - SUBBUCKETS) / (SUBBUCKETS / 2) + 1;
+    lower = (uint64_t)((index - SUBBUCKETS) % (SUBBUCKETS / 2) + (SUBBUCKETS / 2)) << shift;
+    return lower + ((1ULL << shift) >> 1);
+}
+
+void HistogramRecord(struct Histogram *hist, uint64_t value)
+{
+    hist->counts[HistogramIndex(value)]++;
+    hist->total++;
+    if (value > hist->max)
+    {
+        hist->max = value;
+    }
+}
+
+void HistogramMerge(struct Histogram *dst, const struct Histogram *src)
+{
+    int i;
+
+    for (i = 0; i < HISTBUCKETS; i++)
+    {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    if (src->max > dst->max)
+    {
+        dst->max = src->max;
+    }
+}
+
+/* percentile（0〜100）に当たる値を返す */
+uint64_t HistogramPercentile(const struct Histogram *hist, double percentile)
+{
+    uint64_t target;   /* 何番目の値か */
+    uint64_t seen = 0; /* ここまでに数えた値の数 */
+    int i;
+
+    if (hist->total == 0)
+    {
+        return 0;
+    }
+
+    target = (uint64_t)(hist->total * percentile / 100.0 + 0.5);
+    if (target < 1)
+    {
+        target = 1;
+    }
+    for (i = 0; i < HISTBUCKETS; i++)
+    {
+        seen += hist->counts[i];
+        if (seen >= target)
+        {
+            /* 代表値が最大値を超えないようにする */
+            return HistogramValue(i) < hist->max ? HistogramValue(i) : hist->max;
+        }
+    }
+    return hist->max;
+}
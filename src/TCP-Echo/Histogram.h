@@ -0,0 +1,19 @@
+#include <stdint.h>
+
+/* HDRヒストグラム風の対数・線形バケット。
+   2のべき乗ごとにSUBBUCKETS/2個のバケットに分けるので、相対誤差は1/64以下 */
+#define SUBBUCKETBITS 7
+#define SUBBUCKETS (1 << SUBBUCKETBITS)
+#define HISTBUCKETS (SUBBUCKETS + (64 - SUBBUCKETBITS) * (SUBBUCKETS / 2))
+
+struct Histogram
+{
+    uint64_t counts[HISTBUCKETS]; /* バケットごとの記録数 */
+    uint64_t total;               /* 記録した値の数 */
+    uint64_t max;                 /* 記録した値の最大 */
+};
+
+void HistogramInit(struct Histogram *hist);
+void HistogramRecord(struct Histogram *hist, uint64_t value);
+void HistogramMerge(struct Histogram *dst, const struct Histogram *src);
+uint64_t HistogramPercentile(const struct Histogram *hist, double percentile);
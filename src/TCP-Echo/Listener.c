@@ -0,0 +1,204 @@
+#include "Listener.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int CreateInetListener(const char *port, int family, int flags);
+int CreateUnixListener(const char *path, int flags);
+
+/* addressの書き方に合わせてリスニングソケットを作る（書き方はListener.hを参照）。
+   どの種類でもaccept()が返すのはストリームのソケットなので、
+   接続を処理する関数はそのまま使える */
+int CreateListener(const char *address, int backlog, int flags)
+{
+    int sock; /* リスニングソケット */
+
+    if (strncmp(address, "unix:", 5) == 0)
+    {
+        sock = CreateUnixListener(address + 5, flags);
+    }
+    else if (strncmp(address, "tcp4:", 5) == 0)
+    {
+        sock = CreateInetListener(address + 5, AF_INET, flags);
+    }
+    else if ((sock = CreateInetListener(address, AF_INET6, flags)) < 0)
+    {
+        /* IPv6が無効なカーネルでは、IPv4だけで待ち受ける */
+        sock = CreateInetListener(address, AF_INET, flags);
+    }
+
+    /* クライアントからの接続要求を待機 */
+    if (listen(sock, backlog) < 0)
+    {
+        DieWithError("listen() failed");
+    }
+
+    return sock;
+}
+
+/* 全アドレスのポートにバインドしたTCPソケットを作る。AF_INET6ではIPV6_V6ONLYを外し、
+   IPv4の接続も ::ffff:a.b.c.d のIPv4射影アドレスとして同じソケットで受け入れる。
+   カーネルがAF_INET6に対応していなければ-1を返す */
+int CreateInetListener(const char *port, int family, int flags)
+{
+    int sock;                  /* サーバのソケット */
+    int on = 1;                /* 有効にするオプションの値 */
+    int off = 0;               /* 無効にするオプションの値 */
+    struct sockaddr_in addr4;  /* IPv4のアドレス */
+    struct sockaddr_in6 addr6; /* IPv6のアドレス */
+    struct sockaddr *addr;     /* バインドするアドレス */
+    socklen_t addrLen;         /* アドレスの長さ */
+
+    /* 知らない書き方（seqpacket:など）をatoi()で0番ポートとして受け入れないようにする */
+    if (port[0] == '\0' || strspn(port, "0123456789") != strlen(port))
+    {
+        fprintf(stderr, "Invalid port: %s\n", port);
+        exit(1);
+    }
+
+    /* サーバのソケットを作成 */
+    if ((sock = socket(family, SOCK_STREAM, IPPROTO_TCP)) < 0)
+    {
+        if (family == AF_INET6 && errno == EAFNOSUPPORT)
+        {
+            return -1;
+        }
+        DieWithError("socket() failed");
+    }
+
+    if ((flags & LISTEN_REUSEADDR) && setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0)
+    {
+        DieWithError("setsockopt() failed");
+    }
+
+    /* SO_REUSEPORT: 同じポートに複数のソケットをバインドし、
+       カーネルが接続要求をソケットごとの受け入れキューに振り分ける */
+    if ((flags & LISTEN_REUSEPORT) && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    {
+        DieWithError("setsockopt(SO_REUSEPORT) failed");
+    }
+
+    /* サーバのアドレス構造体を作成 */
+    if (family == AF_INET6)
+    {
+        /* net.ipv6.bindv6onlyの設定によらず、IPv4の接続も受け入れる */
+        if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) < 0)
+        {
+            DieWithError("setsockopt(IPV6_V6ONLY) failed");
+        }
+        memset(&addr6, 0, sizeof(addr6));
+        addr6.sin6_family = AF_INET6;
+        addr6.sin6_addr = in6addr_any;
+        addr6.sin6_port = htons(atoi(port));
+        addr = (struct sockaddr *)&addr6;
+        addrLen = sizeof(addr6);
+    }
+    else
+    {
+        memset(&addr4, 0, sizeof(addr4));
+        addr4.sin_family = AF_INET;
+        addr4.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr4.sin_port = htons(atoi(port));
+        addr = (struct sockaddr *)&addr4;
+        addrLen = sizeof(addr4);
+    }
+
+    /* サーバのアドレス構造体にソケットをバインド */
+    if (bind(sock, addr, addrLen) < 0)
+    {
+        DieWithError("bind() failed");
+    }
+
+    return sock;
+}
+
+/* Unixドメインのソケットを作る。同じホストのクライアントとはTCP/IPのプロトコル処理
+   （チェックサム、輻輳制御、ループバックデバイス）を通らずに、ソケットバッファの間で直接やり取りする。
+   パスの先頭が@なら抽象名前空間に作る */
+int CreateUnixListener(const char *path, int flags)
+{
+    int sock;                /* サーバのソケット */
+    struct sockaddr_un addr; /* Unixドメインのアドレス */
+    socklen_t addrLen;       /* アドレスの長さ */
+    size_t pathLen;          /* パスの長さ */
+
+    pathLen = strlen(path);
+    if (pathLen == 0 || pathLen >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Invalid Unix domain socket path: %s\n", path);
+        exit(1);
+    }
+    if (flags & LISTEN_REUSEPORT)
+    {
+        fprintf(stderr, "SO_REUSEPORT needs a TCP address\n");
+        exit(1);
+    }
+
+    /* サーバのソケットを作成 */
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        DieWithError("socket() failed");
+    }
+
+    /* サーバのアドレス構造体を作成。抽象名前空間のアドレスは先頭の\0に続く名前で、
+       終端の\0を含まない長さで区別されるので、長さは名前の分だけにする */
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, pathLen);
+    addrLen = offsetof(struct sockaddr_un, sun_path) + pathLen;
+    if (path[0] == '@')
+    {
+        addr.sun_path[0] = '\0';
+    }
+    else
+    {
+        /* 前回のサーバーが残したファイルがあるとbind()できないので、先に削除する */
+        unlink(path);
+        addrLen++;
+    }
+
+    /* サーバのアドレス構造体にソケットをバインド */
+    if (bind(sock, (struct sockaddr *)&addr, addrLen) < 0)
+    {
+        DieWithError("bind() failed");
+    }
+
+    return sock;
+}
+
+/* accept()で受け取ったクライアントのアドレスを表示用の文字列にする。
+   IPv4射影アドレスはIPv4の書き方に戻す。Unixドメインのクライアントは名前を持たないので "local" にする */
+void FormatPeerAddress(const struct sockaddr *addr, char *buf, size_t size)
+{
+    const struct sockaddr_in *addr4 = (const struct sockaddr_in *)addr;    /* IPv4のアドレス */
+    const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6 *)addr; /* IPv6のアドレス */
+    char host[INET6_ADDRSTRLEN];                                         /* アドレスの文字列 */
+
+    switch (addr->sa_family)
+    {
+    case AF_INET:
+        inet_ntop(AF_INET, &addr4->sin_addr, host, sizeof(host));
+        snprintf(buf, size, "%s:%d", host, ntohs(addr4->sin_port));
+        break;
+    case AF_INET6:
+        if (IN6_IS_ADDR_V4MAPPED(&addr6->sin6_addr))
+        {
+            inet_ntop(AF_INET, &addr6->sin6_addr.s6_addr[12], host, sizeof(host));
+            snprintf(buf, size, "%s:%d", host, ntohs(addr6->sin6_port));
+        }
+        else
+        {
+            inet_ntop(AF_INET6, &addr6->sin6_addr, host, sizeof(host));
+            snprintf(buf, size, "[%s]:%d", host, ntohs(addr6->sin6_port));
+        }
+        break;
+    default:
+        snprintf(buf, size, "local");
+        break;
+    }
+}
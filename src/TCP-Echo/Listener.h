@@ -0,0 +1,15 @@
+#include <stddef.h>
+#include <sys/socket.h>
+
+/* CreateListener()のflags */
+#define LISTEN_REUSEADDR 1 /* 再起動時にTIME_WAIT中のポートでもバインドできるようにする */
+#define LISTEN_REUSEPORT 2 /* 同じポートに複数のソケットをバインドする（TCPのときだけ） */
+
+/* エコーサーバーが待ち受けるアドレスの書き方
+     7                         IPv6デュアルスタックの全アドレスの7番ポート（IPv4の接続も受け入れる）
+     tcp4:7                    IPv4の全アドレスの7番ポート
+     unix:/tmp/echo.sock       Unixドメインのストリームソケット
+     unix:@echo                先頭が@なら抽象名前空間（ファイルを作らず、プロセスが終了すれば消える） */
+int CreateListener(const char *address, int backlog, int flags);
+void FormatPeerAddress(const struct sockaddr *addr, char *buf, size_t size);
+void DieWithError(char *errorMessage);
@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include "Histogram.h"
+
+#define MAXEVENTS 256         /* epoll_wait()で一度に取り出すイベントの最大数 */
+#define RETRYNS 1000000000ULL /* UDPで応答がないとき再送するまでの時間（ナノ秒） */
+#define SCANNS 100000000ULL   /* 再送が必要なリクエストを探す間隔（ナノ秒） */
+
+/* 接続ごとの状態 */
+struct LoadConnection
+{
+    int sock;            /* ソケットディスクリプタ */
+    int busy;            /* 応答待ちのリクエストがある */
+    int sentBytes;       /* 送信済みのバイト数 */
+    int rcvdBytes;       /* 受信済みのバイト数 */
+    uint64_t pending;    /* 予定時刻を過ぎて完了していないリクエスト数（オープンループ） */
+    uint64_t intendedNs; /* 処理中のリクエストの本来の送信時刻 */
+    uint64_t sentNs;     /* 処理中のリクエストを最後に送った時刻（UDPの再送用） */
+};
+
+/* スレッドごとの状態と結果 */
+struct LoadThread
+{
+    pthread_t threadID;           /* スレッドID */
+    int numConns;                 /* このスレッドが持つ接続数 */
+    struct LoadConnection *conns; /* 接続 */
+    double ratePerThread;         /* このスレッドのリクエストレート（0ならクローズドループ） */
+    uint64_t requests;            /* 完了したリクエスト数 */
+    uint64_t errors;              /* エラーで閉じた接続数とUDPの再送回数 */
+    struct Histogram hist;        /* 応答時間のヒストグラム（ナノ秒） */
+};
+
+/* エラー処理関数 */
+void DieWithError(const char *errorMessage)
+{
+    perror(errorMessage);
+    exit(1);
+}
+
+void *LoadThreadMain(void *arg);
+uint64_t NowNs(void);
+int ConnectToServer(void);
+void SendRequest(struct LoadThread *thread, struct LoadConnection *conn, uint64_t intendedNs);
+int ContinueSend(struct LoadConnection *conn);
+
+/* 全スレッド共通の設定 */
+struct sockaddr_in echoServAddr; /* エコーサーバのアドレス */
+int payloadSize = 64;            /* リクエスト1つのバイト数 */
+char *payload;                   /* 送信するデータ */
+uint64_t startNs;                /* 計測の開始時刻 */
+uint64_t endNs;                  /* 計測の終了時刻 */
+int useUDP = 0;                  /* UDPのエコーサーバを計測する */
+
+int main(int argc, char *argv[])
+{
+    char *servIP;                /* サーバのIPアドレス */
+    unsigned short echoServPort; /* エコーサーバのポート */
+    int numConns = 16;           /* 同時接続数 */
+    int numThreads = 1;          /* スレッド数 */
+    int duration = 10;           /* 計測時間（秒） */
+    double rate = 0;             /* 全体のリクエストレート（0ならクローズドループ） */
+    int jsonOutput = 0;          /* 結果をJSONで出力する */
+    struct LoadThread *threads;  /* スレッドごとの状態 */
+    struct Histogram hist;       /* 全体の応答時間のヒストグラム */
+    uint64_t requests = 0;       /* 全体の完了リクエスト数 */
+    uint64_t errors = 0;         /* 全体のエラー数 */
+    double elapsed;              /* 計測時間（秒） */
+    int opt;                     /* getopt()の戻り値 */
+    int i, j;                    /* ループカウンタ */
+
+    while ((opt = getopt(argc, argv, "c:t:d:s:r:ju")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            numConns = atoi(optarg);
+            break;
+        case 't':
+            numThreads = atoi(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 's':
+            payloadSize = atoi(optarg);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'j':
+            jsonOutput = 1;
+            break;
+        case 'u':
+            useUDP = 1;
+            break;
+        default:
+            numConns = 0; /* 不明なオプションは使い方を表示して終了 */
+            break;
+        }
+    }
+
+    /* 引数の数が正しいか確認 */
+    if (optind >= argc || argc - optind > 2 || numConns < 1 || numThreads < 1 || payloadSize < 1 ||
+        (useUDP && payloadSize > 65507))
+    {
+        fprintf(stderr, "Usage: %s [-c <Connections>] [-t <Threads>] [-d <Seconds>] [-s <Payload Bytes>] "
+                        "[-r <Requests/sec: 0 = closed loop>] [-j] [-u] <Server IP> [<Echo Port>]\n", argv[0]);
+        exit(1);
+    }
+    if (numThreads > numConns)
+    {
+        numThreads = numConns;
+    }
+
+    servIP = argv[optind];
+    echoServPort = (argc - optind == 2) ? atoi(argv[optind + 1]) : 7;
+
+    /* エコーサーバのアドレス構造体を作成 */
+    memset(&echoServAddr, 0, sizeof(echoServAddr));
+    echoServAddr.sin_family = AF_INET;
+    echoServAddr.sin_addr.s_addr = inet_addr(servIP);
+    echoServAddr.sin_port = htons(echoServPort);
+
+    if ((payload = (char *)malloc(payloadSize)) == NULL ||
+        (threads = (struct LoadThread *)calloc(numThreads, sizeof(struct LoadThread))) == NULL)
+    {
+        DieWithError("malloc() failed");
+    }
+    memset(payload, 'x', payloadSize);
+
+    /* 接続をスレッドに均等に割り当てる */
+    for (i = 0; i < numThreads; i++)
+    {
+        threads[i].numConns = numConns / numThreads + (i < numConns % numThreads ? 1 : 0);
+        threads[i].ratePerThread = rate * threads[i].numConns / numConns;
+        if ((threads[i].conns = (struct LoadConnection *)calloc(threads[i].numConns, sizeof(struct LoadConnection))) == NULL)
+        {
+            DieWithError("malloc() failed");
+        }
+        for (j = 0; j < threads[i].numConns; j++)
+        {
+            threads[i].conns[j].sock = ConnectToServer();
+        }
+        HistogramInit(&threads[i].hist);
+    }
+
+    /* 全ての接続が確立してから計測を始める */
+    startNs = NowNs();
+    endNs = startNs + (uint64_t)duration * 1000000000ULL;
+    for (i = 0; i < numThreads; i++)
+    {
+        if (pthread_create(&threads[i].threadID, NULL, LoadThreadMain, &threads[i]) != 0)
+        {
+            DieWithError("pthread_create() failed");
+        }
+    }
+
+    /* 各スレッドのヒストグラムを合算する */
+    HistogramInit(&hist);
+    for (i = 0; i < numThreads; i++)
+    {
+        pthread_join(threads[i].threadID, NULL);
+        HistogramMerge(&hist, &threads[i].hist);
+        requests += threads[i].requests;
+        errors += threads[i].errors;
+    }
+    elapsed = (NowNs() - startNs) / 1e9;
+
+    if (jsonOutput)
+    {
+        printf("{\"proto\":\"%s\",\"connections\":%d,\"threads\":%d,\"payload\":%d,\"rate\":%.0f,\"seconds\":%.3f,"
+               "\"requests\":%llu,\"errors\":%llu,\"req_per_sec\":%.1f,\"mb_per_sec\":%.3f,"
+               "\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f}\n",
+               useUDP ? "udp" : "tcp", numConns, numThreads, payloadSize, rate, elapsed,
+               (unsigned long long)requests, (unsigned long long)errors, requests / elapsed,
+               requests * (double)payloadSize * 2 / elapsed / 1e6,
+               HistogramPercentile(&hist, 50) / 1e3, HistogramPercentile(&hist, 99) / 1e3,
+               HistogramPercentile(&hist, 99.9) / 1e3, hist.max / 1e3);
+    }
+    else
+    {
+        printf("%s %s loop: %d connections, %d threads, %d bytes payload, %.1f seconds\n",
+               useUDP ? "UDP" : "TCP", rate > 0 ? "open" : "closed", numConns, numThreads, payloadSize, elapsed);
+        printf("requests: %llu  errors: %llu\n", (unsigned long long)requests, (unsigned long long)errors);
+        printf("throughput: %.1f req/s  %.3f MB/s\n", requests / elapsed,
+               requests * (double)payloadSize * 2 / elapsed / 1e6);
+        printf("latency (us): p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+               HistogramPercentile(&hist, 50) / 1e3, HistogramPercentile(&hist, 99) / 1e3,
+               HistogramPercentile(&hist, 99.9) / 1e3, hist.max / 1e3);
+    }
+
+    return 0;
+}
+
+uint64_t NowNs(void)
+{
+    struct timespec ts; /* 現在時刻 */
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int ConnectToServer(void)
+{
+    int sock;   /* ソケットディスクリプタ */
+    int on = 1; /* ソケットオプションの値 */
+
+    /* ソケットの作成 */
+    if (useUDP)
+    {
+        sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    }
+    else
+    {
+        sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    }
+    if (sock < 0)
+    {
+        DieWithError("socket() failed");
+    }
+
+    /* サーバに接続（UDPでは送信先を固定し、サーバ以外からのデータグラムを受け取らない） */
+    if (connect(sock, (struct sockaddr *)&echoServAddr, sizeof(echoServAddr)) < 0)
+    {
+        DieWithError("connect() failed");
+    }
+
+    /* 小さいリクエストをすぐに送るためNagleアルゴリズムを無効にする */
+    if (!useUDP)
+    {
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    /* 1スレッドで複数の接続を扱うので非ブロッキングにする */
+    if (fcntl(sock, F_SETFL, O_NONBLOCK | fcntl(sock, F_GETFL)) < 0)
+    {
+        DieWithError("Unable to put sock into nonblocking mode");
+    }
+
+    return sock;
+}
+
+void *LoadThreadMain(void *arg)
+{
+    struct LoadThread *thread = (struct LoadThread *)arg; /* このスレッドの状態 */
+    struct LoadConnection *conn;                          /* 接続 */
+    struct epoll_event ev;                                /* 登録するイベント */
+    struct epoll_event events[MAXEVENTS];                 /* 発生したイベント */
+    static __thread char rcvBuffer[65536];                /* 受信バッファ（内容は捨てる） */
+    int epfd;                                             /* epollのファイルディスクリプタ */
+    int nfds;                                             /* 発生したイベントの数 */
+    int timeoutMs;                                        /* epoll_wait()のタイムアウト */
+    int bytesRcvd;                                        /* 受信したバイト数 */
+    uint64_t intervalNs = 0;                              /* スレッド全体の送信間隔（オープンループ） */
+    uint64_t nextDueNs = 0;                               /* 次にリクエストを発生させる時刻 */
+    uint64_t dueSeq = 0;                                  /* 発生させたリクエストの通し番号 */
+    uint64_t nextScanNs = 0;                              /* 次に再送が必要なリクエストを探す時刻 */
+    uint64_t now;                                         /* 現在時刻 */
+    int i;                                                /* ループカウンタ */
+
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        DieWithError("epoll_create1() failed");
+    }
+    for (i = 0; i < thread->numConns; i++)
+    {
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.ptr = &thread->conns[i];
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, thread->conns[i].sock, &ev) < 0)
+        {
+            DieWithError("epoll_ctl() failed");
+        }
+    }
+
+    if (thread->ratePerThread > 0)
+    {
+        /* オープンループ: 接続を順番に回り、スレッド全体で一定間隔でリクエストを発生させる */
+        intervalNs = (uint64_t)(1e9 / thread->ratePerThread);
+        nextDueNs = startNs;
+    }
+    else
+    {
+        /* クローズドループ: 全ての接続が応答を受け取ったらすぐ次を送る */
+        for (i = 0; i < thread->numConns; i++)
+        {
+            SendRequest(thread, &thread->conns[i], NowNs());
+        }
+    }
+
+    while ((now = NowNs()) < endNs)
+    {
+        /* 予定時刻を過ぎたリクエストを発生させる。
+           応答待ちの接続では送信を待たせるが、応答時間は本来の予定時刻から数える
+           （coordinated omissionの補正） */
+        timeoutMs = 100;
+        if (intervalNs > 0)
+        {
+            while (nextDueNs <= now)
+            {
+                conn = &thread->conns[dueSeq % thread->numConns];
+                if (conn->sock < 0)
+                {
+                    thread->errors++; /* 閉じた接続の分は送れなかったリクエストとして数える */
+                }
+                else if (conn->pending++ == 0)
+                {
+                    SendRequest(thread, conn, nextDueNs);
+                }
+                dueSeq++;
+                nextDueNs += intervalNs;
+            }
+            timeoutMs = (int)((nextDueNs - now) / 1000000);
+        }
+
+        /* UDPではデータグラムが失われると応答が来ないので、一定時間応答のない
+           リクエストを再送する。応答時間は本来の送信時刻から数え続ける */
+        if (useUDP && now >= nextScanNs)
+        {
+            for (i = 0; i < thread->numConns; i++)
+            {
+                conn = &thread->conns[i];
+                if (conn->sock >= 0 && conn->busy && now >= conn->sentNs + RETRYNS)
+                {
+                    thread->errors++;
+                    SendRequest(thread, conn, conn->intendedNs);
+                }
+            }
+            nextScanNs = now + SCANNS;
+        }
+
+        if ((nfds = epoll_wait(epfd, events, MAXEVENTS, timeoutMs)) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            DieWithError("epoll_wait() failed");
+        }
+
+        for (i = 0; i < nfds; i++)
+        {
+            conn = (struct LoadConnection *)events[i].data.ptr;
+            if (conn->sock < 0)
+            {
+                continue;
+            }
+
+            /* 送信しきれなかった分を送る */
+            if (conn->busy && conn->sentBytes < payloadSize && !ContinueSend(conn))
+            {
+                thread->errors++;
+                continue;
+            }
+
+            /* 受信できるだけ受信し、ペイロード分そろったら1リクエスト完了 */
+            bytesRcvd = -1;
+            while (conn->busy && (bytesRcvd = recv(conn->sock, rcvBuffer, sizeof(rcvBuffer), 0)) != 0)
+            {
+                if (bytesRcvd < 0)
+                {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    {
+                        close(conn->sock);
+                        conn->sock = -1;
+                        thread->errors++;
+                    }
+                    break;
+                }
+
+                conn->rcvdBytes += bytesRcvd;
+                if (conn->rcvdBytes < payloadSize)
+                {
+                    continue;
+                }
+
+                now = NowNs();
+                HistogramRecord(&thread->hist, now - conn->intendedNs);
+                thread->requests++;
+                conn->busy = 0;
+
+                if (intervalNs == 0)
+                {
+                    SendRequest(thread, conn, now);
+                }
+                else if (--conn->pending > 0)
+                {
+                    /* 待たせていた次のリクエストを送る（本来の予定時刻は送信間隔×接続数だけ後） */
+                    SendRequest(thread, conn, conn->intendedNs + intervalNs * thread->numConns);
+                }
+            }
+            if (bytesRcvd == 0 && conn->sock >= 0)
+            {
+                close(conn->sock);
+                conn->sock = -1;
+                thread->errors++;
+            }
+        }
+    }
+
+    close(epfd);
+    return (NULL);
+}
+
+void SendRequest(struct LoadThread *thread, struct LoadConnection *conn, uint64_t intendedNs)
+{
+    conn->busy = 1;
+    conn->sentBytes = 0;
+    conn->rcvdBytes = 0;
+    conn->intendedNs = intendedNs;
+    conn->sentNs = NowNs();
+
+    if (!ContinueSend(conn))
+    {
+        thread->errors++;
+    }
+}
+
+/* 送信できるだけ送信する。エラーで接続を閉じたら0を返す */
+int ContinueSend(struct LoadConnection *conn)
+{
+    int bytesSent; /* 送信したバイト数 */
+
+    while (conn->sentBytes < payloadSize)
+    {
+        if ((bytesSent = send(conn->sock, payload + conn->sentBytes, payloadSize - conn->sentBytes, MSG_NOSIGNAL)) < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return 1; /* EPOLLOUTで続きを送る */
+            }
+            close(conn->sock);
+            conn->sock = -1;
+            return 0;
+        }
+        conn->sentBytes += bytesSent;
+    }
+    return 1;
+}
@@ -0,0 +1,407 @@
+#include "TCPEchoServer.h"
+#include "Admission.h"
+#include "Metrics.h"
+#include "Log.h"
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define NSPERSEC 1000000000ULL /* 1秒のナノ秒数 */
+#define ADMITMAXSLOTS 1048576  /* 接続ごとの状態を持つディスクリプタの数の上限 */
+
+/* 接続ごとの状態。ディスクリプタの番号で引く。受け入れスレッドが書いてからワーカーに渡し、
+   ワーカーが手放してから閉じるので、同時に2つのスレッドが触ることはない */
+struct AdmissionSlot
+{
+    struct AdmissionSource *source; /* 送信元アドレスのバケット（数えていなければNULL） */
+    uint8_t admitted;               /* 受け入れて数えている */
+    uint8_t started;                /* ワーカーが処理を始めた */
+};
+
+int AdmissionSourceKey(const struct sockaddr *addr, uint8_t key[16]);
+struct AdmissionSource *AdmissionLookup(const uint8_t key[16]);
+int AdmissionOverloaded(uint64_t now);
+
+/* 制限の設定。デフォルトでは全体の同時接続数だけを制限する */
+struct AdmissionConfig admissionConfig = {1024, 0, 0, 0, 0, 0};
+/* 送信元アドレスの表（オープンアドレス法）。要素は削除せずに置き換えるだけなので、
+   探す範囲に未使用の要素があれば、そのアドレスは表にない */
+struct AdmissionSource admissionSources[ADMITTABLESIZE];
+uint64_t admissionSeed;               /* 表のハッシュの種 */
+struct AdmissionSlot *admissionSlots; /* 接続ごとの状態 */
+size_t numAdmissionSlots;             /* admissionSlotsの要素数 */
+atomic_int activeConns;               /* 受け入れて閉じていない接続の数 */
+atomic_int pendingConns;              /* 受け入れてワーカーがまだ処理を始めていない接続の数 */
+int sharedWorkers;                    /* ワーカーを複数の接続で順に使い回す（バイト数の上限で眠らない） */
+/* 応答時間による受け入れの停止（受け入れスレッドだけが読み書きする） */
+int overloaded;                       /* 受け入れを止めている */
+uint64_t windowEndNs;                 /* 次に応答時間を見直す時刻 */
+uint64_t lastLatency[LATENCYBUCKETS]; /* 前回見直したときのヒストグラム */
+
+/* getopt()が返したオプションを設定に取り込む。知らないオプションや負の値なら0を返す */
+int AdmissionOption(int opt, const char *arg)
+{
+    double value; /* オプションの値 */
+
+    if (strchr(ADMISSIONOPTS, opt) == NULL || opt == ':' || (value = atof(arg)) < 0)
+    {
+        return 0;
+    }
+
+    switch (opt)
+    {
+    case 'c':
+        admissionConfig.maxConns = (int)value;
+        break;
+    case 's':
+        admissionConfig.sourceConns = (int)value;
+        break;
+    case 'r':
+        admissionConfig.connRate = value;
+        break;
+    case 'b':
+        admissionConfig.byteRate = value;
+        break;
+    case 'q':
+        admissionConfig.maxPending = (int)value;
+        break;
+    case 'l':
+        admissionConfig.maxLatencyMs = value;
+        break;
+    default:
+        return 0;
+    }
+    return 1;
+}
+
+/* 接続ごとの状態をディスクリプタの上限の数だけ確保する（触れるまでページは割り当てられない） */
+void AdmissionInit(void)
+{
+    struct rlimit limit; /* ディスクリプタ数の上限 */
+
+    numAdmissionSlots = ADMITMAXSLOTS;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < ADMITMAXSLOTS)
+    {
+        numAdmissionSlots = limit.rlim_cur;
+    }
+    if ((admissionSlots = (struct AdmissionSlot *)calloc(numAdmissionSlots, sizeof(struct AdmissionSlot))) == NULL)
+    {
+        DieWithError("calloc() failed");
+    }
+
+    /* 種を起動ごとに変え、外からハッシュの衝突するアドレスを狙って選べないようにする */
+    admissionSeed = MetricsNowNs() * 0x9E3779B97F4A7C15ULL;
+    windowEndNs = MetricsNowNs() + ADMITWINDOWMS * 1000000ULL;
+    MetricsLatencySnapshot(lastLatency);
+}
+
+/* accept()した接続を受け入れるかを決め、受け入れるなら数える。断るなら0を返すので、
+   呼び出し元はすぐに閉じる（listen()のキューに残すと、クライアントは応答のないまま待たされる）。
+   安い判定から順に、全体の同時接続数、過負荷、送信元アドレスごとの同時接続数と頻度を見る */
+int AdmissionAdmit(int clntSock, const struct sockaddr *addr)
+{
+    struct AdmissionSlot *slot;            /* この接続の状態 */
+    struct AdmissionSource *source = NULL; /* 送信元アドレスのバケット */
+    uint8_t key[16];                       /* 送信元アドレス */
+    uint64_t now;                          /* 現在時刻 */
+    uint64_t interval;                     /* 1つの接続が使うトークン（ナノ秒） */
+    uint64_t tat;                          /* この接続を受け入れた後のTAT */
+
+    /* AdmissionInit()の前や、数えられない大きなディスクリプタは制限しない */
+    if (admissionSlots == NULL || (size_t)clntSock >= numAdmissionSlots)
+    {
+        return 1;
+    }
+    now = MetricsNowNs();
+
+    if (admissionConfig.maxConns > 0 &&
+        atomic_load_explicit(&activeConns, memory_order_relaxed) >= admissionConfig.maxConns)
+    {
+        MetricsAdd(MET_REJECT_CAPACITY, 1);
+        return 0;
+    }
+
+    /* ワーカーが追いついていない間に受け入れても待たせるだけなので、新しい接続を断り、
+       処理中の接続の応答時間を守る */
+    if ((admissionConfig.maxPending > 0 &&
+         atomic_load_explicit(&pendingConns, memory_order_relaxed) >= admissionConfig.maxPending) ||
+        AdmissionOverloaded(now))
+    {
+        MetricsAdd(MET_REJECT_OVERLOAD, 1);
+        return 0;
+    }
+
+    if ((admissionConfig.sourceConns > 0 || admissionConfig.connRate > 0 || admissionConfig.byteRate > 0) &&
+        AdmissionSourceKey(addr, key))
+    {
+        source = AdmissionLookup(key);
+    }
+
+    if (source != NULL)
+    {
+        if (admissionConfig.sourceConns > 0 &&
+            atomic_load_explicit(&source->conns, memory_order_relaxed) >= admissionConfig.sourceConns)
+        {
+            MetricsAdd(MET_REJECT_SOURCE, 1);
+            return 0;
+        }
+
+        /* バケットに1秒分（または1つ分）のトークンが貯まるまでは、続けて受け入れる */
+        if (admissionConfig.connRate > 0)
+        {
+            interval = (uint64_t)(NSPERSEC / admissionConfig.connRate);
+            tat = (source->connTat > now ? source->connTat : now) + interval;
+            if (tat - now > NSPERSEC && tat - now > interval)
+            {
+                MetricsAdd(MET_REJECT_RATE, 1);
+                return 0;
+            }
+            source->connTat = tat;
+        }
+
+        atomic_fetch_add_explicit(&source->conns, 1, memory_order_relaxed);
+    }
+
+    atomic_fetch_add_explicit(&activeConns, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pendingConns, 1, memory_order_relaxed);
+    slot = &admissionSlots[clntSock];
+    slot->source = source;
+    slot->admitted = 1;
+    slot->started = 0;
+    return 1;
+}
+
+/* ワーカーを複数の接続で順に使い回すサーバー（スレッドプール）が起動時に呼ぶ。
+   ワーカーが眠ると、1つの送信元アドレスが全てのワーカーを止めて他のクライアントを待たせられるので、
+   以後のAdmissionPace()は眠らずに、バイト数の上限を超えた接続を閉じさせる */
+void AdmissionShareWorkers(void)
+{
+    sharedWorkers = 1;
+}
+
+/* ワーカーが接続の処理を始めた。処理待ちの接続数から外す */
+void AdmissionStart(int clntSock)
+{
+    struct AdmissionSlot *slot; /* この接続の状態 */
+
+    if (admissionSlots == NULL || (size_t)clntSock >= numAdmissionSlots)
+    {
+        return;
+    }
+    slot = &admissionSlots[clntSock];
+    if (slot->admitted && !slot->started)
+    {
+        slot->started = 1;
+        atomic_fetch_sub_explicit(&pendingConns, 1, memory_order_relaxed);
+    }
+}
+
+/* 受信したbytesバイトを送信元アドレスのバケットから引く。1秒分を超えて使い込んでいれば、
+   超えた分だけ眠る。眠っている間は受信しないので、TCPの受信ウィンドウが閉じてクライアントの送信が止まる。
+   AdmissionShareWorkers()の後は眠らずに、バケットから引かないまま0を返すので、呼び出し元は接続を閉じる。
+   同じアドレスの接続は別々のワーカーが処理するので、TATはCASで進める */
+int AdmissionPace(int clntSock, size_t bytes)
+{
+    struct AdmissionSource *source; /* 送信元アドレスのバケット */
+    uint64_t now;                   /* 現在時刻 */
+    uint64_t cost;                  /* bytesバイトが使うトークン（ナノ秒） */
+    uint64_t tat;                   /* 現在のTAT */
+    uint64_t next;                  /* bytesバイトを引いた後のTAT */
+    uint64_t waitNs;                /* 眠る時間 */
+    struct timespec delay;          /* 眠る時間 */
+
+    if (admissionConfig.byteRate <= 0 || admissionSlots == NULL || (size_t)clntSock >= numAdmissionSlots ||
+        (source = admissionSlots[clntSock].source) == NULL)
+    {
+        return 1;
+    }
+
+    now = MetricsNowNs();
+    cost = (uint64_t)(bytes * (NSPERSEC / admissionConfig.byteRate));
+    tat = atomic_load_explicit(&source->byteTat, memory_order_relaxed);
+    do
+    {
+        next = (tat > now ? tat : now) + cost;
+        if (sharedWorkers && next - now > NSPERSEC)
+        {
+            MetricsAdd(MET_THROTTLED, 1);
+            return 0;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&source->byteTat, &tat, next,
+                                                    memory_order_relaxed, memory_order_relaxed));
+
+    if (next - now > NSPERSEC)
+    {
+        waitNs = next - now - NSPERSEC;
+        MetricsAdd(MET_THROTTLED, 1);
+        delay.tv_sec = waitNs / NSPERSEC;
+        delay.tv_nsec = waitNs % NSPERSEC;
+        while (nanosleep(&delay, &delay) < 0 && errno == EINTR)
+        {
+            ;
+        }
+    }
+    return 1;
+}
+
+/* 接続を閉じる前に呼び、数えていた分を戻す。受け入れていない接続や、2回目の呼び出しでは何もしない */
+void AdmissionRelease(int clntSock)
+{
+    struct AdmissionSlot *slot; /* この接続の状態 */
+
+    if (admissionSlots == NULL || (size_t)clntSock >= numAdmissionSlots)
+    {
+        return;
+    }
+    slot = &admissionSlots[clntSock];
+    if (!slot->admitted)
+    {
+        return;
+    }
+
+    if (!slot->started)
+    {
+        atomic_fetch_sub_explicit(&pendingConns, 1, memory_order_relaxed);
+    }
+    /* 0になったバケットは受け入れスレッドが置き換えることがあるので、これより後では触らない */
+    if (slot->source != NULL)
+    {
+        atomic_fetch_sub_explicit(&slot->source->conns, 1, memory_order_release);
+    }
+    atomic_fetch_sub_explicit(&activeConns, 1, memory_order_relaxed);
+    slot->source = NULL;
+    slot->admitted = 0;
+}
+
+/* 送信元アドレスを16バイトにする。IPv4はIPv4射影アドレスにして、
+   デュアルスタックのソケットとIPv4のソケットで同じアドレスが同じバケットになるようにする。
+   Unixドメインのクライアントはアドレスを持たないので0を返す */
+int AdmissionSourceKey(const struct sockaddr *addr, uint8_t key[16])
+{
+    const struct sockaddr_in *addr4 = (const struct sockaddr_in *)addr;    /* IPv4のアドレス */
+    const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6 *)addr; /* IPv6のアドレス */
+
+    switch (addr->sa_family)
+    {
+    case AF_INET:
+        memset(key, 0, 10);
+        key[10] = 0xff;
+        key[11] = 0xff;
+        memcpy(key + 12, &addr4->sin_addr, 4);
+        return 1;
+    case AF_INET6:
+        memcpy(key, &addr6->sin6_addr, 16);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* 送信元アドレスのバケットを探す。なければ探す範囲の中の未使用の要素、それもなければ
+   接続中でなく最も長く使われていない要素を、このアドレスの新しい（満杯の）バケットにする。
+   範囲の全てが接続中なら、このアドレスは数えずにNULLを返す（全体の同時接続数の上限は効く）。
+   受け入れスレッドだけが呼ぶ */
+struct AdmissionSource *AdmissionLookup(const uint8_t key[16])
+{
+    struct AdmissionSource *source;        /* 調べる要素 */
+    struct AdmissionSource *victim = NULL; /* 置き換える要素 */
+    uint64_t lo, hi;                       /* アドレスの前半と後半 */
+    uint64_t hash;                         /* アドレスのハッシュ */
+    uint64_t lastUsed;                     /* 要素を最後に使った時刻 */
+    uint64_t victimLastUsed = 0;           /* 置き換える要素を最後に使った時刻 */
+    int i;
+
+    memcpy(&lo, key, 8);
+    memcpy(&hi, key + 8, 8);
+    hash = (lo ^ admissionSeed) * 0x9E3779B97F4A7C15ULL;
+    hash = (hash ^ (hash >> 29) ^ hi) * 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 32;
+
+    for (i = 0; i < ADMITPROBES; i++)
+    {
+        source = &admissionSources[(hash + i) & (ADMITTABLESIZE - 1)];
+        if (!source->used)
+        {
+            victim = source;
+            break;
+        }
+        if (memcmp(source->addr, key, 16) == 0)
+        {
+            return source;
+        }
+        if (atomic_load_explicit(&source->conns, memory_order_acquire) > 0)
+        {
+            continue;
+        }
+        lastUsed = atomic_load_explicit(&source->byteTat, memory_order_relaxed);
+        if (source->connTat > lastUsed)
+        {
+            lastUsed = source->connTat;
+        }
+        if (victim == NULL || lastUsed < victimLastUsed)
+        {
+            victim = source;
+            victimLastUsed = lastUsed;
+        }
+    }
+
+    if (victim == NULL)
+    {
+        return NULL;
+    }
+    memcpy(victim->addr, key, 16);
+    victim->used = 1;
+    victim->connTat = 0;
+    atomic_store_explicit(&victim->byteTat, 0, memory_order_relaxed);
+    return victim;
+}
+
+/* ADMITWINDOWMSごとに、その間に記録された応答時間の99パーセンタイルを求め、
+   閾値を超えていれば次に見直すまで新しい接続を断る。ヒストグラムのバケットは2のべき乗ナノ秒ごとなので、
+   パーセンタイルはそのバケットの上限（最大で2倍の誤差）で比べる */
+int AdmissionOverloaded(uint64_t now)
+{
+    uint64_t latency[LATENCYBUCKETS]; /* 現在のヒストグラム */
+    uint64_t window[LATENCYBUCKETS];  /* 前回からの記録 */
+    uint64_t count = 0;               /* 前回からの記録数 */
+    uint64_t cumulative = 0;          /* バケットi以下の記録数 */
+    int wasOverloaded = overloaded;   /* 前回の判定 */
+    int i;
+
+    if (admissionConfig.maxLatencyMs <= 0)
+    {
+        return 0;
+    }
+    if (now < windowEndNs)
+    {
+        return overloaded;
+    }
+    windowEndNs = now + ADMITWINDOWMS * 1000000ULL;
+
+    MetricsLatencySnapshot(latency);
+    for (i = 0; i < LATENCYBUCKETS; i++)
+    {
+        window[i] = latency[i] - lastLatency[i];
+        lastLatency[i] = latency[i];
+        count += window[i];
+    }
+
+    for (i = 0; i < LATENCYBUCKETS - 1; i++)
+    {
+        cumulative += window[i];
+        if (cumulative * 100 >= count * 99)
+        {
+            break;
+        }
+    }
+    /* 記録が少なければパーセンタイルが当てにならないので、受け入れる */
+    overloaded = count >= ADMITMINSAMPLES && (double)(1ULL << i) > admissionConfig.maxLatencyMs * 1e6;
+
+    if (overloaded != wasOverloaded)
+    {
+        LogWrite(LOG_WARN, 0, overloaded ? "p99 latency is over %lld us, rejecting new connections"
+                                         : "p99 latency is back under %lld us, accepting new connections",
+                 LOGARGS((long long)(admissionConfig.maxLatencyMs * 1000)));
+    }
+    return overloaded;
+}
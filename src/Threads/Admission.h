@@ -0,0 +1,50 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#ifndef CACHELINE
+#define CACHELINE 64 /* キャッシュラインのサイズ */
+#endif
+#define ADMITTABLESIZE 4096 /* 送信元アドレスの表の大きさ（2のべき乗） */
+#define ADMITPROBES 8       /* 送信元アドレスを探す範囲。この範囲になければ、空いている中で最も古いものを置き換える */
+#define ADMITWINDOWMS 100   /* 応答時間を見直す間隔（ミリ秒） */
+#define ADMITMINSAMPLES 100 /* 応答時間で受け入れを止めるのに必要な、1回の間隔の中の記録数 */
+
+/* getopt()に渡すオプションと、使い方の表示 */
+#define ADMISSIONOPTS "c:s:r:b:q:l:"
+#define ADMISSIONUSAGE "[-c <Max Connections: default 1024>] [-s <Connections per Source>] " \
+                       "[-r <New Connections/s per Source>] [-b <Bytes/s per Source>] "     \
+                       "[-q <Max Pending Connections>] [-l <Max p99 Latency ms>]"
+
+/* 受け入れの制限。0は制限しない */
+struct AdmissionConfig
+{
+    int maxConns;        /* 全体の同時接続数 */
+    int sourceConns;     /* 送信元アドレスごとの同時接続数 */
+    double connRate;     /* 送信元アドレスごとの1秒あたりの新しい接続数 */
+    double byteRate;     /* 送信元アドレスごとの1秒あたりのエコーするバイト数 */
+    int maxPending;      /* 受け入れてまだ処理を始めていない接続の数 */
+    double maxLatencyMs; /* 直近の応答時間の99パーセンタイル（ミリ秒） */
+};
+
+/* 送信元アドレスごとのトークンバケット。バケットはGCRAで表し、トークンの数の代わりに
+   「次に受け入れられる理論上の時刻」（TAT）を1つ持つ。時刻が過ぎていればバケットは満杯で、
+   TATと現在時刻の差が1秒分を超えるまでは続けて受け入れる。
+   バイト数のTATは複数のワーカーがCASで進めるので、他のアドレスとキャッシュラインを共有しない */
+struct AdmissionSource
+{
+    _Alignas(CACHELINE) uint8_t addr[16]; /* 送信元アドレス（IPv4はIPv4射影アドレスにする） */
+    int used;                             /* 使用中 */
+    atomic_int conns;                     /* 同時接続数 */
+    uint64_t connTat;                     /* 次の接続を受け入れられる時刻（受け入れスレッドだけが書く） */
+    atomic_uint_fast64_t byteTat;         /* 次のバイトを送れる時刻 */
+};
+
+int AdmissionOption(int opt, const char *arg);
+void AdmissionInit(void);
+int AdmissionAdmit(int clntSock, const struct sockaddr *addr);
+void AdmissionShareWorkers(void);
+void AdmissionStart(int clntSock);
+int AdmissionPace(int clntSock, size_t bytes);
+void AdmissionRelease(int clntSock);
@@ -0,0 +1,301 @@
+#include "TCPEchoServer.h"
+#include "ConnTable.h"
+#include "Metrics.h"
+#include <netinet/in.h>
+#include <sys/resource.h>
+
+/* スラブ。統計のスレッドが全ての接続を辿れるよう、確保したスラブをリストに繋ぐ */
+struct ConnSlab
+{
+    struct Conn conns[CONNSPERSLAB]; /* 切り分けた接続 */
+    struct ConnSlab *next;           /* 前に確保したスラブ */
+};
+
+struct ConnSlot *connSlots;           /* ディスクリプタで引く表 */
+size_t numConnSlots;                  /* connSlotsの要素数 */
+_Atomic(struct ConnSlab *) connSlabs; /* 確保した全てのスラブ */
+atomic_int numConnSlabs;              /* 確保したスラブの数 */
+/* 空きの接続のスタック。取り出すのは受け入れスレッドだけで、戻すのは接続を閉じる全てのスレッドなので、
+   CASで先頭を付け替えるだけでよい（取り出す側が1つなら、同じ先頭が取り出されて戻るABAは起きない） */
+_Atomic(struct Conn *) connFreeList;
+
+/* 表をディスクリプタの上限の数だけ確保する（触れるまでページは割り当てられない）。
+   呼ばなければ、以下の関数は何もしない */
+void ConnTableInit(void)
+{
+    struct rlimit limit; /* ディスクリプタ数の上限 */
+
+    numConnSlots = CONNTABLEMAX;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < CONNTABLEMAX)
+    {
+        numConnSlots = limit.rlim_cur;
+    }
+    if ((connSlots = (struct ConnSlot *)calloc(numConnSlots, sizeof(struct ConnSlot))) == NULL)
+    {
+        DieWithError("calloc() failed");
+    }
+
+    MetricsAddFormatter(ConnTableFormat);
+}
+
+/* 空きの接続を1つ取り出す。なければスラブを確保し、CONNSPERSLAB個に切り分けて空きリストに繋ぐ */
+struct Conn *ConnAllocate(void)
+{
+    struct ConnSlab *slab; /* 新しく確保したスラブ */
+    struct Conn *conn;     /* 取り出した接続 */
+    int i;
+
+    conn = atomic_load_explicit(&connFreeList, memory_order_acquire);
+    while (conn != NULL && !atomic_compare_exchange_weak_explicit(&connFreeList, &conn, conn->nextFree,
+                                                                  memory_order_acquire, memory_order_acquire))
+    {
+        ;
+    }
+    if (conn != NULL)
+    {
+        return conn;
+    }
+
+    if ((slab = (struct ConnSlab *)aligned_alloc(CACHELINE, sizeof(struct ConnSlab))) == NULL)
+    {
+        return NULL;
+    }
+    memset(slab, 0, sizeof(struct ConnSlab));
+
+    /* 先頭の1つをこの接続に使い、残りを空きリストに繋ぐ */
+    for (i = CONNSPERSLAB - 1; i >= 1; i--)
+    {
+        slab->conns[i].nextFree = atomic_load_explicit(&connFreeList, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&connFreeList, &slab->conns[i].nextFree, &slab->conns[i],
+                                                      memory_order_release, memory_order_relaxed))
+        {
+            ;
+        }
+    }
+
+    /* 統計のスレッドが辿るリストには、初期化を済ませてから繋ぐ */
+    slab->next = atomic_load_explicit(&connSlabs, memory_order_relaxed);
+    atomic_store_explicit(&connSlabs, slab, memory_order_release);
+    atomic_fetch_add_explicit(&numConnSlabs, 1, memory_order_relaxed);
+    return &slab->conns[0];
+}
+
+/* 受け入れた接続を表に載せる。受け入れスレッドだけが呼ぶ。
+   メモリが足りなければ載せずに戻る（エコーはできるが、統計には現れない） */
+void ConnOpen(int fd, const struct sockaddr *addr)
+{
+    const struct sockaddr_in *addr4 = (const struct sockaddr_in *)addr;    /* IPv4のアドレス */
+    const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6 *)addr; /* IPv6のアドレス */
+    struct ConnSlot *slot;                                                /* このディスクリプタの要素 */
+    struct Conn *conn;                                                    /* 載せる接続 */
+    uint64_t now;                                                         /* 現在時刻 */
+
+    if (connSlots == NULL || (size_t)fd >= numConnSlots || (conn = ConnAllocate()) == NULL)
+    {
+        return;
+    }
+    slot = &connSlots[fd];
+    now = MetricsNowNs();
+
+    atomic_store_explicit(&conn->fd, fd, memory_order_relaxed);
+    atomic_store_explicit(&conn->generation, atomic_fetch_add_explicit(&slot->generation, 1, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    /* 統計のスレッドが前の接続として読んでいる途中で中身を書き換えても、世代の変化で気づけるように、
+       世代を先に見せる */
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&conn->lastActiveNs, now, memory_order_relaxed);
+    atomic_store_explicit(&conn->bytes, 0, memory_order_relaxed);
+    atomic_store_explicit(&conn->echoes, 0, memory_order_relaxed);
+    conn->acceptedNs = now;
+    conn->nextFree = NULL;
+
+    memset(conn->addr, 0, sizeof(conn->addr));
+    conn->port = 0;
+    conn->family = addr->sa_family;
+    switch (addr->sa_family)
+    {
+    case AF_INET:
+        conn->addr[10] = 0xff;
+        conn->addr[11] = 0xff;
+        memcpy(conn->addr + 12, &addr4->sin_addr, 4);
+        conn->port = ntohs(addr4->sin_port);
+        break;
+    case AF_INET6:
+        memcpy(conn->addr, &addr6->sin6_addr, 16);
+        conn->port = ntohs(addr6->sin6_port);
+        break;
+    }
+
+    /* 統計のスレッドには、中身を書き終えてから使用中として見せる */
+    atomic_store_explicit(&conn->state, CONN_WAITING, memory_order_release);
+    atomic_store_explicit(&slot->conn, conn, memory_order_release);
+}
+
+/* ディスクリプタに今載っている接続のハンドルを返す。スレッドに渡す引数の代わりに使う */
+ConnHandle ConnGetHandle(int fd)
+{
+    struct Conn *conn; /* 載っている接続 */
+
+    if (connSlots == NULL || (size_t)fd >= numConnSlots ||
+        (conn = atomic_load_explicit(&connSlots[fd].conn, memory_order_acquire)) == NULL)
+    {
+        return (ConnHandle)(uint32_t)fd;
+    }
+    return (ConnHandle)atomic_load_explicit(&conn->generation, memory_order_relaxed) << 32 | (uint32_t)fd;
+}
+
+/* ハンドルの接続を返す。ディスクリプタが閉じられて別の接続に再利用されていれば、世代が違うのでNULLを返す。
+   表に載せられなかった接続（世代0）は表を引かずにNULLを返す。接続を処理するスレッドは閉じるまで
+   ディスクリプタを持っているので引き直す必要はなく、統計のスレッドのように持ち主でないスレッドが使う */
+struct Conn *ConnLookup(ConnHandle handle)
+{
+    int fd = (int)(uint32_t)handle;                 /* ディスクリプタ */
+    uint32_t generation = (uint32_t)(handle >> 32); /* ハンドルの世代 */
+    struct Conn *conn;                              /* 載っている接続 */
+
+    if (connSlots == NULL || generation == 0 || (size_t)fd >= numConnSlots ||
+        (conn = atomic_load_explicit(&connSlots[fd].conn, memory_order_acquire)) == NULL ||
+        atomic_load_explicit(&conn->generation, memory_order_relaxed) != generation)
+    {
+        return NULL;
+    }
+    return conn;
+}
+
+/* スレッドが接続の処理を始めた */
+void ConnStart(int fd)
+{
+    struct Conn *conn; /* 載っている接続 */
+
+    if (connSlots != NULL && (size_t)fd < numConnSlots &&
+        (conn = atomic_load_explicit(&connSlots[fd].conn, memory_order_acquire)) != NULL)
+    {
+        atomic_store_explicit(&conn->state, CONN_ACTIVE, memory_order_relaxed);
+    }
+}
+
+/* 1回のエコーを記録する。書き込むのは持ち主のスレッドだけなので、読んで足して書くだけでよい */
+void ConnRecordEcho(int fd, size_t bytes)
+{
+    struct Conn *conn; /* 載っている接続 */
+
+    if (connSlots == NULL || (size_t)fd >= numConnSlots ||
+        (conn = atomic_load_explicit(&connSlots[fd].conn, memory_order_relaxed)) == NULL)
+    {
+        return;
+    }
+    atomic_store_explicit(&conn->lastActiveNs, MetricsNowNs(), memory_order_relaxed);
+    atomic_store_explicit(&conn->bytes, atomic_load_explicit(&conn->bytes, memory_order_relaxed) + bytes,
+                          memory_order_relaxed);
+    atomic_store_explicit(&conn->echoes, atomic_load_explicit(&conn->echoes, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+/* 接続を表から外して空きリストに戻す。close()の前に呼ぶ（閉じた後では、同じディスクリプタで
+   受け入れた次の接続を外してしまう） */
+void ConnRelease(int fd)
+{
+    struct Conn *conn; /* 載っている接続 */
+
+    if (connSlots == NULL || (size_t)fd >= numConnSlots ||
+        (conn = atomic_exchange_explicit(&connSlots[fd].conn, NULL, memory_order_acq_rel)) == NULL)
+    {
+        return;
+    }
+
+    atomic_store_explicit(&conn->state, CONN_FREE, memory_order_relaxed);
+    conn->nextFree = atomic_load_explicit(&connFreeList, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&connFreeList, &conn->nextFree, conn,
+                                                  memory_order_release, memory_order_relaxed))
+    {
+        ;
+    }
+}
+
+/* 全てのスラブを辿って接続を状態ごとに数え、Prometheusのテキスト形式でbufferに書き込む。
+   接続ごとの値は出さず、数と最も長く無通信の時間だけにして、接続が増えても出力の長さを変えない */
+size_t ConnTableFormat(char *buffer, size_t size)
+{
+    struct ConnSlab *slab;   /* 辿っているスラブ */
+    struct Conn *conn;       /* 数える接続 */
+    int state;               /* 接続の状態 */
+    ConnHandle handle;       /* 数える接続のハンドル */
+    uint64_t lastActiveNs;   /* 最後にエコーした時刻 */
+    int waiting = 0;         /* 処理を待っている接続の数 */
+    int active = 0;          /* 処理中の接続の数 */
+    int idle = 0;            /* 処理中でCONNIDLESECS秒以上無通信の接続の数 */
+    uint64_t maxIdleNs = 0;  /* 最も長く無通信の時間 */
+    uint64_t idleNs;         /* 無通信の時間 */
+    uint64_t now;            /* 現在時刻 */
+    int slabs;               /* スラブの数 */
+    size_t len = 0;          /* 書き込んだバイト数 */
+    int i;
+
+    if (connSlots == NULL)
+    {
+        return 0;
+    }
+
+    now = MetricsNowNs();
+    slabs = atomic_load_explicit(&numConnSlabs, memory_order_relaxed);
+    for (slab = atomic_load_explicit(&connSlabs, memory_order_acquire); slab != NULL; slab = slab->next)
+    {
+        for (i = 0; i < CONNSPERSLAB; i++)
+        {
+            conn = &slab->conns[i];
+            if ((state = atomic_load_explicit(&conn->state, memory_order_acquire)) == CONN_FREE)
+            {
+                continue;
+            }
+            handle = (ConnHandle)atomic_load_explicit(&conn->generation, memory_order_relaxed) << 32 |
+                     (uint32_t)atomic_load_explicit(&conn->fd, memory_order_relaxed);
+            lastActiveNs = atomic_load_explicit(&conn->lastActiveNs, memory_order_relaxed);
+
+            /* 読んでいる間に接続が閉じられ、スラブの要素が次の接続に使われていれば、
+               ハンドルで引き直しても見つからないので数えない（次の統計で新しい接続として数える） */
+            atomic_thread_fence(memory_order_acquire);
+            if (ConnLookup(handle) != conn || atomic_load_explicit(&conn->state, memory_order_relaxed) != state)
+            {
+                continue;
+            }
+
+            switch (state)
+            {
+            case CONN_WAITING:
+                waiting++;
+                break;
+            case CONN_ACTIVE:
+                active++;
+                idleNs = now - lastActiveNs;
+                if (idleNs < (uint64_t)1 << 63 && idleNs >= CONNIDLESECS * 1000000000ULL)
+                {
+                    idle++;
+                }
+                if (idleNs < (uint64_t)1 << 63 && idleNs > maxIdleNs)
+                {
+                    maxIdleNs = idleNs;
+                }
+                break;
+            }
+        }
+    }
+
+#define APPEND(...) \
+    if (len < size) len += snprintf(buffer + len, size - len, __VA_ARGS__)
+
+    APPEND("# HELP echo_connection_table Connections in the connection table.\n"
+           "# TYPE echo_connection_table gauge\n"
+           "echo_connection_table{state=\"waiting\"} %d\n"
+           "echo_connection_table{state=\"active\"} %d\n"
+           "echo_connection_table{state=\"idle\"} %d\n", waiting, active, idle);
+    APPEND("# HELP echo_connection_max_idle_seconds Longest time an active connection has gone without echoing.\n"
+           "# TYPE echo_connection_max_idle_seconds gauge\n"
+           "echo_connection_max_idle_seconds %.3f\n", maxIdleNs / 1e9);
+    APPEND("# HELP echo_connection_table_bytes Memory held by connection objects, used or free.\n"
+           "# TYPE echo_connection_table_bytes gauge\n"
+           "echo_connection_table_bytes %zu\n", (size_t)slabs * sizeof(struct ConnSlab));
+
+#undef APPEND
+
+    return len < size ? len : size - 1;
+}
@@ -0,0 +1,60 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#ifndef CACHELINE
+#define CACHELINE 64 /* キャッシュラインのサイズ */
+#endif
+#define CONNSPERSLAB 64      /* 1つのスラブから切り分ける接続の数 */
+#define CONNTABLEMAX 1048576 /* 表に載せるディスクリプタの数の上限 */
+#define CONNIDLESECS 10      /* この秒数だけ送受信のない接続を、統計で無通信として数える */
+
+/* 接続の状態 */
+enum ConnState
+{
+    CONN_FREE,    /* 空き（スラブの空きリストにある） */
+    CONN_WAITING, /* 受け入れて、スレッドがまだ処理を始めていない */
+    CONN_ACTIVE   /* スレッドがエコーしている */
+};
+
+/* 接続ごとの状態。エコーのたびに書く値と、表から引くときに見る値を先頭の1キャッシュラインにまとめ、
+   表示にしか使わないアドレスは次のキャッシュラインに置く。1接続は2キャッシュライン（128バイト）で、
+   スラブからまとめて切り分けるので、接続の数に比例したメモリしか使わない */
+struct Conn
+{
+    /* 1キャッシュライン目: 持ち主のスレッドが書き、統計のスレッドが読む */
+    _Alignas(CACHELINE) atomic_int fd; /* クライアントのソケットディスクリプタ */
+    atomic_uint generation;            /* 表のこのディスクリプタの世代 */
+    atomic_int state;                  /* enum ConnState */
+    atomic_uint_fast64_t lastActiveNs; /* 最後にエコーした時刻 */
+    atomic_uint_fast64_t bytes;        /* エコーしたバイト数 */
+    atomic_uint_fast64_t echoes;       /* エコーした回数 */
+    uint64_t acceptedNs;               /* 受け入れた時刻 */
+    struct Conn *nextFree;             /* 空きリストの次の接続 */
+    /* 2キャッシュライン目: 受け入れたときに書くだけ */
+    _Alignas(CACHELINE) uint8_t addr[16]; /* クライアントのアドレス（IPv4はIPv4射影アドレス。Unixドメインは0） */
+    uint16_t port;                        /* クライアントのポート */
+    sa_family_t family;                   /* クライアントのアドレスファミリ */
+};
+
+/* ディスクリプタで引く表の要素。ディスクリプタは閉じるとすぐに再利用されるので、
+   接続を載せるたびに世代を進め、持ち主でないスレッドが引くときにハンドルの世代と比べて
+   古い接続を指していないかを確かめる */
+struct ConnSlot
+{
+    _Atomic(struct Conn *) conn; /* 載っている接続（なければNULL） */
+    atomic_uint generation;      /* 接続を載せた回数 */
+};
+
+/* 接続のハンドル。上位32ビットが世代、下位32ビットがディスクリプタ */
+typedef uint64_t ConnHandle;
+
+void ConnTableInit(void);
+void ConnOpen(int fd, const struct sockaddr *addr);
+ConnHandle ConnGetHandle(int fd);
+struct Conn *ConnLookup(ConnHandle handle);
+void ConnStart(int fd);
+void ConnRecordEcho(int fd, size_t bytes);
+void ConnRelease(int fd);
+size_t ConnTableFormat(char *buffer, size_t size);
@@ -0,0 +1,296 @@
+#include "Log.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOGBATCHSIZE 65536 /* ロガースレッドが1回のwrite()で書き出す最大のバイト数 */
+#define LOGLINESIZE 512    /* 1行の最大長 */
+#define LOGFLUSHMS 10      /* リングが空のときにロガースレッドが眠る時間（ミリ秒） */
+
+void *LoggerMain(void *arg);
+struct LogRing *LogThreadRing(void);
+void LogReleaseThread(void *arg);
+size_t LogDrain(void);
+
+/* 全スレッドのリング。先頭に追加するだけで削除しない（終了したスレッドのリングは次のスレッドが引き継ぐ） */
+_Atomic(struct LogRing *) allRings = NULL;
+/* 呼び出し元のスレッドのリング */
+__thread struct LogRing *myRing = NULL;
+/* スレッド終了時にリングを手放すためのキー */
+pthread_key_t logKey;
+pthread_once_t logKeyOnce = PTHREAD_ONCE_INIT;
+/* 書き込むレコードの最小のレベル */
+int logLevel = LOG_INFO;
+/* リングを読み出すのは1度に1スレッドだけ（ロガースレッドと、終了時のLogFlush()） */
+pthread_mutex_t drainLock = PTHREAD_MUTEX_INITIALIZER;
+
+const char *levelNames[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+/* レベルを設定し、リングを読み出して書き出すロガースレッドを起動する。
+   環境変数LOG_LEVEL（debug/info/warn/error）があれば、そちらを優先する */
+void LogInit(enum LogLevel level)
+{
+    const char *env = getenv("LOG_LEVEL"); /* 環境変数で指定したレベル */
+    sigset_t all;                          /* 全てのシグナル */
+    sigset_t saved;                        /* 呼び出し元のシグナルマスク */
+    pthread_t threadID;                    /* スレッドID */
+    int i;
+
+    logLevel = level;
+    for (i = 0; env != NULL && i <= LOG_ERROR; i++)
+    {
+        if (strcasecmp(env, levelNames[i]) == 0)
+        {
+            logLevel = i;
+        }
+    }
+
+    /* シグナルはロガースレッドに届かないようにする（ハンドラがロガースレッドでLogWrite()を呼ばないように） */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    if (pthread_create(&threadID, NULL, LoggerMain, NULL) == 0)
+    {
+        pthread_detach(threadID);
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    /* exit()で終了するときに、リングに残っているレコードを書き出す */
+    atexit(LogFlush);
+}
+
+void LogCreateKey(void)
+{
+    pthread_key_create(&logKey, LogReleaseThread);
+}
+
+/* スレッドが終了したらリングを手放す。残っているレコードはロガースレッドがそのまま読み出す */
+void LogReleaseThread(void *arg)
+{
+    atomic_store_explicit(&((struct LogRing *)arg)->inUse, 0, memory_order_release);
+}
+
+/* 呼び出し元のスレッドのリングを返す。初回は空いているリングを探し、なければ確保してリストに繋ぐ */
+struct LogRing *LogThreadRing(void)
+{
+    struct LogRing *ring; /* 調べるリング */
+    int unused;           /* CASで期待する値 */
+
+    if (myRing != NULL)
+    {
+        return myRing;
+    }
+
+    pthread_once(&logKeyOnce, LogCreateKey);
+
+    for (ring = atomic_load_explicit(&allRings, memory_order_acquire); ring != NULL; ring = ring->next)
+    {
+        unused = 0;
+        if (atomic_compare_exchange_strong_explicit(&ring->inUse, &unused, 1,
+                                                    memory_order_acquire, memory_order_relaxed))
+        {
+            break;
+        }
+    }
+
+    if (ring == NULL)
+    {
+        /* 確保できなければ、ログのためにサーバーを止めずにレコードを捨てる */
+        if ((ring = (struct LogRing *)aligned_alloc(CACHELINE, sizeof(struct LogRing))) == NULL)
+        {
+            return NULL;
+        }
+        memset(ring, 0, sizeof(struct LogRing));
+        atomic_init(&ring->inUse, 1);
+        ring->next = atomic_load_explicit(&allRings, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&allRings, &ring->next, ring,
+                                                      memory_order_release, memory_order_relaxed))
+        {
+            ;
+        }
+    }
+
+    pthread_setspecific(logKey, ring);
+    myRing = ring;
+    return ring;
+}
+
+/* 呼び出し元のスレッドのリングを先に確保する。リングの確保はシグナルハンドラの中では安全でないので、
+   シグナルハンドラでLogWrite()を呼ぶスレッドは、ハンドラを設定する前にこれを呼んでおく */
+void LogThreadInit(void)
+{
+    LogThreadRing();
+}
+
+/* レコードを1つリングに書き込む。書式の展開もシステムコールもしないので、数十ナノ秒で終わる。
+   リングが一杯、またはレート制限を超えたときは待たずに捨て、捨てた数だけを数える */
+void LogWrite(enum LogLevel level, int err, const char *format, const long long *args, int nargs)
+{
+    struct LogRing *ring;     /* このスレッドのリング */
+    struct LogRecord *record; /* 書き込むレコード */
+    struct timespec now;      /* 現在時刻 */
+    size_t tail;              /* 書き込む位置 */
+    int i;
+
+    if ((int)level < logLevel || (ring = LogThreadRing()) == NULL)
+    {
+        return;
+    }
+
+    /* vDSOで読めるので、システムコールにならない */
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+    /* レート制限: 1秒ごとに書いた数を数え直す */
+    if ((uint64_t)now.tv_sec != ring->windowSec)
+    {
+        ring->windowSec = now.tv_sec;
+        ring->windowCount = 0;
+    }
+    if (ring->windowCount >= LOGRATELIMIT)
+    {
+        atomic_store_explicit(&ring->suppressed,
+                              atomic_load_explicit(&ring->suppressed, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return;
+    }
+    ring->windowCount++;
+
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) >= LOGRINGSIZE)
+    {
+        atomic_store_explicit(&ring->dropped,
+                              atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return;
+    }
+
+    record = &ring->records[tail & (LOGRINGSIZE - 1)];
+    record->timeNs = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    record->format = format;
+    record->err = err;
+    record->level = level;
+    for (i = 0; i < LOGMAXARGS; i++)
+    {
+        record->args[i] = i < nargs ? args[i] : 0;
+    }
+
+    /* レコードを書き終えてから位置を進める（ロガースレッドは位置を見てからレコードを読む） */
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/* 1レコードを1行の文字列にする */
+size_t LogFormatRecord(const struct LogRecord *record, char *line, size_t size)
+{
+    time_t sec = record->timeNs / 1000000000ULL; /* 秒 */
+    struct tm tm;                                /* 日時 */
+    size_t len;                                  /* 書き込んだバイト数 */
+    int n;
+
+    localtime_r(&sec, &tm);
+    len = strftime(line, size, "%Y-%m-%d %H:%M:%S", &tm);
+    n = snprintf(line + len, size - len, ".%03llu %-5s ",
+                 (unsigned long long)(record->timeNs / 1000000 % 1000), levelNames[record->level]);
+    len += n;
+    n = snprintf(line + len, size - len, record->format, record->args[0], record->args[1], record->args[2],
+                 record->args[3], record->args[4]);
+    len = (n < 0 || len + n >= size) ? size - 1 : len + n;
+    if (record->err != 0 && len < size - 1)
+    {
+        n = snprintf(line + len, size - len, ": %s", strerror(record->err));
+        len = (n < 0 || len + n >= size) ? size - 1 : len + n;
+    }
+    /* 長すぎる行は切り詰めて、必ず改行で終わらせる */
+    if (len >= size - 1)
+    {
+        len = size - 2;
+    }
+    line[len++] = '\n';
+    return len;
+}
+
+/* 全スレッドのリングに溜まったレコードを文字列にし、まとめてwrite()で書き出す。読み出したレコードの数を返す */
+size_t LogDrain(void)
+{
+    static char batch[LOGBATCHSIZE]; /* 書き出す文字列（drainLockで守る） */
+    size_t batchLen = 0;             /* batchに溜めたバイト数 */
+    size_t drained = 0;              /* 読み出したレコードの数 */
+    struct LogRing *ring;            /* 読み出すリング */
+    struct LogRecord record;         /* 読み出したレコードの写し */
+    size_t head;                     /* 読み出す位置 */
+    size_t tail;                     /* 書き込み済みの位置 */
+    uint64_t lost;                   /* 捨てたレコードの数 */
+
+    pthread_mutex_lock(&drainLock);
+
+    for (ring = atomic_load_explicit(&allRings, memory_order_acquire); ring != NULL; ring = ring->next)
+    {
+        head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        for (; head != tail; head++)
+        {
+            /* 写し終えたらすぐに位置を進め、書き込み側に場所を返す */
+            record = ring->records[head & (LOGRINGSIZE - 1)];
+            atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+            if (batchLen + LOGLINESIZE > LOGBATCHSIZE)
+            {
+                write(STDERR_FILENO, batch, batchLen);
+                batchLen = 0;
+            }
+            batchLen += LogFormatRecord(&record, batch + batchLen, LOGLINESIZE);
+            drained++;
+        }
+
+        /* 捨てたレコードがあれば、その数を1行で知らせる */
+        lost = atomic_load_explicit(&ring->dropped, memory_order_relaxed) - ring->reportedDropped +
+               atomic_load_explicit(&ring->suppressed, memory_order_relaxed) - ring->reportedSuppressed;
+        if (lost > 0)
+        {
+            ring->reportedDropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+            ring->reportedSuppressed = atomic_load_explicit(&ring->suppressed, memory_order_relaxed);
+            if (batchLen + LOGLINESIZE > LOGBATCHSIZE)
+            {
+                write(STDERR_FILENO, batch, batchLen);
+                batchLen = 0;
+            }
+            batchLen += snprintf(batch + batchLen, LOGLINESIZE, "%llu log messages dropped\n",
+                                 (unsigned long long)lost);
+        }
+    }
+
+    if (batchLen > 0)
+    {
+        write(STDERR_FILENO, batch, batchLen);
+    }
+
+    pthread_mutex_unlock(&drainLock);
+    return drained;
+}
+
+/* 呼び出し元のスレッドで、リングに残っているレコードを全て書き出す */
+void LogFlush(void)
+{
+    LogDrain();
+}
+
+/* リングが空になるまで読み出し、空なら少し眠る。レコードが来るたびに起こさないので、
+   書き込み側はロガースレッドを起こすシステムコールを呼ばずに済む */
+void *LoggerMain(void *arg)
+{
+    struct timespec interval = {0, LOGFLUSHMS * 1000000L}; /* 眠る時間 */
+
+    for (;;)
+    {
+        if (LogDrain() == 0)
+        {
+            nanosleep(&interval, NULL);
+        }
+    }
+
+    return (NULL);
+}
@@ -0,0 +1,68 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef CACHELINE
+#define CACHELINE 64 /* キャッシュラインのサイズ */
+#endif
+#define LOGRINGSIZE 1024 /* スレッドごとのリングのレコード数（2のべき乗） */
+#define LOGMAXARGS 5     /* 1レコードの引数の最大数 */
+#define LOGRATELIMIT 1000 /* 1スレッドが1秒間に書けるレコード数。超えた分は捨てて数だけ出力する */
+
+/* ログレベル。LogInit()で指定したレベル未満のレコードは書かない */
+enum LogLevel
+{
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+};
+
+/* 固定長のレコード（64バイト）。書き込むときは書式の文字列を展開せず、ポインタと引数だけを詰める。
+   書式はプログラムが終了するまで有効な文字列リテラルで、変換指定は %lld / %llu / %llx だけを使う */
+struct LogRecord
+{
+    uint64_t timeNs;            /* 書き込んだ時刻（CLOCK_REALTIME） */
+    const char *format;         /* 書式 */
+    long long args[LOGMAXARGS]; /* 引数 */
+    int err;                    /* 末尾にstrerror()を付けるerrno（0なら付けない） */
+    int level;                  /* ログレベル */
+};
+
+/* スレッドごとのSPSCリング。書き込むのは持ち主のスレッドだけ、読み出すのはロガースレッドだけなので、
+   ロックもCASも要らない。書き込み側と読み出し側の位置は別のキャッシュラインに置く */
+struct LogRing
+{
+    _Alignas(CACHELINE) atomic_size_t tail; /* 次に書き込む位置（持ち主のスレッドが進める） */
+    atomic_uint_fast64_t dropped;           /* リングが一杯で捨てたレコードの数 */
+    atomic_uint_fast64_t suppressed;        /* レート制限で捨てたレコードの数 */
+    uint64_t windowSec;                     /* レート制限の現在の1秒 */
+    unsigned int windowCount;               /* 現在の1秒に書いたレコードの数 */
+    _Alignas(CACHELINE) atomic_size_t head; /* 次に読み出す位置（ロガースレッドが進める） */
+    uint64_t reportedDropped;               /* 出力済みのdropped */
+    uint64_t reportedSuppressed;            /* 出力済みのsuppressed */
+    atomic_int inUse;                       /* スレッドが使用中 */
+    struct LogRing *next;                   /* 全スレッドのリングのリスト */
+    struct LogRecord records[LOGRINGSIZE];  /* レコード */
+};
+
+/* 可変長の引数をlong longの配列と個数にする（先頭の0は引数がないときに配列を空にしないためのもの） */
+#define LOGARGS(...) ((const long long[]){0, ##__VA_ARGS__}) + 1, \
+                     (int)(sizeof((const long long[]){0, ##__VA_ARGS__}) / sizeof(long long)) - 1
+/* IPv4アドレス（struct in_addr）をドット区切りの4つの引数にする。書式は "%lld.%lld.%lld.%lld" */
+#define LOGADDR(addr) (long long)(ntohl((addr).s_addr) >> 24), (long long)((ntohl((addr).s_addr) >> 16) & 0xff), \
+                      (long long)((ntohl((addr).s_addr) >> 8) & 0xff), (long long)(ntohl((addr).s_addr) & 0xff)
+
+#define LogDebug(format, ...) LogWrite(LOG_DEBUG, 0, format, LOGARGS(__VA_ARGS__))
+#define LogInfo(format, ...) LogWrite(LOG_INFO, 0, format, LOGARGS(__VA_ARGS__))
+#define LogWarn(format, ...) LogWrite(LOG_WARN, 0, format, LOGARGS(__VA_ARGS__))
+#define LogError(format, ...) LogWrite(LOG_ERROR, 0, format, LOGARGS(__VA_ARGS__))
+/* errnoの説明を末尾に付ける（perror()の代わり） */
+#define LogErrno(level, format, ...) LogWrite(level, errno, format, LOGARGS(__VA_ARGS__))
+
+void LogInit(enum LogLevel level);
+void LogThreadInit(void);
+void LogWrite(enum LogLevel level, int err, const char *format, const long long *args, int nargs);
+void LogFlush(void);
@@ -0,0 +1,101 @@
+#include "MPMCQueue.h"
+#include "TCPEchoServer.h"
+
+void MPMCQueueInit(struct MPMCQueue *queue, size_t capacity)
+{
+    size_t i;
+
+    /* インデックスをマスクで計算できるよう、容量は2のべき乗にする */
+    if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+    {
+        fprintf(stderr, "queue capacity must be a power of two: %zu\n", capacity);
+        exit(1);
+    }
+
+    if ((queue->cells = (struct MPMCCell *)malloc(sizeof(struct MPMCCell) * capacity)) == NULL)
+    {
+        DieWithError("malloc() failed");
+    }
+    for (i = 0; i < capacity; i++)
+    {
+        atomic_init(&queue->cells[i].sequence, i);
+    }
+    queue->mask = capacity - 1;
+    atomic_init(&queue->enqueuePos, 0);
+    atomic_init(&queue->dequeuePos, 0);
+}
+
+/* 要素を追加する。成功すれば1、満杯なら0を返す */
+int MPMCQueuePush(struct MPMCQueue *queue, int value)
+{
+    struct MPMCCell *cell;
+    size_t pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+    size_t seq;
+    long diff;
+
+    for (;;)
+    {
+        cell = &queue->cells[pos & queue->mask];
+        seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        diff = (long)seq - (long)pos;
+        if (diff == 0)
+        {
+            /* 空き要素を見つけたので、位置の確保をCASで試みる */
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return 0; /* 満杯 */
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+        }
+    }
+
+    cell->value = value;
+    /* sequenceを進めて消費者に公開する */
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return 1;
+}
+
+/* 要素を取り出す。成功すれば1、空なら0を返す */
+int MPMCQueuePop(struct MPMCQueue *queue, int *value)
+{
+    struct MPMCCell *cell;
+    size_t pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+    size_t seq;
+    long diff;
+
+    for (;;)
+    {
+        cell = &queue->cells[pos & queue->mask];
+        seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        diff = (long)seq - (long)(pos + 1);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return 0; /* 空 */
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+        }
+    }
+
+    *value = cell->value;
+    /* 一周後の生産者が使えるようにsequenceを進める */
+    atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+    return 1;
+}
@@ -0,0 +1,24 @@
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define CACHELINE 64 /* キャッシュラインのサイズ */
+
+/* リングの1要素。sequenceで要素の世代を管理する */
+struct MPMCCell
+{
+    atomic_size_t sequence;
+    int value;
+};
+
+/* 固定長・ロックフリーのMPMC（複数生産者・複数消費者）リングバッファ */
+struct MPMCQueue
+{
+    struct MPMCCell *cells;
+    size_t mask;
+    _Alignas(CACHELINE) atomic_size_t enqueuePos; /* 生産者と消費者で別のキャッシュラインに置く */
+    _Alignas(CACHELINE) atomic_size_t dequeuePos;
+};
+
+void MPMCQueueInit(struct MPMCQueue *queue, size_t capacity);
+int MPMCQueuePush(struct MPMCQueue *queue, int value);
+int MPMCQueuePop(struct MPMCQueue *queue, int *value);
@@ -0,0 +1,390 @@
+#include "TCPEchoServer.h"
+#include "Metrics.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#define METRICSBUFSIZE 8192   /* 統計のテキストの最大長 */
+#define METRICSTIMEOUT_MS 1000 /* 統計を取りに来たクライアントとの送受信の期限（ミリ秒） */
+#define METRICSBACKOFF_MS 100  /* accept()に失敗したときに再試行するまでの待ち時間（ミリ秒） */
+
+void *MetricsServerMain(void *arg);
+struct ThreadMetrics *MetricsThread(void);
+void MetricsReleaseThread(void *arg);
+
+/* 全スレッドのカウンタ。先頭に追加するだけで削除しない（終了したスレッドのカウンタは次のスレッドが引き継ぐ） */
+_Atomic(struct ThreadMetrics *) allMetrics = NULL;
+/* 呼び出し元のスレッドのカウンタ */
+__thread struct ThreadMetrics *myMetrics = NULL;
+/* スレッド終了時にカウンタを手放すためのキー */
+pthread_key_t metricsKey;
+pthread_once_t metricsKeyOnce = PTHREAD_ONCE_INIT;
+/* 他のモジュールが統計の末尾に追加する出力（統計のスレッドを起動する前に登録する） */
+size_t (*formatters[MAXFORMATTERS])(char *buffer, size_t size);
+int numFormatters = 0;
+
+/* カウンタの名前と説明（enum MetricCounterの順） */
+const char *counterNames[MET_COUNTERS] = {
+    "echo_accepts_total",
+    "echo_connections_closed_total",
+    "echo_received_bytes_total",
+    "echo_sent_bytes_total",
+    "echo_recv_calls_total",
+    "echo_send_calls_total",
+    "echo_errors_total",
+    "echo_accepts_shed_total",
+    "echo_rejected_capacity_total",
+    "echo_rejected_overload_total",
+    "echo_rejected_source_total",
+    "echo_rejected_rate_total",
+    "echo_throttled_total",
+};
+const char *counterHelp[MET_COUNTERS] = {
+    "Accepted connections.",
+    "Closed connections.",
+    "Bytes received from clients.",
+    "Bytes sent to clients.",
+    "Receive system calls.",
+    "Send system calls.",
+    "Receive and send errors.",
+    "Connections closed right after accept because the process was out of file descriptors.",
+    "Connections closed right after accept because the server was at its connection limit.",
+    "Connections closed right after accept because too many were pending or latency was too high.",
+    "Connections closed right after accept because the source had too many open connections.",
+    "Connections closed right after accept because the source opened connections too fast.",
+    "Times a connection was paused because its source exceeded its byte rate.",
+};
+/* エラーの種類のラベル（enum ErrorCategoryの順） */
+const char *errorCategoryNames[ERR_CATEGORIES] = {
+    "reset",
+    "pipe",
+    "timeout",
+    "fds",
+    "memory",
+    "other",
+};
+
+void MetricsCreateKey(void)
+{
+    pthread_key_create(&metricsKey, MetricsReleaseThread);
+}
+
+/* スレッドが終了したらカウンタを手放す。値は消さず、次に作られるスレッドがそのまま加算を続ける */
+void MetricsReleaseThread(void *arg)
+{
+    atomic_store_explicit(&((struct ThreadMetrics *)arg)->inUse, 0, memory_order_release);
+}
+
+/* 呼び出し元のスレッドのカウンタを返す。初回は空いているカウンタを探し、なければ確保してリストに繋ぐ */
+struct ThreadMetrics *MetricsThread(void)
+{
+    struct ThreadMetrics *metrics; /* 調べるカウンタ */
+    int unused;                    /* CASで期待する値 */
+
+    if (myMetrics != NULL)
+    {
+        return myMetrics;
+    }
+
+    pthread_once(&metricsKeyOnce, MetricsCreateKey);
+
+    for (metrics = atomic_load_explicit(&allMetrics, memory_order_acquire); metrics != NULL; metrics = metrics->next)
+    {
+        unused = 0;
+        if (atomic_compare_exchange_strong_explicit(&metrics->inUse, &unused, 1,
+                                                    memory_order_acquire, memory_order_relaxed))
+        {
+            break;
+        }
+    }
+
+    if (metrics == NULL)
+    {
+        if ((metrics = (struct ThreadMetrics *)aligned_alloc(CACHELINE, sizeof(struct ThreadMetrics))) == NULL)
+        {
+            DieWithError("aligned_alloc() failed");
+        }
+        memset(metrics, 0, sizeof(struct ThreadMetrics));
+        atomic_init(&metrics->inUse, 1);
+        metrics->next = atomic_load_explicit(&allMetrics, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&allMetrics, &metrics->next, metrics,
+                                                      memory_order_release, memory_order_relaxed))
+        {
+            ;
+        }
+    }
+
+    pthread_setspecific(metricsKey, metrics);
+    myMetrics = metrics;
+    return metrics;
+}
+
+/* 書き込むのは持ち主のスレッドだけなので、読んで足して書くだけでよい（lock付きの命令にならない）。
+   集計するスレッドはrelaxedで読むので、値が途中で壊れて見えることはない */
+void MetricsAdd(enum MetricCounter counter, uint64_t value)
+{
+    struct ThreadMetrics *metrics = MetricsThread(); /* このスレッドのカウンタ */
+
+    atomic_store_explicit(&metrics->counters[counter],
+                          atomic_load_explicit(&metrics->counters[counter], memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+/* errnoを種類に分けて数える。エラーの合計（MET_ERRORS）も増やす */
+void MetricsCountError(int err)
+{
+    struct ThreadMetrics *metrics = MetricsThread(); /* このスレッドのカウンタ */
+    enum ErrorCategory category;                     /* エラーの種類 */
+
+    switch (err)
+    {
+    case ECONNRESET:
+    case ECONNABORTED:
+        category = ERR_RESET;
+        break;
+    case EPIPE:
+        category = ERR_PIPE;
+        break;
+    case ETIMEDOUT:
+    case EHOSTUNREACH:
+        category = ERR_TIMEOUT;
+        break;
+    case EMFILE:
+    case ENFILE:
+        category = ERR_FDS;
+        break;
+    case ENOMEM:
+    case ENOBUFS:
+    case EAGAIN:
+        category = ERR_MEMORY;
+        break;
+    default:
+        category = ERR_OTHER;
+        break;
+    }
+
+    atomic_store_explicit(&metrics->errors[category],
+                          atomic_load_explicit(&metrics->errors[category], memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    MetricsAdd(MET_ERRORS, 1);
+}
+
+/* 1回のエコー（受信から送信完了まで）にかかった時間を記録する */
+void MetricsRecordLatency(uint64_t ns)
+{
+    struct ThreadMetrics *metrics = MetricsThread(); /* このスレッドのカウンタ */
+    int bucket;                                      /* 2^bucketナノ秒以下のバケット */
+
+    bucket = ns <= 1 ? 0 : 64 - __builtin_clzll(ns - 1);
+    if (bucket >= LATENCYBUCKETS)
+    {
+        bucket = LATENCYBUCKETS - 1;
+    }
+    atomic_store_explicit(&metrics->latency[bucket],
+                          atomic_load_explicit(&metrics->latency[bucket], memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&metrics->latencySumNs,
+                          atomic_load_explicit(&metrics->latencySumNs, memory_order_relaxed) + ns,
+                          memory_order_relaxed);
+}
+
+/* 全スレッドの応答時間のヒストグラムを合計する。前回の値との差を取れば、その間の分布になる */
+void MetricsLatencySnapshot(uint64_t latency[LATENCYBUCKETS])
+{
+    struct ThreadMetrics *metrics; /* 集計するカウンタ */
+    int i;
+
+    memset(latency, 0, sizeof(uint64_t) * LATENCYBUCKETS);
+    for (metrics = atomic_load_explicit(&allMetrics, memory_order_acquire); metrics != NULL; metrics = metrics->next)
+    {
+        for (i = 0; i < LATENCYBUCKETS; i++)
+        {
+            latency[i] += atomic_load_explicit(&metrics->latency[i], memory_order_relaxed);
+        }
+    }
+}
+
+uint64_t MetricsNowNs(void)
+{
+    struct timespec ts; /* 現在時刻 */
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 全スレッドのカウンタを合計し、Prometheusのテキスト形式でbufferに書き込む */
+size_t MetricsFormat(char *buffer, size_t size)
+{
+    uint64_t counters[MET_COUNTERS] = {0};  /* カウンタの合計 */
+    uint64_t errors[ERR_CATEGORIES] = {0};  /* 種類ごとのエラーの合計 */
+    uint64_t latency[LATENCYBUCKETS] = {0}; /* ヒストグラムの合計 */
+    uint64_t latencySum = 0;                /* 応答時間の合計 */
+    uint64_t cumulative = 0;                /* le以下の記録数 */
+    int threads = 0;                        /* 使用中のスレッドの数 */
+    struct ThreadMetrics *metrics;          /* 集計するカウンタ */
+    size_t len = 0;                         /* 書き込んだバイト数 */
+    int i;
+
+    for (metrics = atomic_load_explicit(&allMetrics, memory_order_acquire); metrics != NULL; metrics = metrics->next)
+    {
+        for (i = 0; i < MET_COUNTERS; i++)
+        {
+            counters[i] += atomic_load_explicit(&metrics->counters[i], memory_order_relaxed);
+        }
+        for (i = 0; i < ERR_CATEGORIES; i++)
+        {
+            errors[i] += atomic_load_explicit(&metrics->errors[i], memory_order_relaxed);
+        }
+        for (i = 0; i < LATENCYBUCKETS; i++)
+        {
+            latency[i] += atomic_load_explicit(&metrics->latency[i], memory_order_relaxed);
+        }
+        latencySum += atomic_load_explicit(&metrics->latencySumNs, memory_order_relaxed);
+        threads += atomic_load_explicit(&metrics->inUse, memory_order_relaxed);
+    }
+
+#define APPEND(...) \
+    if (len < size) len += snprintf(buffer + len, size - len, __VA_ARGS__)
+
+    for (i = 0; i < MET_COUNTERS; i++)
+    {
+        APPEND("# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counterNames[i], counterHelp[i], counterNames[i],
+               counterNames[i], (unsigned long long)counters[i]);
+    }
+
+    APPEND("# HELP echo_connection_errors_total Connection errors by category.\n"
+           "# TYPE echo_connection_errors_total counter\n");
+    for (i = 0; i < ERR_CATEGORIES; i++)
+    {
+        APPEND("echo_connection_errors_total{category=\"%s\"} %llu\n", errorCategoryNames[i],
+               (unsigned long long)errors[i]);
+    }
+
+    /* 受け入れと切断は別のスレッドで数えるので、使用中の接続数は合計の差で求める */
+    APPEND("# HELP echo_connections_active Open client connections.\n# TYPE echo_connections_active gauge\n"
+           "echo_connections_active %lld\n", (long long)(counters[MET_ACCEPTS] - counters[MET_CLOSES]));
+    APPEND("# HELP echo_threads Threads that have recorded metrics.\n# TYPE echo_threads gauge\n"
+           "echo_threads %d\n", threads);
+
+    APPEND("# HELP echo_latency_seconds Time from a receive returning to its echo being sent.\n"
+           "# TYPE echo_latency_seconds histogram\n");
+    for (i = 0; i < LATENCYBUCKETS - 1; i++)
+    {
+        cumulative += latency[i];
+        APPEND("echo_latency_seconds_bucket{le=\"%.9f\"} %llu\n", (double)(1ULL << i) / 1e9,
+               (unsigned long long)cumulative);
+    }
+    cumulative += latency[LATENCYBUCKETS - 1];
+    APPEND("echo_latency_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cumulative);
+    APPEND("echo_latency_seconds_sum %.9f\n", latencySum / 1e9);
+    APPEND("echo_latency_seconds_count %llu\n", (unsigned long long)cumulative);
+
+#undef APPEND
+
+    for (i = 0; i < numFormatters && len < size; i++)
+    {
+        len += formatters[i](buffer + len, size - len);
+    }
+
+    return len < size ? len : size - 1;
+}
+
+/* formatが書き込んだテキストを、統計の末尾に追加する */
+void MetricsAddFormatter(size_t (*format)(char *buffer, size_t size))
+{
+    if (numFormatters < MAXFORMATTERS)
+    {
+        formatters[numFormatters++] = format;
+    }
+}
+
+/* 127.0.0.1:portで統計を返すスレッドを起動する */
+void MetricsStartServer(unsigned short port)
+{
+    int sock;                     /* 統計用のリスニングソケット */
+    int on = 1;                   /* ソケットオプションの値 */
+    struct sockaddr_in statsAddr; /* 統計用のアドレス */
+    pthread_t threadID;           /* スレッドID */
+
+    if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+    {
+        DieWithError("socket() failed");
+    }
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    /* 外部に公開しないよう、ループバックアドレスにだけバインドする */
+    memset(&statsAddr, 0, sizeof(statsAddr));
+    statsAddr.sin_family = AF_INET;
+    statsAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    statsAddr.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr *)&statsAddr, sizeof(statsAddr)) < 0)
+    {
+        DieWithError("bind() failed");
+    }
+    if (listen(sock, 16) < 0)
+    {
+        DieWithError("listen() failed");
+    }
+
+    if (pthread_create(&threadID, NULL, MetricsServerMain, (void *)(intptr_t)sock) != 0)
+    {
+        DieWithError("pthread_create() failed");
+    }
+    pthread_detach(threadID);
+}
+
+/* 接続ごとにリクエストを読み捨て、HTTP/1.0のレスポンスとして統計を返して閉じる。
+   1つのスレッドで順番に処理するので、何も送らないクライアントや受信しないクライアントに
+   止められないよう、送受信に期限を付ける */
+void *MetricsServerMain(void *arg)
+{
+    int servSock = (int)(intptr_t)arg; /* 統計用のリスニングソケット */
+    int clntSock;                      /* 統計を取りに来たクライアント */
+    char request[1024];                /* リクエスト（内容は見ない） */
+    char body[METRICSBUFSIZE];         /* 統計のテキスト */
+    char header[128];                  /* レスポンスヘッダ */
+    struct iovec iov[2];               /* ヘッダと本文 */
+    struct msghdr msg;                 /* 送信するメッセージ */
+    size_t bodyLen;                    /* 本文の長さ */
+    struct timeval timeout;            /* 送受信の期限 */
+    struct timespec backoff;           /* accept()を再試行するまでの待ち時間 */
+
+    timeout.tv_sec = METRICSTIMEOUT_MS / 1000;
+    timeout.tv_usec = METRICSTIMEOUT_MS % 1000 * 1000;
+    backoff.tv_sec = METRICSBACKOFF_MS / 1000;
+    backoff.tv_nsec = METRICSBACKOFF_MS % 1000 * 1000000;
+
+    for (;;)
+    {
+        if ((clntSock = accept(servSock, NULL, NULL)) < 0)
+        {
+            /* ディスクリプタが尽きたときなどに空回りしないよう、少し待ってから再試行する */
+            if (errno != EINTR && errno != ECONNABORTED)
+            {
+                nanosleep(&backoff, NULL);
+            }
+            continue;
+        }
+        setsockopt(clntSock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(clntSock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        recv(clntSock, request, sizeof(request), 0);
+
+        bodyLen = MetricsFormat(body, sizeof(body));
+        iov[0].iov_base = header;
+        iov[0].iov_len = snprintf(header, sizeof(header),
+                                  "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                  "Content-Length: %zu\r\n\r\n", bodyLen);
+        iov[1].iov_base = body;
+        iov[1].iov_len = bodyLen;
+
+        /* 途中で切断されても、SIGPIPEでサーバー全体を終了させない */
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        sendmsg(clntSock, &msg, MSG_NOSIGNAL);
+        close(clntSock);
+    }
+
+    return (NULL);
+}
@@ -0,0 +1,61 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef CACHELINE
+#define CACHELINE 64 /* キャッシュラインのサイズ */
+#endif
+#define LATENCYBUCKETS 32 /* 応答時間のヒストグラムのバケット数（2のべき乗ナノ秒ごと、約2秒まで） */
+#define MAXFORMATTERS 4    /* 統計に追加できる出力の数 */
+
+/* スレッドごとに数えるカウンタ */
+enum MetricCounter
+{
+    MET_ACCEPTS,         /* 受け入れた接続の数 */
+    MET_CLOSES,          /* 閉じた接続の数 */
+    MET_BYTES_IN,        /* 受信したバイト数 */
+    MET_BYTES_OUT,       /* 送信したバイト数 */
+    MET_RECV_CALLS,      /* 受信のシステムコールの回数 */
+    MET_SEND_CALLS,      /* 送信のシステムコールの回数 */
+    MET_ERRORS,          /* 送受信のエラーの回数 */
+    MET_SHED,            /* ディスクリプタが足りず、受け入れてすぐに閉じた接続の数 */
+    MET_REJECT_CAPACITY, /* 全体の同時接続数の上限を超え、受け入れてすぐに閉じた接続の数 */
+    MET_REJECT_OVERLOAD, /* 処理待ちの接続数や応答時間が閾値を超え、受け入れてすぐに閉じた接続の数 */
+    MET_REJECT_SOURCE,   /* 送信元アドレスごとの同時接続数の上限を超え、受け入れてすぐに閉じた接続の数 */
+    MET_REJECT_RATE,     /* 送信元アドレスごとの新しい接続の頻度の上限を超え、受け入れてすぐに閉じた接続の数 */
+    MET_THROTTLED,       /* 送信元アドレスごとのバイト数の上限を超え、受信を待たせた（スレッドプールでは閉じた）回数 */
+    MET_COUNTERS         /* カウンタの数 */
+};
+
+/* エラーの種類（errnoから分類する） */
+enum ErrorCategory
+{
+    ERR_RESET,     /* 相手が接続をリセットした（ECONNRESET, ECONNABORTED） */
+    ERR_PIPE,      /* 相手が閉じた接続に送信した（EPIPE） */
+    ERR_TIMEOUT,   /* 再送やキープアライブがタイムアウトした（ETIMEDOUT, EHOSTUNREACH） */
+    ERR_FDS,       /* ディスクリプタが足りない（EMFILE, ENFILE） */
+    ERR_MEMORY,    /* メモリやソケットバッファが足りない（ENOMEM, ENOBUFS, EAGAIN） */
+    ERR_OTHER,     /* その他 */
+    ERR_CATEGORIES /* 種類の数 */
+};
+
+/* スレッドごとのカウンタ。書き込むのは持ち主のスレッドだけなので、ロックもアトミックな加算も要らない。
+   他のスレッドのカウンタと同じキャッシュラインに載らないよう、キャッシュラインの境界に揃える */
+struct ThreadMetrics
+{
+    _Alignas(CACHELINE) atomic_uint_fast64_t counters[MET_COUNTERS]; /* カウンタ */
+    atomic_uint_fast64_t errors[ERR_CATEGORIES];                     /* 種類ごとのエラーの回数 */
+    atomic_uint_fast64_t latency[LATENCYBUCKETS];                    /* 応答時間のヒストグラム */
+    atomic_uint_fast64_t latencySumNs;                               /* 応答時間の合計（ナノ秒） */
+    atomic_int inUse;                                                /* スレッドが使用中 */
+    struct ThreadMetrics *next;                                      /* 全スレッドのカウンタのリスト */
+};
+
+void MetricsAdd(enum MetricCounter counter, uint64_t value);
+void MetricsCountError(int err);
+void MetricsRecordLatency(uint64_t ns);
+void MetricsLatencySnapshot(uint64_t latency[LATENCYBUCKETS]);
+uint64_t MetricsNowNs(void);
+size_t MetricsFormat(char *buffer, size_t size);
+void MetricsAddFormatter(size_t (*format)(char *buffer, size_t size));
+void MetricsStartServer(unsigned short port);
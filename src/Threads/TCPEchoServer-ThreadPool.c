@@ -0,0 +1,140 @@
+#include "TCPEchoServer.h"
+#include "Admission.h"
+#include "MPMCQueue.h"
+#include "Metrics.h"
+#include "Log.h"
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+
+#define DEFAULT_WORKERS 8    /* ワーカースレッド数のデフォルト */
+#define DEFAULT_QUEUE 1024   /* キューの長さのデフォルト（2のべき乗） */
+
+/* ワーカースレッド関数 */
+void *WorkerMain(void *arg);
+
+struct MPMCQueue clntQueue; /* 受け入れたソケットを渡すキュー */
+sem_t queuedSocks;          /* キュー内のソケットの数 */
+sem_t freeSlots;            /* キューの空きの数 */
+
+int main(int argc, char *argv[])
+{
+    int servSock;                /* サーバのソケットディスクリプタ */
+    int clntSock;                /* クライアントのソケットディスクリプタ */
+    const char *servAddress;     /* サーバのポート番号、またはunix:<パス>など */
+    int numWorkers;              /* ワーカースレッドの数 */
+    int queueSize;               /* キューの長さ */
+    pthread_t threadID;          /* スレッドID */
+    int opt;                     /* getopt()の戻り値 */
+    int i;                       /* ループカウンタ */
+
+    /* 受け入れの制限のオプション（Admission.hを参照） */
+    while ((opt = getopt(argc, argv, ADMISSIONOPTS)) != -1)
+    {
+        if (!AdmissionOption(opt, optarg))
+        {
+            argc = 0; /* 不明なオプションは使い方を表示して終了 */
+            break;
+        }
+    }
+
+    /* ワーカー数は1以上。0や負の数、数でない値は使い方を表示して終了 */
+    if (argc != 0 && argc - optind >= 2 && atoi(argv[optind + 1]) < 1)
+    {
+        argc = 0;
+    }
+
+    /* 引数の数をチェック */
+    if (argc == 0 || argc - optind > 4)
+    {
+        fprintf(stderr, "Usage: %s " ADMISSIONUSAGE " [<Server Port or Address: default 7> [<Workers: default %d> [<Queue Size: default %d> [<Stats Port>]]]]\n",
+                argv[0], DEFAULT_WORKERS, DEFAULT_QUEUE);
+        exit(1);
+    }
+    argc -= optind - 1; /* 以下はオプションを除いた位置引数として数える */
+    argv += optind - 1;
+    servAddress = (argc >= 2) ? argv[1] : "7";
+    numWorkers = (argc >= 3) ? atoi(argv[2]) : DEFAULT_WORKERS;
+    queueSize = (argc >= 4) ? atoi(argv[3]) : DEFAULT_QUEUE;
+
+    /* 接続ごとのログはリングに書き、ロガースレッドがまとめて標準エラー出力に書き出す */
+    LogInit(LOG_INFO);
+
+    /* 統計ポートを指定したら、127.0.0.1のそのポートでPrometheus形式の統計を返す */
+    if (argc == 5)
+    {
+        MetricsStartServer(atoi(argv[4]));
+    }
+
+    MPMCQueueInit(&clntQueue, queueSize);
+    if (sem_init(&queuedSocks, 0, 0) < 0 || sem_init(&freeSlots, 0, queueSize) < 0)
+    {
+        DieWithError("sem_init() failed");
+    }
+
+    /* サーバのソケットを作成 */
+    servSock = CreateServerSocket(servAddress);
+
+    /* ワーカーは全ての接続で共有するので、バイト数の上限を超えた接続はワーカーを眠らせずに閉じる */
+    AdmissionShareWorkers();
+
+    /* ワーカースレッドを起動時に一度だけ生成する */
+    for (i = 0; i < numWorkers; i++)
+    {
+        if (pthread_create(&threadID, NULL, WorkerMain, NULL) != 0)
+        {
+            DieWithError("pthread_create() failed");
+        }
+        pthread_detach(threadID);
+    }
+
+    for (;;)
+    {
+        /* キューが満杯の間は受け入れを止め、接続要求をlisten()のキューに留める */
+        while (sem_wait(&freeSlots) < 0)
+        {
+            ;
+        }
+
+        /* クライアントの接続を待機（制限を超えて断った接続なら、取っておいた空きを戻して次を待つ） */
+        if ((clntSock = AcceptTCPConnection(servSock)) < 0)
+        {
+            sem_post(&freeSlots);
+            continue;
+        }
+
+        /* ソケットをキューに入れてワーカーを起こす（接続ごとのmallocやスレッド生成はしない） */
+        while (!MPMCQueuePush(&clntQueue, clntSock))
+        {
+            sched_yield();
+        }
+        sem_post(&queuedSocks);
+    }
+}
+
+void *WorkerMain(void *arg)
+{
+    int clntSock; /* クライアントのソケットディスクリプタ */
+
+    (void)arg;
+
+    for (;;)
+    {
+        /* キューにソケットが入るまで待機 */
+        while (sem_wait(&queuedSocks) < 0)
+        {
+            ;
+        }
+
+        /* 別の生産者が書き込み途中の場合は空に見えることがあるので再試行する */
+        while (!MPMCQueuePop(&clntQueue, &clntSock))
+        {
+            sched_yield();
+        }
+        sem_post(&freeSlots);
+
+        HandleTCPClient(clntSock);
+    }
+
+    return (NULL);
+}
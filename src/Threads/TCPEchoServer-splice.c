@@ -0,0 +1,113 @@
+#include "TCPEchoServer.h"
+#include "Admission.h"
+#include "ConnTable.h"
+#include "Metrics.h"
+#include "Log.h"
+#include <pthread.h>
+#include <signal.h>
+
+#define THREADSTACKSIZE 65536 /* 接続ごとのスレッドのスタックサイズ */
+
+/* メインスレッド関数 */
+void *ThreadMain(void *arg);
+
+int main(int argc, char *argv[])
+{
+    int servSock;                   /* サーバのソケットディスクリプタ */
+    int clntSock;                   /* クライアントのソケットディスクリプタ */
+    const char *servAddress;        /* サーバのポート番号、またはunix:<パス>など */
+    pthread_t threadID;             /* スレッドID */
+    pthread_attr_t threadAttr;      /* スレッドの属性 */
+    ConnHandle handle;              /* スレッドに渡す接続のハンドル */
+    int result;                     /* pthread_create()の戻り値 */
+    int opt;                        /* getopt()の戻り値 */
+
+    /* 受け入れの制限のオプション（Admission.hを参照） */
+    while ((opt = getopt(argc, argv, ADMISSIONOPTS)) != -1)
+    {
+        if (!AdmissionOption(opt, optarg))
+        {
+            argc = 0; /* 不明なオプションは使い方を表示して終了 */
+            break;
+        }
+    }
+
+    /* 引数の数をチェック */
+    if (argc == 0 || argc - optind > 2)
+    {
+        fprintf(stderr, "Usage: %s " ADMISSIONUSAGE " [<Server Port or Address: default 7> [<Stats Port>]]\n", argv[0]);
+        exit(1);
+    }
+    else if (argc - optind >= 1)
+    {
+        servAddress = argv[optind];
+    }
+    else
+    {
+        servAddress = "7";
+    }
+
+    /* 接続ごとのログはリングに書き、ロガースレッドがまとめて標準エラー出力に書き出す */
+    LogInit(LOG_INFO);
+
+    /* 統計ポートを指定したら、127.0.0.1のそのポートでPrometheus形式の統計を返す */
+    if (argc - optind == 2)
+    {
+        MetricsStartServer(atoi(argv[optind + 1]));
+    }
+
+    /* splice()にはMSG_NOSIGNALを渡せないので、閉じられた接続への送信でプロセスが終了しないようSIGPIPEを無視する */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* サーバのソケットを作成 */
+    servSock = CreateServerSocket(servAddress);
+
+    /* スレッドが使うスタックはエコーバッファ程度なので、デフォルト（8MB）を予約せず、
+       接続ごとのメモリを小さく一定にする。終了したスレッドの資源はjoinせずに解放する */
+    if ((result = pthread_attr_init(&threadAttr)) != 0 ||
+        (result = pthread_attr_setstacksize(&threadAttr, THREADSTACKSIZE)) != 0 ||
+        (result = pthread_attr_setdetachstate(&threadAttr, PTHREAD_CREATE_DETACHED)) != 0)
+    {
+        errno = result;
+        DieWithError("pthread_attr_init() failed");
+    }
+
+    for (;;)
+    {
+        /* クライアントの接続を待機（制限を超えて断った接続なら次を待つ） */
+        if ((clntSock = AcceptTCPConnection(servSock)) < 0)
+        {
+            continue;
+        }
+
+        /* 接続の状態はAcceptTCPConnection()が接続の表に載せたので、スレッドにはハンドルだけを渡す
+           （接続ごとに引数をmallocしない） */
+        handle = ConnGetHandle(clntSock);
+
+        /* クライアントスレッドを生成 */
+        if ((result = pthread_create(&threadID, &threadAttr, ThreadMain, (void *)(uintptr_t)handle)) != 0)
+        {
+            /* スレッド数の上限（EAGAIN）に達したら、この接続だけを断る */
+            MetricsCountError(result);
+            LogWrite(LOG_WARN, result, "pthread_create() failed", LOGARGS());
+            AdmissionRelease(clntSock);
+            ConnRelease(clntSock);
+            close(clntSock);
+            MetricsAdd(MET_CLOSES, 1);
+            continue;
+        }
+    }
+}
+
+void *ThreadMain(void *arg)
+{
+    ConnHandle handle = (ConnHandle)(uintptr_t)arg; /* 接続のハンドル */
+    int clntSock = (int)(uint32_t)handle;           /* クライアントのソケットディスクリプタ */
+
+    /* 受け入れスレッドはディスクリプタを渡したら閉じないので、このスレッドが閉じるまで別の接続に
+       再利用されることはなく、表を引き直して世代を確かめる必要はない */
+    /* splice()でソケット→パイプ→ソケットとデータを移し、ユーザー空間へのコピーを省く */
+    HandleTCPClientZeroCopy(clntSock);
+
+    return (NULL);
+}
@@ -1,96 +1,372 @@
+#define _GNU_SOURCE
 #include "TCPEchoServer.h"
+#include "Admission.h"
+#include "ConnTable.h"
+#include "Metrics.h"
+#include "Log.h"
+#include "../TCP-Echo/Listener.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <time.h>
 
-#define MAXPENDING 5   /* 待機中の接続要求の最大数 */
-#define RCVBUFSIZE 256 /* 受信バッファサイズ */
+#define MAXPENDING 5            /* 待機中の接続要求の最大数 */
+#define RCVBUFSIZE 256          /* 受信バッファサイズ */
+#define SPLICEPIPESIZE 1048576  /* splice()で経由するパイプの容量 */
+#define ACCEPTBACKOFFMAX_MS 100 /* accept()を再試行するまでの最大の待ち時間（ミリ秒） */
+#define IDLETIMEOUT_MS 60000    /* 何も受信しない接続を閉じるまでの時間（ミリ秒） */
+#define WRITETIMEOUT_MS 10000   /* 相手が受信せず送信が進まない接続を閉じるまでの時間（ミリ秒） */
 
+void ShedConnection(int servSock);
+void SetConnectionDeadlines(int clntSock);
+void LogClient(const struct sockaddr_storage *addr);
+void ConnectionError(char *errorMessage);
+
+/* ディスクリプタが尽きたときに、待機中の接続要求を受け入れて閉じるための予備のディスクリプタ */
+int reserveFd = -1;
+
+/* errorMessageは文字列リテラルを渡す（ロガースレッドが後から書式として読むため）。
+   リングに残っているレコードはexit()のときに書き出される */
 void DieWithError(char *errorMessage)
 {
-    perror(errorMessage);
+    LogErrno(LOG_ERROR, errorMessage);
     exit(1);
 }
 
-int CreateTCPServerSocket(unsigned short port)
+/* 待ち受けるアドレスはポート番号のほか、unix:<パス> などで指定できる（../TCP-Echo/Listener.hを参照） */
+int CreateServerSocket(const char *address)
 {
     int sock;
-    struct sockaddr_in echoServAddr;
 
-    /* サーバのソケットを作成 */
-    if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+    sock = CreateListener(address, MAXPENDING, 0);
+
+    reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    AdmissionInit();
+    ConnTableInit();
+
+    return sock;
+}
+
+/* 接続要求を1つ受け入れる。制限（Admission.hを参照）を超えた接続はすぐに閉じて-1を返すので、
+   呼び出し元は次の接続要求を待つ */
+int AcceptTCPConnection(int servSock)
+{
+    int clntSock;
+    struct sockaddr_storage echoClntAddr;
+    unsigned int clntLen;
+
+    long backoffMs = 0; /* 次に再試行するまでの待ち時間（ミリ秒） */
+    struct timespec backoff;
+
+    for (;;)
     {
-        DieWithError("socket() failed");
+        /* クライアントのアドレス構造体の長さを初期化 */
+        clntLen = sizeof(echoClntAddr);
+
+        /* クライアントからの接続要求を受け入れ */
+        if ((clntSock = accept(servSock, (struct sockaddr *)&echoClntAddr, &clntLen)) >= 0)
+        {
+            break;
+        }
+
+        /* 1つの接続要求のエラーや資源の不足でサーバー全体を止めない。
+           リスニングソケットそのものが使えない場合（EBADF, EINVALなど）だけ終了する */
+        switch (errno)
+        {
+        case EINTR:
+            continue;
+        case ECONNABORTED: /* 受け入れる前にクライアントがリセットした */
+        case EPROTO:
+        case ENETDOWN:
+        case ENETUNREACH:
+        case EHOSTUNREACH:
+        case EHOSTDOWN:
+        case ENONET:
+        case ENOPROTOOPT:
+        case EOPNOTSUPP:
+            /* Linuxでは接続要求に保留されていたネットワークのエラーがaccept()から返るので、やり直す */
+            MetricsCountError(errno);
+            continue;
+        case EMFILE:
+        case ENFILE:
+            MetricsCountError(errno);
+            ShedConnection(servSock);
+            break;
+        case ENOBUFS:
+        case ENOMEM:
+        case EPERM:
+            MetricsCountError(errno);
+            break;
+        default:
+            DieWithError("accept() failed");
+        }
+
+        /* 資源が足りないときは、ワーカーが接続を閉じて資源を返すまで待つ間隔を倍々に延ばす */
+        backoffMs = backoffMs == 0 ? 1 : backoffMs * 2;
+        if (backoffMs > ACCEPTBACKOFFMAX_MS)
+        {
+            backoffMs = ACCEPTBACKOFFMAX_MS;
+        }
+        LogErrno(LOG_WARN, "accept() failed, retrying in %lld ms", (long long)backoffMs);
+        backoff.tv_sec = backoffMs / 1000;
+        backoff.tv_nsec = backoffMs % 1000 * 1000000;
+        nanosleep(&backoff, NULL);
     }
 
-    /* サーバのアドレス構造体を作成 */
-    memset(&echoServAddr, 0, sizeof(echoServAddr));
-    echoServAddr.sin_family = AF_INET;
-    echoServAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    echoServAddr.sin_port = htons(port);
+    /* 接続ごとにprintf()するとstdoutのロックで全スレッドが直列になるので、カウンタを増やし、
+       アドレスはinet_ntoa()で文字列にせずにこのスレッドのリングに書くだけにする */
+    MetricsAdd(MET_ACCEPTS, 1);
 
-    /* サーバのアドレス構造体にソケットをバインド */
-    if (bind(sock, (struct sockaddr *)&echoServAddr, sizeof(echoServAddr)) < 0)
+    if (!AdmissionAdmit(clntSock, (struct sockaddr *)&echoClntAddr))
     {
-        DieWithError("bind() failed");
+        close(clntSock);
+        MetricsAdd(MET_CLOSES, 1);
+        return -1;
     }
+    LogClient(&echoClntAddr);
+    ConnOpen(clntSock, (struct sockaddr *)&echoClntAddr);
+    SetConnectionDeadlines(clntSock);
+
+    return clntSock;
+}
+
+/* ブロッキングの送受信に期限を付ける。接続ごとにスレッドが1つ張り付くので、
+   何も送らない・受信しないクライアントがスレッドを持ったままにならないようにする。
+   期限を過ぎるとrecv()/send()/splice()はEAGAINで戻り、ワーカーは接続を閉じる */
+void SetConnectionDeadlines(int clntSock)
+{
+    struct timeval timeout; /* 送受信の期限 */
+
+    timeout.tv_sec = IDLETIMEOUT_MS / 1000;
+    timeout.tv_usec = IDLETIMEOUT_MS % 1000 * 1000;
+    setsockopt(clntSock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    timeout.tv_sec = WRITETIMEOUT_MS / 1000;
+    timeout.tv_usec = WRITETIMEOUT_MS % 1000 * 1000;
+    setsockopt(clntSock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
 
-    /* クライアントからの接続要求を待機 */
-    if (listen(sock, MAXPENDING) < 0)
+/* クライアントのアドレスをアドレスファミリごとに整数の引数にしてリングに書く。
+   IPv4射影アドレス（デュアルスタックのソケットが受け入れたIPv4の接続）はIPv4として書く */
+void LogClient(const struct sockaddr_storage *addr)
+{
+    const struct sockaddr_in *addr4 = (const struct sockaddr_in *)addr;    /* IPv4のアドレス */
+    const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6 *)addr; /* IPv6のアドレス */
+    const uint8_t *a = addr6->sin6_addr.s6_addr;                          /* IPv6のアドレスのバイト列 */
+    struct in_addr mapped;                                                /* IPv4射影アドレスのIPv4部分 */
+
+    switch (addr->ss_family)
     {
-        DieWithError("listen() failed");
+    case AF_INET:
+        LogInfo("Handling client %lld.%lld.%lld.%lld:%lld", LOGADDR(addr4->sin_addr), (long long)ntohs(addr4->sin_port));
+        break;
+    case AF_INET6:
+        if (IN6_IS_ADDR_V4MAPPED(&addr6->sin6_addr))
+        {
+            memcpy(&mapped, a + 12, sizeof(mapped));
+            LogInfo("Handling client %lld.%lld.%lld.%lld:%lld", LOGADDR(mapped), (long long)ntohs(addr6->sin6_port));
+        }
+        else
+        {
+            /* 引数は5つまでなので、32ビットずつ4つに分けて書く */
+            LogInfo("Handling client [%llx:%llx:%llx:%llx]:%lld",
+                    (long long)((uint32_t)a[0] << 24 | a[1] << 16 | a[2] << 8 | a[3]),
+                    (long long)((uint32_t)a[4] << 24 | a[5] << 16 | a[6] << 8 | a[7]),
+                    (long long)((uint32_t)a[8] << 24 | a[9] << 16 | a[10] << 8 | a[11]),
+                    (long long)((uint32_t)a[12] << 24 | a[13] << 16 | a[14] << 8 | a[15]),
+                    (long long)ntohs(addr6->sin6_port));
+        }
+        break;
+    default:
+        LogInfo("Handling local client");
+        break;
     }
-
-    return sock;
 }
 
-int AcceptTCPConnection(int servSock)
+/* 予備のディスクリプタを閉じて空きを1つ作り、待機中の接続要求を1つ受け入れてすぐに閉じる。
+   受け入れずにおくと接続要求はlisten()のキューに残り、クライアントは応答のないまま待たされ続ける */
+void ShedConnection(int servSock)
 {
-    int clntSock;
-    struct sockaddr_in echoClntAddr;
-    unsigned int clntLen;
+    int clntSock; /* すぐに閉じるソケット */
 
-    /* クライアントのアドレス構造体の長さを初期化 */
-    clntLen = sizeof(echoClntAddr);
+    /* 前回の予備を取り戻せていなければ、今回は確保し直すだけにする */
+    if (reserveFd < 0)
+    {
+        reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        return;
+    }
 
-    /* クライアントからの接続要求を受け入れ */
-    if ((clntSock = accept(servSock, (struct sockaddr *)&echoClntAddr, &clntLen)) < 0)
+    close(reserveFd);
+    if ((clntSock = accept(servSock, NULL, NULL)) >= 0)
     {
-        DieWithError("accept() failed");
+        close(clntSock);
+        MetricsAdd(MET_SHED, 1);
     }
+    reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
 
-    printf("Handling client %s\n", inet_ntoa(echoClntAddr.sin_addr));
+/* 1つの接続のエラーはその接続を閉じるだけにし、他の接続の処理を続ける。
+   相手からのリセットは日常的に起きるので、デバッグレベルでだけ出力する */
+void ConnectionError(char *errorMessage)
+{
+    int err = errno; /* 呼び出し元のerrno */
 
-    return clntSock;
+    /* ブロッキングのソケットでEAGAINが返るのは、SO_RCVTIMEO/SO_SNDTIMEOの期限を過ぎたときだけ */
+    if (err == EAGAIN || err == EWOULDBLOCK)
+    {
+        err = ETIMEDOUT;
+    }
+
+    MetricsCountError(err);
+    LogWrite((err == ECONNRESET || err == EPIPE) ? LOG_DEBUG : LOG_WARN, err, errorMessage, LOGARGS());
 }
 
 void HandleTCPClient(int clntSocket)
 {
     char echoBuffer[RCVBUFSIZE]; /* エコー文字列のバッファ */
     int recvMsgSize;             /* 受信メッセージのサイズ */
+    int sentMsgSize;             /* 送信したメッセージのサイズ */
+    uint64_t rcvdNs;             /* 受信した時刻 */
+
+    AdmissionStart(clntSocket);
+    ConnStart(clntSocket);
 
     /* クライアントからのメッセージを受信 */
+    MetricsAdd(MET_RECV_CALLS, 1);
     if ((recvMsgSize = recv(clntSocket, echoBuffer, RCVBUFSIZE, 0)) < 0)
     {
-        DieWithError("recv() failed");
+        ConnectionError("recv() failed");
     }
 
     /* 受信したデータをクライアントにエコーバック */
     while (recvMsgSize > 0)
     {
-        /* クライアントにデータを送信 */
-        if (send(clntSocket, echoBuffer, recvMsgSize, 0) != recvMsgSize)
+        /* 送信元アドレスのバイト数の上限を超えていれば、ここで待たせる（応答時間には含めない）。
+           ワーカーを使い回すスレッドプールでは待たせずに閉じる */
+        if (!AdmissionPace(clntSocket, recvMsgSize))
         {
-            DieWithError("send() failed");
+            break;
         }
+        rcvdNs = MetricsNowNs();
+        MetricsAdd(MET_BYTES_IN, recvMsgSize);
+
+        /* クライアントにデータを送信（相手が閉じていてもSIGPIPEでプロセスを終了させない） */
+        MetricsAdd(MET_SEND_CALLS, 1);
+        if ((sentMsgSize = send(clntSocket, echoBuffer, recvMsgSize, MSG_NOSIGNAL)) != recvMsgSize)
+        {
+            /* 一部だけ送れて戻ったのは、送信の期限を過ぎたとき */
+            if (sentMsgSize >= 0)
+            {
+                errno = ETIMEDOUT;
+            }
+            ConnectionError("send() failed");
+            break;
+        }
+        MetricsAdd(MET_BYTES_OUT, recvMsgSize);
+        MetricsRecordLatency(MetricsNowNs() - rcvdNs);
+        ConnRecordEcho(clntSocket, recvMsgSize);
 
         /* クライアントからのメッセージを受信 */
+        MetricsAdd(MET_RECV_CALLS, 1);
         if ((recvMsgSize = recv(clntSocket, echoBuffer, RCVBUFSIZE, 0)) < 0)
         {
-            DieWithError("recv() failed");
+            ConnectionError("recv() failed");
         }
     }
 
-    sleep(3); /* クライアントがデータを受信するのを待つ */
-
+    AdmissionRelease(clntSocket);
+    ConnRelease(clntSocket);
     close(clntSocket); /* クライアントのソケットをクローズ */
+    MetricsAdd(MET_CLOSES, 1);
+}
+
+void HandleTCPClientZeroCopy(int clntSocket)
+{
+    int pipefd[2];   /* ソケット間でデータを受け渡すパイプ */
+    ssize_t inPipe;  /* パイプに移したバイト数 */
+    ssize_t moved;   /* パイプからソケットに移したバイト数 */
+    int spliced = 0; /* splice()でデータを移したことがある */
+    uint64_t rcvdNs; /* パイプに移した時刻 */
+    ssize_t echoed;  /* 今回移したバイト数 */
 
-    printf("\tClient disconnected: %d\n", clntSocket);
-}
\ No newline at end of file
+    AdmissionStart(clntSocket);
+    ConnStart(clntSocket);
+
+    /* パイプを作れなければ通常のコピーでエコーする */
+    if (pipe2(pipefd, O_CLOEXEC) < 0)
+    {
+        HandleTCPClient(clntSocket);
+        return;
+    }
+
+    /* 1回のsplice()で大きく移せるようパイプの容量を広げる（失敗してもデフォルトの容量で動く） */
+    fcntl(pipefd[1], F_SETPIPE_SZ, SPLICEPIPESIZE);
+
+    for (;;)
+    {
+        /* ソケット→パイプ: データをユーザー空間にコピーせず、カーネル内でページを移す */
+        MetricsAdd(MET_RECV_CALLS, 1);
+        inPipe = splice(clntSocket, NULL, pipefd[1], NULL, SPLICEPIPESIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (inPipe == 0)
+        {
+            break; /* クライアントが切断した */
+        }
+        if (inPipe < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            /* splice()に対応していないソケットなら、まだ何も移していない場合に限りコピーに切り替える */
+            if (!spliced && (errno == EINVAL || errno == ENOSYS))
+            {
+                close(pipefd[0]);
+                close(pipefd[1]);
+                HandleTCPClient(clntSocket);
+                return;
+            }
+            ConnectionError("splice() failed");
+            break;
+        }
+        spliced = 1;
+        echoed = inPipe;
+        if (!AdmissionPace(clntSocket, inPipe))
+        {
+            break;
+        }
+        rcvdNs = MetricsNowNs();
+        MetricsAdd(MET_BYTES_IN, inPipe);
+
+        /* パイプ→ソケット: パイプに入った分を全てクライアントに送る。
+           SPLICE_F_MOREを付けるとMSG_MOREと同じく送信が保留され、
+           最後の小さなセグメントが200ms近く遅れるので付けない */
+        while (inPipe > 0)
+        {
+            MetricsAdd(MET_SEND_CALLS, 1);
+            if ((moved = splice(pipefd[0], NULL, clntSocket, NULL, inPipe, SPLICE_F_MOVE)) < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                ConnectionError("splice() failed");
+                break;
+            }
+            MetricsAdd(MET_BYTES_OUT, moved);
+            inPipe -= moved;
+        }
+        if (inPipe > 0)
+        {
+            break; /* 送信に失敗した */
+        }
+        MetricsRecordLatency(MetricsNowNs() - rcvdNs);
+        ConnRecordEcho(clntSocket, echoed);
+    }
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+    AdmissionRelease(clntSocket);
+    ConnRelease(clntSocket);
+    close(clntSocket); /* クライアントのソケットをクローズ */
+    MetricsAdd(MET_CLOSES, 1);
+}
@@ -7,5 +7,6 @@
 
 void DieWithError(char *errorMessage);
 void HandleTCPClient(int clntSocket);
-int CreateTCPServerSocket(unsigned short port);
+void HandleTCPClientZeroCopy(int clntSocket);
+int CreateServerSocket(const char *address);
 int AcceptTCPConnection(int servSock);
\ No newline at end of file
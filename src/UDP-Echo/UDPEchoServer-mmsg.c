@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* エコー文字列の最大長（UDPデータグラムの最大長） */
+#define ECHOMAX 65536
+/* 1回のシステムコールで送受信するデータグラム数のデフォルト */
+#define DEFAULT_BATCH 64
+
+/* エラー処理関数 */
+void DieWithError(const char *errorMessage)
+{
+    perror(errorMessage);
+    exit(1);
+}
+
+int main(int argc, char const *argv[])
+{
+    int sock;                        /* ソケット */
+    struct sockaddr_in echoServAddr; /* エコーサーバのアドレス */
+    unsigned short echoServPort;     /* サーバのポート */
+    int batchSize;                   /* 1回に送受信するデータグラム数 */
+    struct mmsghdr *msgs;            /* データグラムごとのヘッダ */
+    struct iovec *iovecs;            /* データグラムごとのバッファ */
+    struct sockaddr_in *clntAddrs;   /* データグラムごとの送信元アドレス */
+    char *buffers;                   /* 受信バッファの実体 */
+    int numRecv;                     /* 受信したデータグラム数 */
+    int numSent;                     /* 送信したデータグラム数 */
+    int ret;                         /* sendmmsg()の戻り値 */
+    unsigned long sendErrors = 0;    /* 送信できなかったデータグラム数 */
+    int i;                           /* ループカウンタ */
+
+    /* 引数の数が正しいか確認 */
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "Usage: %s <UDP SERVER PORT> [<Batch Size: default %d>]\n", argv[0], DEFAULT_BATCH);
+        exit(1);
+    }
+
+    /* 1つ目の引数: サーバのポート */
+    echoServPort = atoi(argv[1]);
+    /* 2つ目の引数: バッチサイズ */
+    batchSize = (argc == 3) ? atoi(argv[2]) : DEFAULT_BATCH;
+    if (batchSize < 1)
+    {
+        batchSize = 1;
+    }
+
+    /* データグラムの送受信に使うソケットを作成 */
+    if ((sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+    {
+        DieWithError("socket() failed");
+    }
+
+    /* ローカルアドレス構造体を作成 */
+    memset(&echoServAddr, 0, sizeof(echoServAddr));/* 構造体をゼロで埋める */
+    echoServAddr.sin_family = AF_INET;                /* インターネットアドレスファミリ */
+    echoServAddr.sin_addr.s_addr = htonl(INADDR_ANY); /* 任意のローカルアドレス */
+    echoServAddr.sin_port = htons(echoServPort);      /* サーバのポート */
+
+    /* ソケットにアドレスをバインド */
+    if (bind(sock, (struct sockaddr *)&echoServAddr, sizeof(echoServAddr)) < 0)
+    {
+        DieWithError("bind() failed");
+    }
+
+    /* バッチ分のヘッダ・バッファ・アドレスを起動時にまとめて確保する */
+    msgs = (struct mmsghdr *)calloc(batchSize, sizeof(struct mmsghdr));
+    iovecs = (struct iovec *)calloc(batchSize, sizeof(struct iovec));
+    clntAddrs = (struct sockaddr_in *)calloc(batchSize, sizeof(struct sockaddr_in));
+    buffers = (char *)malloc((size_t)batchSize * ECHOMAX);
+    if (msgs == NULL || iovecs == NULL || clntAddrs == NULL || buffers == NULL)
+    {
+        DieWithError("malloc() failed");
+    }
+    for (i = 0; i < batchSize; i++)
+    {
+        iovecs[i].iov_base = buffers + (size_t)i * ECHOMAX;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &clntAddrs[i];
+    }
+
+    for (;;)
+    {
+        /* 入出力パラメータセット */
+        for (i = 0; i < batchSize; i++)
+        {
+            iovecs[i].iov_len = ECHOMAX;
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+
+        /* 最初の1つが届くまでブロックし、その時点で届いている分をまとめて受信する */
+        if ((numRecv = recvmmsg(sock, msgs, batchSize, MSG_WAITFORONE, NULL)) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            DieWithError("recvmmsg() failed");
+        }
+
+        /* 受信した長さだけを、受信したときのアドレスにそのままエコーバックする */
+        for (i = 0; i < numRecv; i++)
+        {
+            iovecs[i].iov_len = msgs[i].msg_len;
+        }
+
+        /* バッチ全体を1回のsendmmsg()で送信する（一部しか送れなければ残りを送り直す） */
+        for (numSent = 0; numSent < numRecv; numSent += ret)
+        {
+            if ((ret = sendmmsg(sock, msgs + numSent, numRecv - numSent, 0)) < 0)
+            {
+                if (errno == EINTR)
+                {
+                    ret = 0;
+                    continue;
+                }
+                /* ソケットそのものが使えないときだけ終了する */
+                if (errno == EBADF || errno == ENOTSOCK || errno == EFAULT)
+                {
+                    DieWithError("sendmmsg() failed");
+                }
+                /* 送信元ポートが0のデータグラムなど、先頭の1つだけが送れない。
+                   それを飛ばして、バッチの残りのクライアントにはエコーバックする。
+                   1つのクライアントから大量に届いても出力で遅くならないよう、表示は2のべき乗回目だけにする */
+                sendErrors++;
+                if ((sendErrors & (sendErrors - 1)) == 0)
+                {
+                    fprintf(stderr, "sendmmsg() failed: %s (%lu datagrams dropped)\n", strerror(errno), sendErrors);
+                }
+                ret = 1;
+            }
+        }
+    }
+
+    return 0;
+}
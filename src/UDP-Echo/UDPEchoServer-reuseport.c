@@ -0,0 +1,505 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/sock_diag.h>
+#include <sys/syscall.h>
+
+/* エコー文字列の最大長（UDPデータグラムの最大長） */
+#define ECHOMAX 65536
+/* 1回のシステムコールで送受信するデータグラム数 */
+#define BATCHSIZE 64
+/* ソケットごとの負荷を表示する間隔（秒） */
+#define STATSINTERVAL 10
+/* 受信したCPU（SO_INCOMING_CPU）を調べるバッチの間隔 */
+#define CPUSAMPLEBATCHES 16
+/* cpuの振り分けでCPUの番号とワーカーを対応させる数の上限（BPFの命令数の上限に収める） */
+#define CPUMAPMAX 1024
+
+/* ワーカースレッド関数 */
+void *WorkerMain(void *arg);
+/* SO_REUSEPORTを付けたUDPソケットを作成する */
+int CreateUDPReusePortSocket(unsigned short port);
+int *GetAllowedCPUs(int *numCPUs);
+void AttachSteeringProgram(int sock, const char *steering, long numWorkers, const int *cpus, int numCPUs);
+int AttachCPUProgramEBPF(int sock, long numWorkers, const int *cpus, int numMapped);
+void AttachCPUProgramCBPF(int sock, long numWorkers, const int *cpus, int numMapped);
+void AttachProgramCBPF(int sock, struct sock_filter *code, unsigned short len);
+
+/* ワーカースレッドに渡す構造体。カウンタは持ち主のワーカーだけが書き、
+   メインスレッドが読むだけなので、ワーカーごとに別のキャッシュラインに置く */
+struct WorkerArgs
+{
+    _Alignas(64) int sock;             /* このワーカー専用のソケット */
+    int cpu;                           /* 固定するCPU番号 */
+    atomic_uint_fast64_t datagrams;    /* 受信したデータグラムの数 */
+    atomic_uint_fast64_t bytes;        /* 受信したバイト数 */
+    atomic_uint_fast64_t samples;      /* 受信したCPUを調べた回数 */
+    atomic_uint_fast64_t localSamples; /* 受信したCPUがワーカーのCPUと同じだった回数 */
+    atomic_uint_fast64_t sendErrors;   /* 送信できずに捨てたデータグラムの数 */
+};
+
+void PrintLoad(struct WorkerArgs *workers, long numWorkers, uint64_t *lastDatagrams);
+
+/* エラー処理関数 */
+void DieWithError(const char *errorMessage)
+{
+    perror(errorMessage);
+    exit(1);
+}
+
+/* このプロセスが実行を許されたCPUの番号を小さい順に並べた配列を返し、その数をnumCPUsに入れる。
+   オンラインのCPUが0から連番とは限らず、cpusetやtasksetで一部のCPUしか使えないこともあるので、
+   sched_getaffinity()の集合から作る。返した配列は呼び出し元がfree()する */
+int *GetAllowedCPUs(int *numCPUs)
+{
+    cpu_set_t cpuset; /* 実行を許可されたCPUの集合 */
+    int *cpus;        /* CPUの番号 */
+    int cpu;          /* 調べるCPUの番号 */
+
+    if (sched_getaffinity(0, sizeof(cpuset), &cpuset) < 0)
+    {
+        DieWithError("sched_getaffinity() failed");
+    }
+    if ((cpus = (int *)malloc(sizeof(int) * CPU_COUNT(&cpuset))) == NULL)
+    {
+        DieWithError("malloc() failed");
+    }
+
+    *numCPUs = 0;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &cpuset))
+        {
+            cpus[(*numCPUs)++] = cpu;
+        }
+    }
+    return cpus;
+}
+
+int main(int argc, char const *argv[])
+{
+    unsigned short echoServPort; /* サーバのポート */
+    int *cpus;                   /* 実行を許されたCPUの番号 */
+    int numCPUs;                 /* 実行を許されたCPUの数 */
+    long numWorkers;             /* ワーカースレッドの数 */
+    const char *steering;        /* ソケットの選び方 */
+    pthread_t *threadIDs;        /* スレッドID */
+    struct WorkerArgs *workers;  /* ワーカーごとの引数 */
+    uint64_t *lastDatagrams;     /* 前回表示したときのデータグラムの数 */
+    long i;                      /* ループカウンタ */
+
+    /* 引数の数が正しいか確認 */
+    if (argc < 2 || argc > 4)
+    {
+        fprintf(stderr, "Usage: %s <UDP SERVER PORT> [<Workers: default CPUs> [<Steering: hash|cpu|field:<offset>[:<size>]>]]\n",
+                argv[0]);
+        exit(1);
+    }
+
+    echoServPort = atoi(argv[1]);
+    cpus = GetAllowedCPUs(&numCPUs);
+    numWorkers = (argc >= 3) ? atol(argv[2]) : numCPUs;
+    steering = (argc == 4) ? argv[3] : "hash";
+    if (numWorkers < 1)
+    {
+        numWorkers = 1;
+    }
+
+    if ((threadIDs = (pthread_t *)malloc(sizeof(pthread_t) * numWorkers)) == NULL ||
+        (workers = (struct WorkerArgs *)aligned_alloc(64, sizeof(struct WorkerArgs) * numWorkers)) == NULL ||
+        (lastDatagrams = (uint64_t *)calloc(numWorkers, sizeof(uint64_t))) == NULL)
+    {
+        DieWithError("malloc() failed");
+    }
+    memset(workers, 0, sizeof(struct WorkerArgs) * numWorkers);
+
+    /* ワーカーごとに同じポートのソケットを作る。
+       既定では、カーネルが送信元アドレス・ポートのハッシュでデータグラムをソケットに振り分ける。
+       i番目のワーカーは、実行を許されたCPUのi番目に固定する */
+    for (i = 0; i < numWorkers; i++)
+    {
+        workers[i].sock = CreateUDPReusePortSocket(echoServPort);
+        workers[i].cpu = cpus[i % numCPUs];
+    }
+
+    /* 振り分けのプログラムはグループ内のどれか1つのソケットに付ければ、グループ全体に効く。
+       プログラムが返す番号は、バインドした順のソケットの番号（= ワーカーの番号）になる */
+    AttachSteeringProgram(workers[0].sock, steering, numWorkers, cpus, numCPUs);
+    free(cpus);
+
+    for (i = 0; i < numWorkers; i++)
+    {
+        if (pthread_create(&threadIDs[i], NULL, WorkerMain, (void *)&workers[i]) != 0)
+        {
+            DieWithError("pthread_create() failed");
+        }
+    }
+
+    printf("%ld workers listening on UDP port %d (steering: %s)\n", numWorkers, echoServPort, steering);
+
+    /* ワーカーは終了しないので、メインスレッドはソケットごとの負荷を一定間隔で表示し続ける */
+    for (;;)
+    {
+        sleep(STATSINTERVAL);
+        PrintLoad(workers, numWorkers, lastDatagrams);
+    }
+
+    return 0;
+}
+
+/* SO_REUSEPORTのグループに、データグラムを届けるソケットを選ぶプログラムを付ける。
+     hash                 カーネルの既定（送信元・宛先のアドレスとポートのハッシュ）
+     cpu                  データグラムを受信したCPUに固定したワーカー。割り込みを処理したCPUのワーカーが
+                          そのまま受け取り、キャッシュが他のCPUに移らない。どのワーカーも固定していない
+                          CPUで受信したときは、CPUの番号をソケット数で割った余りのソケットが受け取る
+     field:<off>[:<size>] ペイロードのoffバイト目からsize（1, 2, 4。既定は4）バイトの値。
+                          クライアントが付けたフローIDなどで振り分け、重いクライアントを1つのソケットに集めない
+   プログラムが返した番号をソケット数で割った余りのソケットが受け取る */
+void AttachSteeringProgram(int sock, const char *steering, long numWorkers, const int *cpus, int numCPUs)
+{
+    unsigned int offset;                    /* 振り分けに使うフィールドの位置 */
+    unsigned int size = 4;                  /* 振り分けに使うフィールドのバイト数 */
+    unsigned short loadSize;                /* フィールドを読み込む命令の大きさ */
+    int numMapped;                          /* ワーカーと対応させるCPUの数 */
+    struct sock_filter fieldProgram[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, 0},           /* A = ペイロードのフィールド（命令とオフセットは後で埋める） */
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, numWorkers}, /* A %= ソケット数 */
+        {BPF_RET | BPF_A, 0, 0, 0},                    /* Aの番号のソケットを選ぶ */
+    };                                      /* フィールドで振り分けるプログラム */
+
+    if (strcmp(steering, "hash") == 0)
+    {
+        return;
+    }
+    else if (strcmp(steering, "cpu") == 0)
+    {
+        /* ワーカーiはcpus[i]に固定しているので、その番号のCPUで受信したらソケットiを選ぶ */
+        numMapped = numWorkers < numCPUs ? (int)numWorkers : numCPUs;
+        if (numMapped > CPUMAPMAX)
+        {
+            numMapped = CPUMAPMAX;
+        }
+        /* eBPFを読み込めなければ（権限がない、カーネルが古いなど）、同じことをするclassic BPFを使う */
+        if (AttachCPUProgramEBPF(sock, numWorkers, cpus, numMapped) == 0)
+        {
+            printf("Attached eBPF reuseport program\n");
+            return;
+        }
+        AttachCPUProgramCBPF(sock, numWorkers, cpus, numMapped);
+    }
+    else if (sscanf(steering, "field:%u:%u", &offset, &size) >= 1)
+    {
+        switch (size)
+        {
+        case 1:
+            loadSize = BPF_B;
+            break;
+        case 2:
+            loadSize = BPF_H;
+            break;
+        case 4:
+            loadSize = BPF_W;
+            break;
+        default:
+            fprintf(stderr, "Field size must be 1, 2 or 4\n");
+            exit(1);
+        }
+        /* UDPのreuseportのプログラムには、UDPヘッダを取り除いたペイロードの先頭が0バイト目として渡される。
+           データグラムがフィールドより短いと読み込みに失敗して0を返すので、ソケット0が受け取る */
+        fieldProgram[0].code = BPF_LD | loadSize | BPF_ABS;
+        fieldProgram[0].k = offset;
+        AttachProgramCBPF(sock, fieldProgram, sizeof(fieldProgram) / sizeof(fieldProgram[0]));
+    }
+    else
+    {
+        fprintf(stderr, "Unknown steering: %s\n", steering);
+        exit(1);
+    }
+
+    printf("Attached classic BPF reuseport program\n");
+}
+
+/* 受信したCPUに固定したワーカーのソケットを選ぶeBPFのプログラムを読み込んで付ける。
+   cpus[i]のCPUならiを返し、どれでもなければCPUの番号をソケット数で割った余りを返す。
+   bpf()にはCAP_BPF（またはroot）が要るので、読み込めなければ-1を返す */
+int AttachCPUProgramEBPF(int sock, long numWorkers, const int *cpus, int numMapped)
+{
+    struct bpf_insn program[3 * CPUMAPMAX + 3]; /* プログラム */
+    int len = 0;                                /* プログラムの命令数 */
+    union bpf_attr attr;                        /* bpf()の引数 */
+    int progFd;                                 /* 読み込んだプログラム */
+    int result;                                 /* setsockopt()の戻り値 */
+    int i;
+
+    memset(program, 0, sizeof(program));
+    /* r0 = CPUの番号 */
+    program[len++] = (struct bpf_insn){.code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_get_smp_processor_id};
+    for (i = 0; i < numMapped; i++)
+    {
+        /* r0がcpus[i]でなければ次の比較へ進み、そうならr0 = iで終える */
+        program[len++] = (struct bpf_insn){.code = BPF_JMP | BPF_JNE | BPF_K, .dst_reg = BPF_REG_0, .off = 2, .imm = cpus[i]};
+        program[len++] = (struct bpf_insn){.code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_0, .imm = i};
+        program[len++] = (struct bpf_insn){.code = BPF_JMP | BPF_EXIT};
+    }
+    /* r0 %= ソケット数として、r0の番号のソケットを選ぶ */
+    program[len++] = (struct bpf_insn){.code = BPF_ALU | BPF_MOD | BPF_K, .dst_reg = BPF_REG_0, .imm = numWorkers};
+    program[len++] = (struct bpf_insn){.code = BPF_JMP | BPF_EXIT};
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+    attr.insns = (uint64_t)(uintptr_t)program;
+    attr.insn_cnt = len;
+    attr.license = (uint64_t)(uintptr_t) "GPL";
+
+    if ((progFd = syscall(SYS_bpf, BPF_PROG_LOAD, &attr, sizeof(attr))) < 0)
+    {
+        return -1;
+    }
+
+    /* 付けた後はソケットがプログラムを参照し続けるので、ディスクリプタは閉じてよい */
+    result = setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_EBPF, &progFd, sizeof(progFd));
+    close(progFd);
+    return result < 0 ? -1 : 0;
+}
+
+/* AttachCPUProgramEBPF()と同じ振り分けを、classic BPF（SKF_AD_CPU）で付ける */
+void AttachCPUProgramCBPF(int sock, long numWorkers, const int *cpus, int numMapped)
+{
+    struct sock_filter program[2 * CPUMAPMAX + 3]; /* プログラム */
+    unsigned short len = 0;                        /* プログラムの命令数 */
+    int i;
+
+    /* A = 受信したCPUの番号 */
+    program[len++] = (struct sock_filter){BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU};
+    for (i = 0; i < numMapped; i++)
+    {
+        /* Aがcpus[i]なら、iの番号のソケットを選ぶ */
+        program[len++] = (struct sock_filter){BPF_JMP | BPF_JEQ | BPF_K, 0, 1, (unsigned int)cpus[i]};
+        program[len++] = (struct sock_filter){BPF_RET | BPF_K, 0, 0, (unsigned int)i};
+    }
+    /* A %= ソケット数として、Aの番号のソケットを選ぶ */
+    program[len++] = (struct sock_filter){BPF_ALU | BPF_MOD | BPF_K, 0, 0, numWorkers};
+    program[len++] = (struct sock_filter){BPF_RET | BPF_A, 0, 0, 0};
+
+    AttachProgramCBPF(sock, program, len);
+}
+
+void AttachProgramCBPF(int sock, struct sock_filter *code, unsigned short len)
+{
+    struct sock_fprog program = {len, code}; /* プログラム */
+
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) < 0)
+    {
+        DieWithError("setsockopt(SO_ATTACH_REUSEPORT_CBPF) failed");
+    }
+}
+
+/* ソケットごとに、前回からのデータグラムの数、受信したCPUがワーカーのCPUと同じだった割合、
+   受信キューが溢れて捨てられた数を表示する。振り分けが偏っていれば、数の差と捨てられた数に現れる */
+void PrintLoad(struct WorkerArgs *workers, long numWorkers, uint64_t *lastDatagrams)
+{
+    uint32_t meminfo[SK_MEMINFO_VARS]; /* ソケットのメモリと破棄の情報 */
+    socklen_t len;                     /* meminfoの長さ */
+    uint64_t datagrams;                /* 受信したデータグラムの数 */
+    uint64_t samples;                  /* 受信したCPUを調べた回数 */
+    uint64_t total = 0;                /* 全ソケットで前回から受信したデータグラムの数 */
+    char local[16];                    /* 受信したCPUがワーカーのCPUと同じだった割合 */
+    long i;
+
+    for (i = 0; i < numWorkers; i++)
+    {
+        total += atomic_load_explicit(&workers[i].datagrams, memory_order_relaxed) - lastDatagrams[i];
+    }
+    if (total == 0)
+    {
+        return;
+    }
+
+    for (i = 0; i < numWorkers; i++)
+    {
+        datagrams = atomic_load_explicit(&workers[i].datagrams, memory_order_relaxed);
+        samples = atomic_load_explicit(&workers[i].samples, memory_order_relaxed);
+        if (samples > 0)
+        {
+            snprintf(local, sizeof(local), "%.0f%%",
+                     100.0 * atomic_load_explicit(&workers[i].localSamples, memory_order_relaxed) / samples);
+        }
+        else
+        {
+            snprintf(local, sizeof(local), "n/a");
+        }
+        len = sizeof(meminfo);
+        if (getsockopt(workers[i].sock, SOL_SOCKET, SO_MEMINFO, meminfo, &len) < 0)
+        {
+            meminfo[SK_MEMINFO_DROPS] = 0;
+        }
+        printf("socket %ld (CPU %d): %llu datagrams (%.1f%%), %llu bytes total, %s on own CPU, %u drops, "
+               "%llu send errors\n",
+               i, workers[i].cpu, (unsigned long long)(datagrams - lastDatagrams[i]),
+               100.0 * (datagrams - lastDatagrams[i]) / total,
+               (unsigned long long)atomic_load_explicit(&workers[i].bytes, memory_order_relaxed),
+               local,
+               meminfo[SK_MEMINFO_DROPS],
+               (unsigned long long)atomic_load_explicit(&workers[i].sendErrors, memory_order_relaxed));
+        lastDatagrams[i] = datagrams;
+    }
+    fflush(stdout);
+}
+
+int CreateUDPReusePortSocket(unsigned short port)
+{
+    int sock;                        /* ソケット */
+    int on = 1;                      /* ソケットオプションの値 */
+    struct sockaddr_in echoServAddr; /* エコーサーバのアドレス */
+
+    /* データグラムの送受信に使うソケットを作成 */
+    if ((sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+    {
+        DieWithError("socket() failed");
+    }
+
+    /* 同じポートに複数のソケットをバインドできるようにする */
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    {
+        DieWithError("setsockopt(SO_REUSEPORT) failed");
+    }
+
+    /* ローカルアドレス構造体を作成 */
+    memset(&echoServAddr, 0, sizeof(echoServAddr));
+    echoServAddr.sin_family = AF_INET;
+    echoServAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    echoServAddr.sin_port = htons(port);
+
+    /* ソケットにアドレスをバインド */
+    if (bind(sock, (struct sockaddr *)&echoServAddr, sizeof(echoServAddr)) < 0)
+    {
+        DieWithError("bind() failed");
+    }
+
+    return sock;
+}
+
+void *WorkerMain(void *arg)
+{
+    struct WorkerArgs *worker = (struct WorkerArgs *)arg; /* ワーカーの引数 */
+    cpu_set_t cpuset;                                     /* 実行を許可するCPUの集合 */
+    struct mmsghdr msgs[BATCHSIZE];                       /* データグラムごとのヘッダ */
+    struct iovec iovecs[BATCHSIZE];                       /* データグラムごとのバッファ */
+    struct sockaddr_in clntAddrs[BATCHSIZE];              /* データグラムごとの送信元アドレス */
+    char *buffers;                                        /* 受信バッファの実体 */
+    int numRecv;                                          /* 受信したデータグラム数 */
+    int numSent;                                          /* 送信したデータグラム数 */
+    int ret;                                              /* sendmmsg()の戻り値 */
+    int i;                                                /* ループカウンタ */
+    unsigned int batches = 0;                             /* 受信したバッチの数 */
+    int incomingCpu;                                      /* 最後に受信したデータグラムを処理したCPU */
+    socklen_t len;                                        /* incomingCpuの長さ */
+    size_t bytes;                                         /* バッチのバイト数 */
+
+    /* ワーカーをCPUに固定し、受信からエコーバックまで同じCPUのキャッシュで処理する */
+    CPU_ZERO(&cpuset);
+    CPU_SET(worker->cpu, &cpuset);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+    {
+        fprintf(stderr, "pthread_setaffinity_np() failed for CPU %d\n", worker->cpu);
+    }
+
+    /* バッファは固定したCPUで確保し、そのCPUに近いメモリに置く */
+    if ((buffers = (char *)malloc((size_t)BATCHSIZE * ECHOMAX)) == NULL)
+    {
+        DieWithError("malloc() failed");
+    }
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < BATCHSIZE; i++)
+    {
+        iovecs[i].iov_base = buffers + (size_t)i * ECHOMAX;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &clntAddrs[i];
+    }
+
+    for (;;)
+    {
+        /* 入出力パラメータセット */
+        for (i = 0; i < BATCHSIZE; i++)
+        {
+            iovecs[i].iov_len = ECHOMAX;
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+
+        /* このワーカーのソケットに届いたデータグラムをまとめて受信する */
+        if ((numRecv = recvmmsg(worker->sock, msgs, BATCHSIZE, MSG_WAITFORONE, NULL)) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            DieWithError("recvmmsg() failed");
+        }
+
+        bytes = 0;
+        for (i = 0; i < numRecv; i++)
+        {
+            iovecs[i].iov_len = msgs[i].msg_len;
+            bytes += msgs[i].msg_len;
+        }
+
+        /* カウンタを書くのはこのワーカーだけなので、ロックもアトミックな加算も要らない */
+        atomic_store_explicit(&worker->datagrams, atomic_load_explicit(&worker->datagrams, memory_order_relaxed) + numRecv,
+                              memory_order_relaxed);
+        atomic_store_explicit(&worker->bytes, atomic_load_explicit(&worker->bytes, memory_order_relaxed) + bytes,
+                              memory_order_relaxed);
+
+        /* ときどき、ソフト割り込みでデータグラムを処理したCPUがこのワーカーのCPUと同じかを調べる。
+           カーネルが記録していなければ-1が返るので数えない */
+        len = sizeof(incomingCpu);
+        if (++batches % CPUSAMPLEBATCHES == 0 &&
+            getsockopt(worker->sock, SOL_SOCKET, SO_INCOMING_CPU, &incomingCpu, &len) == 0 && incomingCpu >= 0)
+        {
+            atomic_store_explicit(&worker->samples, atomic_load_explicit(&worker->samples, memory_order_relaxed) + 1,
+                                  memory_order_relaxed);
+            if (incomingCpu == worker->cpu)
+            {
+                atomic_store_explicit(&worker->localSamples,
+                                      atomic_load_explicit(&worker->localSamples, memory_order_relaxed) + 1,
+                                      memory_order_relaxed);
+            }
+        }
+
+        /* まとめてエコーバック */
+        for (numSent = 0; numSent < numRecv; numSent += ret)
+        {
+            if ((ret = sendmmsg(worker->sock, msgs + numSent, numRecv - numSent, 0)) < 0)
+            {
+                if (errno == EINTR)
+                {
+                    ret = 0;
+                    continue;
+                }
+                /* ソケットそのものが使えないときだけ終了する */
+                if (errno == EBADF || errno == ENOTSOCK || errno == EFAULT)
+                {
+                    DieWithError("sendmmsg() failed");
+                }
+                /* 先頭の1つが送れない（送信元ポートが0など）。それを数えて飛ばし、残りを送る */
+                atomic_store_explicit(&worker->sendErrors,
+                                      atomic_load_explicit(&worker->sendErrors, memory_order_relaxed) + 1,
+                                      memory_order_relaxed);
+                ret = 1;
+            }
+        }
+    }
+
+    return (NULL);
+}